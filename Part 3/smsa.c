@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 
 // Project Include files
 #include <smsa.h>
@@ -28,7 +29,6 @@
 // Defines
 //#define SMSA_BLOCK_ADDRESS(drum,blk) ((smsa_disk_array[drum])+(blk*SMSA_BLOCK_SIZE))
 #define SMSA_BLOCK_ADDRESS(drum,blk) &smsa_disk_array[drum][blk*SMSA_BLOCK_SIZE]
-// #define SMSA_STORAGE_ENABLED
 #define SMSA_ROW(x) ((int)x/4)
 #define SMSA_COL(x) (x%4)
 #define SMSA_DIFF(x,y) ((x>y) ? (x-y) : (y-x))
@@ -36,15 +36,36 @@
 //
 // Library global data
 
-static uint8_t				smsa_library_initialized = 0;	// Flag indicating the library init occurred
-static uint32_t				smsa_mount_state = 0;  			// Mount state (0=not mounted, 1=mounted)
-SMSA_ERROR_LEVEL			smsa_error_number = 0;			// This is the current error number
-
-// This is the disk array itself
-static uint8_t				smsa_drum_head; // The current drum under eval
-static uint32_t				smsa_read_head; // The current read position on the drum
+static pthread_once_t			smsa_library_initialized = PTHREAD_ONCE_INIT;	// Makes sure the library init occurs once
+static uint32_t				smsa_mount_state = 0;  			// Number of sessions that have the array mounted
+static int				smsa_storage_enabled = 0;		// Keep the array in SMSA_DISK_FILE across mounts
+__thread SMSA_ERROR_LEVEL		smsa_error_number = 0;			// This is the current error number (per thread)
+
+// Sessions can run on different threads at once.  The mount lock covers
+// the mount count and bringing the array up and down, a session that has
+// the array mounted keeps it up so its operations never take it.  Each
+// drum has its own reader/writer lock: reads of a drum share it, writes
+// and formats have it to themselves, and drums never wait on each other.
+static pthread_mutex_t			smsa_mount_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t			smsa_drum_lock[SMSA_DISK_ARRAY_SIZE] = {
+						[0 ... SMSA_DISK_ARRAY_SIZE-1] = PTHREAD_RWLOCK_INITIALIZER };
+
+// This is the disk array itself, the heads live in the sessions
 static unsigned char		       *smsa_disk_array[SMSA_DISK_ARRAY_SIZE]; // The disk memory
-static unsigned long                    smsa_cycle_count = 0; // This is the clock count for the SMSA
+static unsigned long                    smsa_cycle_count = 0; // This is the clock count for the SMSA (all sessions)
+static SMSA_SESSION			smsa_default_session; // Used by callers that pass no session
+
+// Array memory lent out by smsa_operation_pin.  A pinned drum memory is
+// never changed: the next write to the drum moves the drum to a copy and
+// the old memory is retired until its last pin is given back.  The pin
+// lock covers the counts, the list and swapping a drum's memory (which is
+// also done with the drum's write lock held).  The record that retires a
+// drum's memory is made when it is first pinned, so retiring it never
+// has to allocate.
+static pthread_mutex_t			smsa_pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t				smsa_drum_pins[SMSA_DISK_ARRAY_SIZE]; // Pins on each drum's memory
+static SMSA_RETIRED		       *smsa_drum_retire[SMSA_DISK_ARRAY_SIZE]; // Record ready to retire it
+static SMSA_RETIRED		       *smsa_retired = NULL; // Replaced drum memory still pinned
 
 // This is the text associated with the SMSA operation (commands)
 static const char *smsa_op_text[] = {
@@ -54,9 +75,16 @@ static const char *smsa_op_text[] = {
 		"SMSA_SEEK_BLOCK",	// Seek to a block in the current drum
 		"SMSA_DISK_READ",	// Read from the disk
 		"SMSA_DISK_WRITE",	// Write to the disk
-		"SMSA_GET_STATE",	// Get the current disk state (unimplemented)
+		"SMSA_GET_STATE",	// Get the current disk state (drum content hashes)
 		"SMSA_BLOCK_SIGN",  // Generate a signature for a block (and output to log)
 		"SMSA_FORMAT_DRUM",	// Format the current drum (zeros)
+		"SMSA_DISK_READ_EXTENT",	// Read a run of blocks from the disk
+		"SMSA_DISK_WRITE_EXTENT",	// Write a run of blocks to the disk
+		"SMSA_DISK_READ_AT",	// Seek to a drum/block and read it
+		"SMSA_DISK_WRITE_AT",	// Seek to a drum/block and write it
+		"SMSA_DISK_FILL",	// Fill a run of blocks with one byte value
+		"SMSA_DISK_WRITE_PART",	// Write part of a block
+		"SMSA_DISK_COPY",	// Copy a run of blocks to another place
 };
 
 // This is the text associated with the SMSA disk error
@@ -77,21 +105,44 @@ static const char *smsa_error_text[] = {
 
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_library_init
+// Description  : Setup the virtual hardware initial state (first call only)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void smsa_library_init( void ) {
+
+	// Setup the virtual hardware initial state
+	smsa_mount_state  = 0;
+	smsa_error_number = SMSA_NO_ERROR;
+	memset( smsa_disk_array, 0x0, sizeof(smsa_disk_array) );
+	return;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_operation
 // Description  : This is the external interface to the disk array.
 //
-// Inputs       : op - the operation encoded structure
+// Inputs       : session - the client's head state and cycles (NULL for the default)
+//                op - the operation encoded structure
 //              : block - the block of data to operate on
 // Outputs      : 0 if successful test, -1 if failure
 
-int smsa_operation( uint32_t op, unsigned char *block ) {
+int smsa_operation( SMSA_SESSION *session, uint32_t op, unsigned char *block ) {
 
 	// Local variables
-	int retcode = 0;
+	int retcode = 0, cost;
 	SMSA_OPERATION dop;
 
+	// Sessionless callers all share one set of heads
+	if ( session == NULL ) {
+		session = &smsa_default_session;
+	}
+
 	// Decode the command and log it if verbose
 	if ( decode_SMSA_operation(&dop, op, block) ) {
 		logMessage( LOG_ERROR_LEVEL, "Unable to decode SMSA operation [%lu]", op );
@@ -101,58 +152,87 @@ int smsa_operation( uint32_t op, unsigned char *block ) {
 
 
 	// Check to see if this is the first time we have called the library
-	if ( smsa_library_initialized == 0 ) {
+	pthread_once( &smsa_library_initialized, smsa_library_init );
 
-		// Setup the virtual hardware initial state
-		smsa_mount_state  = 0;
-		smsa_error_number = SMSA_NO_ERROR;
-		memset( smsa_disk_array, 0x0, sizeof(smsa_disk_array) );
-		smsa_library_initialized = 1;
-	}
-
-	// Count the cycles the operation will take
-	smsa_cycle_count += operation_cycle_cost( dop.cmd, dop.did, dop.bid );
+	// Count the cycles the operation will take, against the session's own
+	// heads, for the session and for the array as a whole
+	cost = operation_cycle_cost( session, dop.cmd, dop.did, dop.bid, dop.len/SMSA_BLOCK_SIZE );
+	session->cycle_count += cost;
+	__atomic_fetch_add( &smsa_cycle_count, cost, __ATOMIC_RELAXED );
 
 	// Perform the disk operation
 	switch (dop.cmd) {
 
 		case SMSA_MOUNT: // Mount the disk array
-			retcode = SMSAMountArray();
+			retcode = SMSAMountArray( session );
 			break;
 
 		case SMSA_UNMOUNT: // Unmount the disk array
-			retcode = SMSAUnmountArray();
+			retcode = SMSAUnmountArray( session );
 			break;
 
 		case SMSA_SEEK_DRUM: // See to a new drum
-			retcode = SMSASeekDrum( dop.did );
+			retcode = SMSASeekDrum( session, dop.did );
 			break;
 
 		case SMSA_SEEK_BLOCK: // Seek to a disk address in the current drum
-			retcode = SMSASeekBlock( dop.bid );
+			retcode = SMSASeekBlock( session, dop.bid );
 			break;
 
 		case SMSA_DISK_READ: // Read from the disk
-			retcode = SMSAReadBlock( block );
+			retcode = SMSAReadBlock( session, block );
 			break;
 
 		case SMSA_DISK_WRITE: // Write to the disk
-			retcode = SMSAWriteBlock( block );
+			retcode = SMSAWriteBlock( session, block );
 			break;
 
-		case SMSA_GET_STATE: // Get the current disk state (unimplemented)
-			logMessage( LOG_ERROR_LEVEL, "Get state UNIMPLEMENTED, ignoring" );
-			retcode = 0;
+		case SMSA_GET_STATE: // Get the current disk state (drum content hashes)
+			retcode = SMSAGetState( block );
 			break;
 
 		case SMSA_FORMAT_DRUM: // Format the current drum (zeros)
-			retcode = SMSAFormatDrum();
+			retcode = SMSAFormatDrum( session );
 			break;
 
 		case SMSA_BLOCK_SIGN: // Generate a signature for a block (and output to log)
 			retcode = SMSABlockSign( dop.did, dop.bid );
 			break;
 
+		case SMSA_DISK_READ_EXTENT: // Read a run of blocks from the disk
+			retcode = SMSAReadExtent( session, block, dop.len/SMSA_BLOCK_SIZE );
+			break;
+
+		case SMSA_DISK_WRITE_EXTENT: // Write a run of blocks to the disk
+			retcode = SMSAWriteExtent( session, block, dop.len/SMSA_BLOCK_SIZE );
+			break;
+
+		case SMSA_DISK_READ_AT: // Seek to a drum/block and read it
+			retcode = SMSASeekAt( session, dop.did, dop.bid );
+			if ( retcode == 0 ) {
+				retcode = SMSAReadBlock( session, block );
+			}
+			break;
+
+		case SMSA_DISK_WRITE_AT: // Seek to a drum/block and write it
+			retcode = SMSASeekAt( session, dop.did, dop.bid );
+			if ( retcode == 0 ) {
+				retcode = SMSAWriteBlock( session, block );
+			}
+			break;
+
+		case SMSA_DISK_FILL: // Fill a run of blocks with one byte value
+			retcode = SMSAFillExtent( session, dop.bid, dop.len/SMSA_BLOCK_SIZE );
+			break;
+
+		case SMSA_DISK_WRITE_PART: // Write part of a block
+			retcode = SMSAWritePart( session, block, dop.bid, dop.len );
+			break;
+
+		case SMSA_DISK_COPY: // Copy a run of blocks to another place
+			retcode = SMSACopyExtent( session, dop.did, dop.bid, dop.len/SMSA_BLOCK_SIZE );
+			break;
+
 		default: logMessage( LOG_ERROR_LEVEL, "OP Illegal disk command [%u]", dop.cmd );
 			retcode = -1;
 			break;
@@ -162,6 +242,90 @@ int smsa_operation( uint32_t op, unsigned char *block ) {
 	return( retcode );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_operation_pin
+// Description  : Run an extent read without copying the blocks: they are
+//                pinned where they are on the array and stay as they are
+//                until given back with smsa_unpin, however the array
+//                changes.  The heads move and the cycles count exactly as
+//                for the read through smsa_operation.
+//
+// Inputs       : session - the client's head state and cycles (NULL for the default)
+//                op - the operation encoded structure (an extent read)
+//                pins - where the pins go (SMSA_MAX_PINS of them)
+// Outputs      : the number of pins taken, -1 if failure
+
+int smsa_operation_pin( SMSA_SESSION *session, uint32_t op, SMSA_PIN *pins ) {
+
+	// Local variables
+	int cost;
+	SMSA_OPERATION dop;
+
+	// Sessionless callers all share one set of heads
+	if ( session == NULL ) {
+		session = &smsa_default_session;
+	}
+
+	// Decode the command (the pins stand in for the block), only extent
+	// reads can be pinned
+	if ( decode_SMSA_operation(&dop, op, (unsigned char *)pins) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to decode SMSA operation [%lu]", op );
+	}
+	if ( dop.cmd != SMSA_DISK_READ_EXTENT ) {
+		logMessage( LOG_ERROR_LEVEL, "OP cannot pin disk command [%u]", dop.cmd );
+		smsa_error_number = SMSA_BAD_OPCODE;
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "SMSA Array received operation [%s/did=%d,blk=%d]",
+			smsa_op_text[dop.cmd], dop.did, dop.bid );
+
+	// Check to see if this is the first time we have called the library
+	pthread_once( &smsa_library_initialized, smsa_library_init );
+
+	// Count the cycles as the copying read would
+	cost = operation_cycle_cost( session, dop.cmd, dop.did, dop.bid, dop.len/SMSA_BLOCK_SIZE );
+	session->cycle_count += cost;
+	__atomic_fetch_add( &smsa_cycle_count, cost, __ATOMIC_RELAXED );
+
+	return( SMSAPinExtent(session, pins, dop.len/SMSA_BLOCK_SIZE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_unpin
+// Description  : Give back array memory pinned by smsa_operation_pin,
+//                freeing a retired drum memory with its last pin
+//
+// Inputs       : pin - the pin
+// Outputs      : none
+
+void smsa_unpin( SMSA_PIN *pin ) {
+
+	// Local variables
+	SMSA_RETIRED **old, *gone;
+
+	pthread_mutex_lock( &smsa_pin_lock );
+	if ( smsa_disk_array[pin->drum] == pin->image ) {
+		smsa_drum_pins[pin->drum] --;
+	} else {
+		for ( old=&smsa_retired; *old!=NULL; old=&(*old)->next ) {
+			if ( (*old)->image != pin->image ) {
+				continue;
+			}
+			if ( --(*old)->pins == 0 ) {
+				gone = *old;
+				*old = gone->next;
+				free( gone->image );
+				free( gone );
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock( &smsa_pin_lock );
+	return;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_error_string
@@ -199,22 +363,25 @@ int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
 
 	// Check for sane signature address
 	if ( drum >= SMSA_DISK_ARRAY_SIZE ) {
-		logMessage( LOG_ERROR_LEVEL, "Illegal signature drum [%u/%u]",	smsa_drum_head, smsa_read_head );
+		logMessage( LOG_ERROR_LEVEL, "Illegal signature drum [%u/%u]",	drum, block );
 		smsa_error_number =	SMSA_BAD_DRUM_ID;
 		return( -1 );
 	}
 	if ( block >= SMSA_DISK_SIZE ) {
-		logMessage( LOG_ERROR_LEVEL, "Illegal signature block [%u/%u]",	smsa_drum_head, smsa_read_head );
+		logMessage( LOG_ERROR_LEVEL, "Illegal signature block [%u/%u]",	drum, block );
 		smsa_error_number =	SMSA_BAD_BLOCK_ID;
 		return( -1 );
 	}
 
 	// Now do the signature and check the result
+	pthread_rwlock_rdlock( &smsa_drum_lock[drum] );
 	if ( generate_md5_signature( block_address(drum,block), SMSA_BLOCK_SIZE, sig, &slen) ) {
+		pthread_rwlock_unlock( &smsa_drum_lock[drum] );
 		logMessage( LOG_ERROR_LEVEL, "Signature failed (%d/%d]", drum, block );
 		smsa_error_number =	SMSA_SIG_FAIL;
 		return( -1 );
 	}
+	pthread_rwlock_unlock( &smsa_drum_lock[drum] );
 
 	// Log the string byte for the message
 	bufToString( sig, slen, sigstr, CMPSC311_HASH_LENGTH*4 );
@@ -235,7 +402,57 @@ int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
 unsigned long smsa_get_cycle_count( void ) {
 
 	// Return the cycle count
-	return( smsa_cycle_count );
+	return( __atomic_load_n(&smsa_cycle_count, __ATOMIC_RELAXED) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_init_session
+// Description  : Setup a session: heads at the start of the array, no
+//                cycles yet, array not mounted
+//
+// Inputs       : session - the session to setup
+// Outputs      : none
+
+void smsa_init_session( SMSA_SESSION *session ) {
+
+	memset( session, 0x0, sizeof(SMSA_SESSION) );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_close_session
+// Description  : End a session, letting go of the array if the client
+//                never unmounted it
+//
+// Inputs       : session - the session to end
+// Outputs      : 0 if successful test, -1 if failure
+
+int smsa_close_session( SMSA_SESSION *session ) {
+
+	// A session that leaves mounted still holds the array
+	if ( session->mounted ) {
+		logMessage( LOG_INFO_LEVEL, "Session closed with the array mounted, unmounting." );
+		return( SMSAUnmountArray(session) );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_storage
+// Description  : Keep the array contents in SMSA_DISK_FILE between an
+//                unmount and the next mount instead of starting from zeros
+//
+// Inputs       : enabled - 1 to store/load the array, 0 to start empty
+// Outputs      : none
+
+void smsa_set_storage( int enabled ) {
+
+	// Takes effect at the next mount/unmount
+	smsa_storage_enabled = enabled;
+	return;
 }
 
 //
@@ -244,22 +461,36 @@ unsigned long smsa_get_cycle_count( void ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : SMSAMountArray
-// Description  : Mount the array (load from disk or init)
+// Description  : Mount the array for a session (load from disk or init
+//                when it is the first session to mount it)
 //
-// Inputs       : none
+// Inputs       : session - the session mounting
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSAMountArray( void ) {
+int SMSAMountArray( SMSA_SESSION *session ) {
 
 	// Local variables
 	int i;
 
 	// See if already mounted
-	if ( smsa_mount_state ) {
+	if ( session->mounted ) {
 		logMessage( LOG_INFO_LEVEL, "Trying to mount already mounted disk array, ignoring." );
 		return( 0 );
 	}
 
+	// Every session starts at the beginning of the array
+	session->mounted = 1;
+	session->drum_head = 0;
+	session->read_head = 0;
+
+	// Another session has the array already, just share it
+	pthread_mutex_lock( &smsa_mount_lock );
+	if ( smsa_mount_state++ ) {
+		logMessage( LOG_INFO_LEVEL, "Joined mounted disk array (%u sessions).", smsa_mount_state );
+		pthread_mutex_unlock( &smsa_mount_lock );
+		return( 0 );
+	}
+
 	// Mounting operation begin
 	logMessage( LOG_INFO_LEVEL, "Mounting the disk array ..." );
 
@@ -268,65 +499,78 @@ int SMSAMountArray( void ) {
 		smsa_disk_array[i] = malloc( SMSA_DISK_SIZE );
 		memset( smsa_disk_array[i], 0x0, SMSA_DISK_SIZE );
 	}
-	smsa_drum_head = 0;
-	smsa_read_head = 0;
 
-	// Mounting operation finished, set appropriate flag
+	// Mounting operation finished
 	logMessage( LOG_INFO_LEVEL, "Mounted the disk array successfully." );
-	smsa_mount_state  = 1;
 
-#if SMSA_STORAGE_ENABLED
 	// Try to load the disk array from disk file or format disks if not available
-	if ( SMSALoadArray() != 0 ) {
+	if ( smsa_storage_enabled && (SMSALoadArray() != 0) ) {
 		logMessage( LOG_INFO_LEVEL, "No mount data or failed, resetting disk data." );
 
 		// Initialize the disk array data
 		for (  i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-			SMSASeekDrum( i );
-			SMSAFormatDrum();
+			SMSASeekDrum( session, i );
+			SMSAFormatDrum( session );
 		}
 	}
-#endif
 
 	// Return successfully
+	pthread_mutex_unlock( &smsa_mount_lock );
 	return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : SMSAUmountArray
-// Description  : Unmount the array, saving to disk if possible
+// Description  : Unmount the array for a session, saving it to disk if
+//                possible once the last session lets go of it
 //
-// Inputs       : none
+// Inputs       : session - the session unmounting
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSAUnmountArray( void ) {
+int SMSAUnmountArray( SMSA_SESSION *session ) {
 
 	// Local variables
 	int i;
 
 	// See if already mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		logMessage( LOG_INFO_LEVEL, "Trying to unmount unmounted disk array, ignoring." );
 		return( 0 );
 	}
+	session->mounted = 0;
+	session->drum_head = 0;
+	session->read_head = 0;
+
+	// Other sessions are still using the array
+	pthread_mutex_lock( &smsa_mount_lock );
+	if ( --smsa_mount_state ) {
+		logMessage( LOG_INFO_LEVEL, "Left mounted disk array (%u sessions).", smsa_mount_state );
+		pthread_mutex_unlock( &smsa_mount_lock );
+		return( 0 );
+	}
 
 	// Mounting operation begin
 	logMessage( LOG_INFO_LEVEL, "Unmounting the disk array ..." );
 
-	// Store contents, deallocate the data from the array, reset disk heads
-#if SMSA_STORAGE_ENABLED
-	SMSAStoreArray();
-#endif
+	// Store contents, deallocate the data from the array
+	if ( smsa_storage_enabled ) {
+		SMSAStoreArray();
+	}
+	pthread_mutex_lock( &smsa_pin_lock );
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		free( smsa_disk_array[i] );
+		// Pinned memory is retired, it is freed with its last pin
+		if ( smsa_drum_pins[i] > 0 ) {
+			SMSARetireDrum( i );
+		} else {
+			free( smsa_disk_array[i] );
+		}
 		smsa_disk_array[i] = NULL;
 	}
-	smsa_drum_head = 0;
-	smsa_read_head = 0;
-	smsa_mount_state = 0;
+	pthread_mutex_unlock( &smsa_pin_lock );
 
 	// Return successfully
+	pthread_mutex_unlock( &smsa_mount_lock );
 	return( 0 );
 }
 
@@ -335,13 +579,14 @@ int SMSAUnmountArray( void ) {
 // Function     : SMSASeekDrum
 // Description  : Seek to another drum in the array
 //
-// Inputs       : none
+// Inputs       : session - the session whose head moves
+//                did - the drum to move to
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSASeekDrum( SMSA_DRUM_ID did ) {
+int SMSASeekDrum( SMSA_SESSION *session, SMSA_DRUM_ID did ) {
 
 	// Check to see if the disk array has been mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		logMessage( LOG_ERROR_LEVEL, "Trying to seek on unmounted array." );
 			smsa_error_number = SMSA_UNMOUNTED_DISK;
 		return( -1 );
@@ -358,8 +603,8 @@ int SMSASeekDrum( SMSA_DRUM_ID did ) {
 	}
 
 	// Move to the drum and return successfully
-	smsa_drum_head = did;
-	smsa_read_head = 0;
+	session->drum_head = did;
+	session->read_head = 0;
 	return( 0 );
 }
 
@@ -368,20 +613,21 @@ int SMSASeekDrum( SMSA_DRUM_ID did ) {
 // Function     : SMSASeekBlock
 // Description  : Seek to a block in the array
 //
-// Inputs       : none
+// Inputs       : session - the session whose head moves
+//                blk - the block to move to
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSASeekBlock( SMSA_BLOCK_ID blk ) {
+int SMSASeekBlock( SMSA_SESSION *session, SMSA_BLOCK_ID blk ) {
 
 	// Check to see if the disk array has been mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		logMessage( LOG_ERROR_LEVEL, "Trying to seek on unmounted array." );
 			smsa_error_number = SMSA_UNMOUNTED_DISK;
 		return( -1 );
 	}
 
 	// Storing operation begin
-	logMessage( LOG_INFO_LEVEL, "Seeking new block [%u] on current disk [%d]", blk, smsa_drum_head );
+	logMessage( LOG_INFO_LEVEL, "Seeking new block [%u] on current disk [%d]", blk, session->drum_head );
 
 	// Check for legal disk
 	if ( blk >= SMSA_MAX_BLOCK_ID ) {
@@ -391,43 +637,64 @@ int SMSASeekBlock( SMSA_BLOCK_ID blk ) {
 	}
 
 	// Move to the drum and return successfully
-	smsa_read_head = blk;
+	session->read_head = blk;
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSASeekAt
+// Description  : Move the heads to a drum/block the way a driver would,
+//                seeking the drum only if the heads are on another one
+//
+// Inputs       : session - the session whose heads move
+//                did - the drum to move to
+//                blk - the block to move to
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSASeekAt( SMSA_SESSION *session, SMSA_DRUM_ID did, SMSA_BLOCK_ID blk ) {
+
+	// Only changing drums resets the read head
+	if ( (did != session->drum_head) && (SMSASeekDrum(session, did) == -1) ) {
+		return( -1 );
+	}
+	return( SMSASeekBlock(session, blk) );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : SMSAReadBlock
 // Description  : Read a block from the current read head positions
 //
-// Inputs       : block - the buffer to place the data in
+// Inputs       : session - the session whose heads to read at
+//                block - the buffer to place the data in
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSAReadBlock( unsigned char *block ) {
+int SMSAReadBlock( SMSA_SESSION *session, unsigned char *block ) {
 
 	// Storing operation begin
-	logMessage( LOG_INFO_LEVEL, "Reading drum/block [%u/%u]", smsa_drum_head, smsa_read_head );
-	assert( smsa_drum_head < SMSA_DISK_ARRAY_SIZE );
-	assert( smsa_read_head < SMSA_MAX_BLOCK_ID );
+	logMessage( LOG_INFO_LEVEL, "Reading drum/block [%u/%u]", session->drum_head, session->read_head );
 
 	// Check to see if the disk array has been mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		logMessage( LOG_ERROR_LEVEL, "Trying to read on unmounted array." );
 			smsa_error_number = SMSA_UNMOUNTED_DISK;
 		return( -1 );
 	}
 
 	// Check to make sure that we are in a good read place
-	if ( (smsa_drum_head >= SMSA_DISK_ARRAY_SIZE) || (smsa_read_head >= SMSA_MAX_BLOCK_ID) ) {
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) || (session->read_head >= SMSA_MAX_BLOCK_ID) ) {
 		logMessage( LOG_ERROR_LEVEL, "Illegal read drum/block [%u/%u]",
-				smsa_drum_head, smsa_read_head );
+				session->drum_head, session->read_head );
 		smsa_error_number = SMSA_BAD_READ;
 		return( -1 );
 	}
 
 	// Now do the read and return successfully
-	memcpy( block, SMSA_BLOCK_ADDRESS(smsa_drum_head,smsa_read_head), SMSA_BLOCK_SIZE );
-	smsa_read_head ++;
+	pthread_rwlock_rdlock( &smsa_drum_lock[session->drum_head] );
+	memcpy( block, SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head), SMSA_BLOCK_SIZE );
+	pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+	session->read_head ++;
 	return( 0 );
 }
 
@@ -436,34 +703,504 @@ int SMSAReadBlock( unsigned char *block ) {
 // Function     : SMSAWriteBlock
 // Description  : Write a block to the current read head positions
 //
-// Inputs       : block - the buffer to obtain data to write
+// Inputs       : session - the session whose heads to write at
+//                block - the buffer to obtain data to write
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSAWriteBlock( unsigned char *block ) {
+int SMSAWriteBlock( SMSA_SESSION *session, unsigned char *block ) {
 
-	// Log the write, check to see if current position sane
-	logMessage( LOG_INFO_LEVEL, "Write drum/block [%u/%u]", smsa_drum_head, smsa_read_head );
-	assert( smsa_drum_head < SMSA_DISK_ARRAY_SIZE );
-	assert( smsa_read_head < SMSA_MAX_BLOCK_ID );
+	// Log the write
+	logMessage( LOG_INFO_LEVEL, "Write drum/block [%u/%u]", session->drum_head, session->read_head );
 
 	// Check to see if the disk array has been mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		logMessage( LOG_ERROR_LEVEL, "Trying to write on unmounted array." );
 			smsa_error_number = SMSA_UNMOUNTED_DISK;
 		return( -1 );
 	}
 
 	// Check the write for sanity
-	if ( (smsa_drum_head >= SMSA_DISK_ARRAY_SIZE) || (smsa_read_head >= SMSA_MAX_BLOCK_ID) ) {
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) || (session->read_head >= SMSA_MAX_BLOCK_ID) ) {
 		logMessage( LOG_ERROR_LEVEL, "Illegal write drum/block [%u/%u]",
-				smsa_drum_head, smsa_read_head );
+				session->drum_head, session->read_head );
 		smsa_error_number = SMSA_BAD_WRITE;
 		return( -1 );
 	}
 
 	// Now do the read and return successfully
-	memcpy( SMSA_BLOCK_ADDRESS(smsa_drum_head,smsa_read_head), block, SMSA_BLOCK_SIZE );
-	smsa_read_head ++;
+	pthread_rwlock_wrlock( &smsa_drum_lock[session->drum_head] );
+	if ( SMSAUnshareDrum(session->drum_head, 1) == -1 ) {
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+	memcpy( SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head), block, SMSA_BLOCK_SIZE );
+	pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+	session->read_head ++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAWritePart
+// Description  : Write some bytes of the block at the current read head
+//                positions, the rest of it stays as it was.  The head
+//                moves on as for a write.
+//
+// Inputs       : session - the session whose heads to write at
+//                bytes - the bytes to write
+//                offset - where in the block they go
+//                len - the number of them
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAWritePart( SMSA_SESSION *session, unsigned char *bytes, uint32_t offset, uint32_t len ) {
+
+	// Log the write, check to see if current position sane
+	logMessage( LOG_INFO_LEVEL, "Write drum/block [%u/%u] bytes [%u+%u]",
+			session->drum_head, session->read_head, offset, len );
+
+	// Check to see if the disk array has been mounted
+	if ( ! session->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to write on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the write for sanity
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) || (session->read_head >= SMSA_MAX_BLOCK_ID) ||
+			(bytes == NULL) || (offset+len > SMSA_BLOCK_SIZE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal write drum/block [%u/%u] bytes [%u+%u]",
+				session->drum_head, session->read_head, offset, len );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+
+	// Now patch the block and return successfully
+	pthread_rwlock_wrlock( &smsa_drum_lock[session->drum_head] );
+	if ( SMSAUnshareDrum(session->drum_head, 1) == -1 ) {
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+	memcpy( SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head)+offset, bytes, len );
+	pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+	session->read_head ++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAReadExtent
+// Description  : Read a run of blocks from the current read head positions,
+//                as that many reads would: the head moves on a block each
+//                time and onto the start of the next drum at the end of one
+//
+// Inputs       : session - the session whose heads to read at
+//                block - the buffer to place the data in (blocks of them)
+//                blocks - the number of blocks to read
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAReadExtent( SMSA_SESSION *session, unsigned char *block, uint32_t blocks ) {
+
+	// Local variables
+	uint32_t done, n;
+
+	// Log the read, check to see if the disk array has been mounted
+	logMessage( LOG_INFO_LEVEL, "Reading drum/block [%u/%u] for %u blocks",
+			session->drum_head, session->read_head, blocks );
+	if ( ! session->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to read on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the whole run is on the array before moving the heads
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) ||
+			((SMSA_DISK_ARRAY_SIZE-session->drum_head)*SMSA_MAX_BLOCK_ID-session->read_head < blocks) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal read drum/block [%u/%u] for %u blocks",
+				session->drum_head, session->read_head, blocks );
+		smsa_error_number = SMSA_BAD_READ;
+		return( -1 );
+	}
+
+	// Read as much as each drum has, holding its lock once
+	for ( done=0; done<blocks; done+=n ) {
+		if ( session->read_head >= SMSA_MAX_BLOCK_ID ) {
+			session->drum_head ++;
+			session->read_head = 0;
+		}
+		n = SMSA_MAX_BLOCK_ID-session->read_head;
+		if ( n > blocks-done ) {
+			n = blocks-done;
+		}
+		pthread_rwlock_rdlock( &smsa_drum_lock[session->drum_head] );
+		memcpy( &block[done*SMSA_BLOCK_SIZE], SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head),
+				n*SMSA_BLOCK_SIZE );
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		session->read_head += n;
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAWriteExtent
+// Description  : Write a run of blocks at the current read head positions,
+//                moving the heads as that many writes would
+//
+// Inputs       : session - the session whose heads to write at
+//                block - the buffer to obtain data to write (blocks of them)
+//                blocks - the number of blocks to write
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAWriteExtent( SMSA_SESSION *session, unsigned char *block, uint32_t blocks ) {
+
+	// Local variables
+	uint32_t done, n;
+
+	// Log the write, check to see if the disk array has been mounted
+	logMessage( LOG_INFO_LEVEL, "Write drum/block [%u/%u] for %u blocks",
+			session->drum_head, session->read_head, blocks );
+	if ( ! session->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to write on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the whole run is on the array before moving the heads
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) ||
+			((SMSA_DISK_ARRAY_SIZE-session->drum_head)*SMSA_MAX_BLOCK_ID-session->read_head < blocks) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal write drum/block [%u/%u] for %u blocks",
+				session->drum_head, session->read_head, blocks );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+
+	// Write as much as each drum takes, holding its lock once
+	for ( done=0; done<blocks; done+=n ) {
+		if ( session->read_head >= SMSA_MAX_BLOCK_ID ) {
+			session->drum_head ++;
+			session->read_head = 0;
+		}
+		n = SMSA_MAX_BLOCK_ID-session->read_head;
+		if ( n > blocks-done ) {
+			n = blocks-done;
+		}
+		pthread_rwlock_wrlock( &smsa_drum_lock[session->drum_head] );
+		if ( SMSAUnshareDrum(session->drum_head, 1) == -1 ) {
+			pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+			smsa_error_number = SMSA_BAD_WRITE;
+			return( -1 );
+		}
+		memcpy( SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head), &block[done*SMSA_BLOCK_SIZE],
+				n*SMSA_BLOCK_SIZE );
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		session->read_head += n;
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAFillExtent
+// Description  : Write a run of blocks all holding one byte value at the
+//                current read head positions, moving the heads as that
+//                many writes would
+//
+// Inputs       : session - the session whose heads to write at
+//                value - the byte every block is filled with
+//                blocks - the number of blocks to fill
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAFillExtent( SMSA_SESSION *session, unsigned char value, uint32_t blocks ) {
+
+	// Local variables
+	uint32_t done, n;
+
+	// Log the fill, check to see if the disk array has been mounted
+	logMessage( LOG_INFO_LEVEL, "Fill drum/block [%u/%u] for %u blocks with [%u]",
+			session->drum_head, session->read_head, blocks, value );
+	if ( ! session->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to write on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the whole run is on the array before moving the heads
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) ||
+			((SMSA_DISK_ARRAY_SIZE-session->drum_head)*SMSA_MAX_BLOCK_ID-session->read_head < blocks) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal write drum/block [%u/%u] for %u blocks",
+				session->drum_head, session->read_head, blocks );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+
+	// Fill as much as each drum takes, holding its lock once
+	for ( done=0; done<blocks; done+=n ) {
+		if ( session->read_head >= SMSA_MAX_BLOCK_ID ) {
+			session->drum_head ++;
+			session->read_head = 0;
+		}
+		n = SMSA_MAX_BLOCK_ID-session->read_head;
+		if ( n > blocks-done ) {
+			n = blocks-done;
+		}
+		pthread_rwlock_wrlock( &smsa_drum_lock[session->drum_head] );
+		if ( SMSAUnshareDrum(session->drum_head, 1) == -1 ) {
+			pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+			smsa_error_number = SMSA_BAD_WRITE;
+			return( -1 );
+		}
+		memset( SMSA_BLOCK_ADDRESS(session->drum_head,session->read_head), value, n*SMSA_BLOCK_SIZE );
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		session->read_head += n;
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSACopyExtent
+// Description  : Copy a run of blocks from the current read head positions
+//                to the drum/block given, as reading them and then seeking
+//                there and writing them would.  The runs may overlap, the
+//                whole run is read before any of it is written.
+//
+// Inputs       : session - the session whose heads to copy from
+//                did - the drum to copy to
+//                blk - the block to copy to
+//                blocks - the number of blocks to copy
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSACopyExtent( SMSA_SESSION *session, SMSA_DRUM_ID did, SMSA_BLOCK_ID blk, uint32_t blocks ) {
+
+	// Local variables
+	unsigned char *run;
+	int ret;
+
+	// Check the place copied to holds the whole run before moving the heads
+	logMessage( LOG_INFO_LEVEL, "Copy drum/block [%u/%u] to [%u/%u] for %u blocks",
+			session->drum_head, session->read_head, did, blk, blocks );
+	if ( (did >= SMSA_DISK_ARRAY_SIZE) ||
+			((SMSA_DISK_ARRAY_SIZE-did)*SMSA_MAX_BLOCK_ID-blk < blocks) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal copy to drum/block [%u/%u] for %u blocks",
+				did, blk, blocks );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+
+	// Read the run, then write it where it goes
+	if ( (run = malloc(blocks*SMSA_BLOCK_SIZE)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failed allocating copy of %u blocks", blocks );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+	ret = SMSAReadExtent( session, run, blocks );
+	if ( ret == 0 ) {
+		ret = SMSASeekAt( session, did, blk );
+	}
+	if ( ret == 0 ) {
+		ret = SMSAWriteExtent( session, run, blocks );
+	}
+	free( run );
+
+	// Return the status
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAPinExtent
+// Description  : Pin a run of blocks at the current read head positions
+//                instead of reading them, moving the heads as the read
+//                would.  Each drum the run is on gives one pin.
+//
+// Inputs       : session - the session whose heads to read at
+//                pins - where the pins go (SMSA_MAX_PINS of them)
+//                blocks - the number of blocks to pin
+// Outputs      : the number of pins taken, -1 if failure
+
+int SMSAPinExtent( SMSA_SESSION *session, SMSA_PIN *pins, uint32_t blocks ) {
+
+	// Local variables
+	uint32_t done, n;
+	int count = 0;
+
+	// Log the read, check to see if the disk array has been mounted
+	logMessage( LOG_INFO_LEVEL, "Pinning drum/block [%u/%u] for %u blocks",
+			session->drum_head, session->read_head, blocks );
+	if ( ! session->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to read on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the whole run is on the array (and fits the pins) before
+	// moving the heads
+	if ( (session->drum_head >= SMSA_DISK_ARRAY_SIZE) || (blocks > SMSA_MAX_EXTENT) ||
+			((SMSA_DISK_ARRAY_SIZE-session->drum_head)*SMSA_MAX_BLOCK_ID-session->read_head < blocks) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal read drum/block [%u/%u] for %u blocks",
+				session->drum_head, session->read_head, blocks );
+		smsa_error_number = SMSA_BAD_READ;
+		return( -1 );
+	}
+
+	// Pin as much as each drum has
+	for ( done=0; done<blocks; done+=n ) {
+		if ( session->read_head >= SMSA_MAX_BLOCK_ID ) {
+			session->drum_head ++;
+			session->read_head = 0;
+		}
+		n = SMSA_MAX_BLOCK_ID-session->read_head;
+		if ( n > blocks-done ) {
+			n = blocks-done;
+		}
+		pthread_rwlock_rdlock( &smsa_drum_lock[session->drum_head] );
+		pthread_mutex_lock( &smsa_pin_lock );
+		if ( (smsa_drum_retire[session->drum_head] == NULL) &&
+				((smsa_drum_retire[session->drum_head] = malloc(sizeof(SMSA_RETIRED))) == NULL) ) {
+			pthread_mutex_unlock( &smsa_pin_lock );
+			pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+			logMessage( LOG_ERROR_LEVEL, "Unable to pin drum [%u]", session->drum_head );
+			while ( count > 0 ) {
+				smsa_unpin( &pins[--count] );
+			}
+			smsa_error_number = SMSA_BAD_READ;
+			return( -1 );
+		}
+		pins[count].data = SMSA_BLOCK_ADDRESS( session->drum_head, session->read_head );
+		pins[count].len = n*SMSA_BLOCK_SIZE;
+		pins[count].drum = session->drum_head;
+		pins[count].image = smsa_disk_array[session->drum_head];
+		smsa_drum_pins[session->drum_head] ++;
+		pthread_mutex_unlock( &smsa_pin_lock );
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		session->read_head += n;
+		count ++;
+	}
+
+	// Return successfully
+	return( count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAUnshareDrum
+// Description  : Make sure a drum's memory is not pinned before changing
+//                it.  If it is, the drum moves to new memory (a copy, or
+//                left for the caller to fill) and the pinned memory is
+//                retired.  Called with the drum's write lock held.
+//
+// Inputs       : did - the drum about to change
+//                copy - 1 to copy the contents to the new memory
+// Outputs      : 0 if successful (or not pinned), -1 if failure
+
+int SMSAUnshareDrum( SMSA_DRUM_ID did, int copy ) {
+
+	// Local variables
+	unsigned char *image = NULL;
+
+	pthread_mutex_lock( &smsa_pin_lock );
+	if ( smsa_drum_pins[did] == 0 ) {
+		pthread_mutex_unlock( &smsa_pin_lock );
+		return( 0 );
+	}
+	if ( (image = malloc(SMSA_DISK_SIZE)) == NULL ) {
+		pthread_mutex_unlock( &smsa_pin_lock );
+		logMessage( LOG_ERROR_LEVEL, "Unable to move pinned drum [%u]", did );
+		return( -1 );
+	}
+	if ( copy ) {
+		memcpy( image, smsa_disk_array[did], SMSA_DISK_SIZE );
+	}
+
+	// Retire the pinned memory with its pins, the drum starts over
+	SMSARetireDrum( did );
+	smsa_disk_array[did] = image;
+	pthread_mutex_unlock( &smsa_pin_lock );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSARetireDrum
+// Description  : Put a pinned drum's memory on the retired list with its
+//                pins, using the record made when it was first pinned.
+//                The drum is left with no memory and no pins, and the
+//                pin lock has to be held.
+//
+// Inputs       : did - the pinned drum
+// Outputs      : none
+
+void SMSARetireDrum( SMSA_DRUM_ID did ) {
+
+	// Local variables
+	SMSA_RETIRED *old = smsa_drum_retire[did];
+
+	smsa_drum_retire[did] = NULL;
+	old->image = smsa_disk_array[did];
+	old->pins = smsa_drum_pins[did];
+	old->next = smsa_retired;
+	smsa_retired = old;
+	smsa_disk_array[did] = NULL;
+	smsa_drum_pins[did] = 0;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAGetState
+// Description  : Fill the block with a 64 bit content hash of every drum
+//                (FNV-1a over the drum's 64 bit words, network byte order),
+//                so clients can tell whether a drum changed since they
+//                last looked at it.  Does not move the heads.
+//
+// Inputs       : block - the block to place the hashes in
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAGetState( unsigned char *block ) {
+
+	// Local variables
+	uint64_t hash, word;
+	int i, j;
+
+	// Check for a sane block to place the state in
+	if ( block == NULL ) {
+		smsa_error_number = SMSA_BAD_READ;
+		return( -1 );
+	}
+
+	// Check if the drum array has been mounted, and keep it that way
+	pthread_mutex_lock( &smsa_mount_lock );
+	if ( ! smsa_mount_state ) {
+		pthread_mutex_unlock( &smsa_mount_lock );
+		smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Hash each drum, most significant byte first
+	memset( block, 0x0, SMSA_BLOCK_SIZE );
+	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
+		hash = 0xcbf29ce484222325ULL;
+		pthread_rwlock_rdlock( &smsa_drum_lock[i] );
+		for ( j=0; j<SMSA_DISK_SIZE; j+=sizeof(word) ) {
+			memcpy( &word, &smsa_disk_array[i][j], sizeof(word) );
+			hash = (hash ^ word) * 0x100000001b3ULL;
+		}
+		pthread_rwlock_unlock( &smsa_drum_lock[i] );
+		for ( j=0; j<SMSA_STATE_HASH_SIZE; j++ ) {
+			block[i*SMSA_STATE_HASH_SIZE+j] = (hash >> (8*(SMSA_STATE_HASH_SIZE-1-j))) & 0xff;
+		}
+	}
+
+	// Return successfully
+	pthread_mutex_unlock( &smsa_mount_lock );
 	return( 0 );
 }
 
@@ -472,33 +1209,39 @@ int SMSAWriteBlock( unsigned char *block ) {
 // Function     : SMSAFormatDrum
 // Description  : Format the drum at the current head location
 //
-// Inputs       : none
+// Inputs       : session - the session whose heads pick the drum
 // Outputs      : 0 if successful test, -1 if failure
 
-int SMSAFormatDrum( void ) {
+int SMSAFormatDrum( SMSA_SESSION *session ) {
 
 	// Log the format
-	logMessage( LOG_INFO_LEVEL, "Formatting drum [%u] ...", smsa_drum_head );
+	logMessage( LOG_INFO_LEVEL, "Formatting drum [%u] ...", session->drum_head );
 
 	// Check if the drum array has been mounted
-	if ( ! smsa_mount_state ) {
+	if ( ! session->mounted ) {
 		smsa_error_number = SMSA_UNMOUNTED_DISK;
 		return( -1 );
 	}
 
 	// Check if we are on a legal drum
-	if ( smsa_drum_head >= SMSA_DISK_ARRAY_SIZE ) {
+	if ( session->drum_head >= SMSA_DISK_ARRAY_SIZE ) {
 		smsa_error_number = SMSA_ILLEGAL_DRUM;
 		return( -1 );
 	}
 
 	// Zero the disk contents, reset the read head
-	memset( smsa_disk_array[smsa_drum_head], 0x0, SMSA_DISK_SIZE );
-	smsa_drum_head = 0;
-	smsa_read_head = 0;
+	pthread_rwlock_wrlock( &smsa_drum_lock[session->drum_head] );
+	if ( SMSAUnshareDrum(session->drum_head, 0) == -1 ) {
+		pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+		return( -1 );
+	}
+	memset( smsa_disk_array[session->drum_head], 0x0, SMSA_DISK_SIZE );
+	pthread_rwlock_unlock( &smsa_drum_lock[session->drum_head] );
+	session->drum_head = 0;
+	session->read_head = 0;
 
 	// Log the format completion
-	logMessage( LOG_INFO_LEVEL, "Formatting drum [%u] completed successfully.", smsa_drum_head );
+	logMessage( LOG_INFO_LEVEL, "Formatting drum [%u] completed successfully.", session->drum_head );
 
 	// Return successfully
 	return( 0 );
@@ -615,8 +1358,11 @@ int decode_SMSA_operation( SMSA_OPERATION *dop, uint32_t op, unsigned char *bloc
 	 *
 	 * 	0-5		- command number (6-bits)
 	 * 	6-9		- drum identifier (4-bits)
-	 * 	10-23	- RESERVED (unused)
-	 * 	24-31	- block address (8-bits)
+	 * 	10-15	- RESERVED (unused)
+	 * 	16-23	- extent length in blocks (8-bits, extents, fills and
+	 * 		  copies only, the byte count of a partial write)
+	 * 	24-31	- block address (8-bits, the byte value for a fill and
+	 * 		  the offset in the block for a partial write)
 	 *
 	 */
 
@@ -655,6 +1401,29 @@ int decode_SMSA_operation( SMSA_OPERATION *dop, uint32_t op, unsigned char *bloc
 		dop->blk = NULL;
 	}
 
+	// Extents move a run of blocks from the head on, a fill writes one
+	// and a copy moves one within the array, both without any data
+	if ( (dop->cmd == SMSA_DISK_READ_EXTENT) || (dop->cmd == SMSA_DISK_WRITE_EXTENT) ||
+			(dop->cmd == SMSA_DISK_FILL) || (dop->cmd == SMSA_DISK_COPY) ) {
+		dop->len = SMSA_EXTENTLEN(op)*SMSA_BLOCK_SIZE;
+		if ( (dop->len == 0) || ((block == NULL) && (dop->cmd != SMSA_DISK_FILL) &&
+				(dop->cmd != SMSA_DISK_COPY)) ) {
+			logMessage( LOG_ERROR_LEVEL, "Decoded empty extent [%lu]", op );
+			smsa_error_number = SMSA_BAD_OPCODE;
+			return( -1 );
+		}
+	}
+
+	// A partial write carries its bytes for somewhere inside one block
+	if ( dop->cmd == SMSA_DISK_WRITE_PART ) {
+		dop->len = SMSA_EXTENTLEN(op);
+		if ( (dop->len == 0) || (block == NULL) || (dop->bid+dop->len > SMSA_BLOCK_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "Decoded bad partial write [%lu]", op );
+			smsa_error_number = SMSA_BAD_OPCODE;
+			return( -1 );
+		}
+	}
+
 	// Return successfully
 	return( 0 );
 }
@@ -724,15 +1493,18 @@ unsigned char * block_address( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid ) {
 // Function     : opperation_cycle_cost
 // Description  : This function calculates the cycle cost of an operation
 //
-// Inputs       : cmd - the operatio to perform
+// Inputs       : session - the session whose heads the operation moves
+//                cmd - the operatio to perform
 //                did - the drum identifier
 //                bid - the block identifier
 // Outputs      : the pointer to the block in memory
 
-int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid ) {
+int operation_cycle_cost( SMSA_SESSION *session, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t blocks ) {
 
     // Local variables
     int cost = 0;
+    uint32_t head, i;
+    SMSA_DRUM_ID drum, next;
 
     // Perform the disk operation
     switch (cmd) {
@@ -746,13 +1518,13 @@ int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID
 	    break;
 
 	case SMSA_SEEK_DRUM: // See to a new drum
-	    cost = SMSA_DIFF(SMSA_ROW(smsa_drum_head),SMSA_ROW(did));
-            cost = SMSA_DIFF(SMSA_COL(smsa_drum_head),SMSA_COL(did));
+	    cost = SMSA_DIFF(SMSA_ROW(session->drum_head),SMSA_ROW(did));
+            cost = SMSA_DIFF(SMSA_COL(session->drum_head),SMSA_COL(did));
 	    cost *= 1000;
 	    break;
     
 	case SMSA_SEEK_BLOCK: // Seek to a disk address in the current drum
-	    cost = SMSA_DIFF(smsa_read_head,bid)*10;
+	    cost = SMSA_DIFF(session->read_head,bid)*10;
 	    break;
 
 	case SMSA_DISK_READ: // Read from the disk
@@ -760,11 +1532,11 @@ int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID
 	    break;
 
 	case SMSA_DISK_WRITE: // Write to the disk
+	case SMSA_DISK_WRITE_PART: // Write part of a block
 	    cost = 200;
 	    break;
 
-	case SMSA_GET_STATE: // Get the current disk state (unimplemented)
-	    logMessage( LOG_ERROR_LEVEL, "Get state UNIMPLEMENTED, ignoring" );
+	case SMSA_GET_STATE: // Get the current disk state (drum content hashes)
 	    cost = 0;
 	    break;
 
@@ -776,6 +1548,69 @@ int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID
 	    cost = 0;
 	    break;
 
+	case SMSA_DISK_READ_AT: // Seek to a drum/block and read it
+	case SMSA_DISK_WRITE_AT: // Seek to a drum/block and write it
+	    // Costs the drum seek (if changing drums), the block seek and
+	    // the read or write, just as the separate operations would
+	    head = session->read_head;
+	    if ( did != session->drum_head ) {
+		cost = SMSA_DIFF(SMSA_COL(session->drum_head),SMSA_COL(did))*1000;
+		head = 0;
+	    }
+	    cost += SMSA_DIFF(head,bid)*10;
+	    cost += (cmd == SMSA_DISK_READ_AT) ? 50 : 200;
+	    break;
+
+	case SMSA_DISK_READ_EXTENT: // Read a run of blocks from the disk
+	case SMSA_DISK_WRITE_EXTENT: // Write a run of blocks to the disk
+	case SMSA_DISK_FILL: // Fill a run of blocks with one byte value
+	    // Costs what the reads or writes would, plus a drum seek each
+	    // time the run goes on to the next drum (a fill is writes)
+	    drum = session->drum_head;
+	    head = session->read_head;
+	    for ( i=0; i<blocks; i++, head++ ) {
+		if ( head >= SMSA_MAX_BLOCK_ID ) {
+		    next = drum+1;
+		    cost += SMSA_DIFF(SMSA_COL(drum),SMSA_COL(next))*1000;
+		    drum = next;
+		    head = 0;
+		}
+		cost += (cmd == SMSA_DISK_READ_EXTENT) ? 50 : 200;
+	    }
+	    break;
+
+	case SMSA_DISK_COPY: // Copy a run of blocks to another place
+	    // Costs the reads of the run from the heads, the seek from where
+	    // they end to the drum/block in the opcode and then the writes
+	    drum = session->drum_head;
+	    head = session->read_head;
+	    for ( i=0; i<blocks; i++, head++ ) {
+		if ( head >= SMSA_MAX_BLOCK_ID ) {
+		    next = drum+1;
+		    cost += SMSA_DIFF(SMSA_COL(drum),SMSA_COL(next))*1000;
+		    drum = next;
+		    head = 0;
+		}
+		cost += 50;
+	    }
+	    if ( did != drum ) {
+		cost += SMSA_DIFF(SMSA_COL(drum),SMSA_COL(did))*1000;
+		head = 0;
+	    }
+	    cost += SMSA_DIFF(head,bid)*10;
+	    drum = did;
+	    head = bid;
+	    for ( i=0; i<blocks; i++, head++ ) {
+		if ( head >= SMSA_MAX_BLOCK_ID ) {
+		    next = drum+1;
+		    cost += SMSA_DIFF(SMSA_COL(drum),SMSA_COL(next))*1000;
+		    drum = next;
+		    head = 0;
+		}
+		cost += 200;
+	    }
+	    break;
+
 	default: logMessage( LOG_ERROR_LEVEL, "OP Illegal disk command (cost) [%u]", cmd );
 	    cost = -1;
 	    break;
@@ -20,6 +20,9 @@
 #define SMSA_BLOCK_SIZE			256
 #define SMSA_MAX_BLOCK_ID		(SMSA_DISK_SIZE/SMSA_BLOCK_SIZE)
 #define SMSA_DISK_FILE 			"smsa_data.dat"
+#define SMSA_STATE_HASH_SIZE	8	// GET_STATE gives each drum an 8 byte content hash, in drum order
+#define SMSA_MAX_EXTENT		255	// Most blocks an extent read or write moves
+#define SMSA_MAX_PINS		2	// Most pins an extent read takes (it spans at most two drums)
 
 // Workload related defines
 #define MAX_SMSA_VIRTUAL_ADDRESS (SMSA_DISK_ARRAY_SIZE*SMSA_DISK_SIZE)
@@ -34,6 +37,7 @@
 #define SMSA_OPCODE(op) (op >> 26)
 #define SMSA_DRUMID(op) ((op >> 22)&0xf)
 #define SMSA_BLOCKID(op) ((op & 0xff)
+#define SMSA_EXTENTLEN(op) ((op >> 8)&0xff)
 
 // Type definitions
 
@@ -51,10 +55,17 @@ typedef enum {
 	SMSA_SEEK_BLOCK		= 3,  // Seek to a disk address in the current drum
 	SMSA_DISK_READ 		= 4,  // Read from the disk
 	SMSA_DISK_WRITE		= 5,  // Write to the disk
-	SMSA_GET_STATE		= 6,  // Get the current disk state (UNIMPLEMENTED)
+	SMSA_GET_STATE		= 6,  // Get the current disk state (drum content hashes)
 	SMSA_FORMAT_DRUM	= 7,  // Format the current drum (zeros)
 	SMSA_BLOCK_SIGN		= 8,  // Generate a signature for a block (and output to log)
-	SMSA_MAX_COMMAND	= 9,  // The largest value of a command (+1)
+	SMSA_DISK_READ_EXTENT	= 9,  // Read a run of blocks from the disk (across drums)
+	SMSA_DISK_WRITE_EXTENT	= 10, // Write a run of blocks to the disk (across drums)
+	SMSA_DISK_READ_AT	= 11, // Seek to the drum/block in the opcode and read it
+	SMSA_DISK_WRITE_AT	= 12, // Seek to the drum/block in the opcode and write it
+	SMSA_DISK_FILL		= 13, // Fill a run of blocks with the byte in the block field
+	SMSA_DISK_WRITE_PART	= 14, // Write bytes at the offset in the block field of the block
+	SMSA_DISK_COPY		= 15, // Copy a run of blocks from the heads to the drum/block in the opcode
+	SMSA_MAX_COMMAND	= 16, // The largest value of a command (+1)
 } SMSA_DISK_COMMAND;
 
 // These are the disk error levels
@@ -74,14 +85,46 @@ typedef enum {
 	SMSA_MAX_ERRNO			= 12	// The highest error level (not an error)
 } SMSA_ERROR_LEVEL;
 
+// One client of the array.  Each session has its own heads, so clients
+// seeking and reading at the same time do not move each other, and counts
+// the cycles its own operations cost.
+typedef struct {
+	uint8_t			mounted;		// 1 if this session has mounted the array
+	SMSA_DRUM_ID		drum_head;		// The current drum under eval
+	uint32_t		read_head;		// The current read position on the drum
+	unsigned long		cycle_count;		// Cycles this session's operations cost
+} SMSA_SESSION;
+
+// A run of array memory lent out by smsa_operation_pin instead of being
+// copied.  It keeps the contents it had when pinned (the next write to
+// its drum goes to a fresh copy of the drum) until it is given back.
+typedef struct {
+	unsigned char		*data;			// The first byte of the run
+	uint32_t		len;			// Number of bytes in it
+	SMSA_DRUM_ID		drum;			// The drum it is on
+	unsigned char		*image;			// The drum memory it is part of
+} SMSA_PIN;
+
 //
 // Global data
-extern SMSA_ERROR_LEVEL smsa_error_number;
+extern __thread SMSA_ERROR_LEVEL smsa_error_number;
 //
 // Disk interface
 
-int smsa_operation( uint32_t op, unsigned char *block );
-	// This is the (*only*) interface to the disk array
+int smsa_operation( SMSA_SESSION *session, uint32_t op, unsigned char *block );
+	// This is the (*only*) interface to the disk array (NULL session for the default)
+
+void smsa_init_session( SMSA_SESSION *session );
+	// Setup a session before its first operation
+
+int smsa_close_session( SMSA_SESSION *session );
+	// End a session, unmounting the array if it is still mounted
+
+int smsa_operation_pin( SMSA_SESSION *session, uint32_t op, SMSA_PIN *pins );
+	// Run an extent read by pinning the blocks in place, returns the pins taken
+
+void smsa_unpin( SMSA_PIN *pin );
+	// Give back array memory pinned by smsa_operation_pin
 
 int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block );
 	// Generate a signature for a particular block
@@ -90,7 +133,10 @@ int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block );
 // Utility Functions
 
 unsigned long smsa_get_cycle_count( void );
-	// Return the cycle count
+	// Return the cycle count (all sessions)
+
+void smsa_set_storage( int enabled );
+	// Keep the array in SMSA_DISK_FILE between unmount and mount
 
 const char * smsa_error_string( int eno );
 	// This returns a constant string detailing the meaning of an SMSA error
@@ -0,0 +1,508 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_bench.c
+//  Description   : This is the benchmark program for the SMSA client pieces
+//                  and the array.
+//
+//   Author        : Mohanish Sheth
+//
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Project Includes
+#include <smsa.h>
+#include <smsa_cache.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define SMSA_ARGUMENTS "hvl:n:s:"
+#define USAGE \
+	"USAGE: smsabench [-h] [-v] [-l <logfile>] [-n <ops>] [-s <shards>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -n - number of operations per measurement (default 1000000)\n" \
+	"    -s - cache shards for the threaded runs (default 16)\n" \
+	"\n" \
+
+#define SMSA_BENCH_MIN_LINES 32
+#define SMSA_BENCH_MAX_LINES SMSA_CACHE_MAX_KEYS // smsa_init_cache() holds no more
+#define SMSA_BENCH_MAX_THREADS 32
+#define SMSA_BENCH_THREAD_LINES 1024
+#define SMSA_BENCH_ARRAY_THREADS 16
+
+// What one array benchmark thread does
+typedef struct {
+	pthread_t     thread;  // The thread
+	uint32_t      ops;     // Block reads and writes to do
+	uint32_t      seed;    // Where its block stream starts
+	SMSA_DRUM_ID  drum;    // The drum it works on
+	int           writes;  // 1 to make every fourth operation a write
+	int           failed;  // Operations the array refused
+} SMSA_BENCH_ARRAY_WORKER;
+
+// What one benchmark thread does
+typedef struct {
+	pthread_t  thread;  // The thread
+	uint32_t   ops;     // Lookups to do
+	uint32_t   seed;    // Where its key stream starts
+	uint32_t  *keys;    // Keys to pick from
+	uint32_t   nkeys;   // Number of keys
+	int        fill;    // 1 to put the block on a miss
+	uint64_t   hits;    // Lookups that hit
+} SMSA_BENCH_WORKER;
+
+//
+// Functional Prototypes
+
+int bench_cache_lookup( uint32_t ops );
+int bench_cache_threads( uint32_t ops, uint32_t shards );
+double bench_run_threads( SMSA_BENCH_WORKER *workers, int threads );
+void *bench_worker( void *arg );
+int bench_array_threads( uint32_t ops );
+void *bench_array_worker( void *arg );
+double bench_now( void );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the SMSA benchmarks
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] )
+{
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+	uint32_t ops = 1000000, shards = 16;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'n': // Set the number of operations
+			if ( sscanf( optarg, "%u", &ops ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad operation count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 's': // Set the number of shards
+			if ( sscanf( optarg, "%u", &shards ) != 1 || shards < 1 || shards > SMSA_CACHE_MAX_SHARDS ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad shard count [%s]", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Run the benchmark
+	if ( bench_cache_lookup(ops) ) {
+		logMessage( LOG_ERROR_LEVEL, "Cache lookup benchmark failed." );
+		return( -1 );
+	}
+	if ( bench_cache_threads(ops, shards) ) {
+		logMessage( LOG_ERROR_LEVEL, "Threaded cache benchmark failed." );
+		return( -1 );
+	}
+	if ( bench_array_threads(ops) ) {
+		logMessage( LOG_ERROR_LEVEL, "Threaded array benchmark failed." );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_lookup
+// Description  : Time cache hits and misses for cache sizes from 32 to 4096
+//                lines (one per block of the array, the most the cache
+//                holds).  The cache is filled with as many distinct blocks
+//                as it can hold, then probed with keys known to hit and
+//                known to miss.
+//
+// Inputs       : ops - the number of probes per measurement
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_cache_lookup( uint32_t ops ) {
+
+	// Local variables
+	uint32_t lines, filled, i, key, *keys;
+	unsigned char buf[SMSA_BLOCK_SIZE];
+	unsigned long found;
+	double start, hit, miss;
+
+	// Randomize the key order once so every size sees the same stream
+	keys = malloc( SMSA_CACHE_MAX_KEYS * sizeof(uint32_t) );
+	if ( keys == NULL ) {
+		return( -1 );
+	}
+	for ( i=0; i<SMSA_CACHE_MAX_KEYS; i++ ) {
+		keys[i] = i;
+	}
+	srand( 311 );
+	for ( i=SMSA_CACHE_MAX_KEYS-1; i>0; i-- ) {
+		key = rand() % (i+1);
+		filled = keys[i];
+		keys[i] = keys[key];
+		keys[key] = filled;
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "%8s %8s %12s %12s", "lines", "cached", "hit ns/op", "miss ns/op" );
+	for ( lines=SMSA_BENCH_MIN_LINES; lines<=SMSA_BENCH_MAX_LINES; lines*=2 ) {
+
+		// Fill the cache, leaving at least one key out to probe misses with
+		if ( smsa_init_cache(lines) ) {
+			free( keys );
+			return( -1 );
+		}
+		filled = (lines < SMSA_CACHE_MAX_KEYS) ? lines : SMSA_CACHE_MAX_KEYS-1;
+		memset( buf, 0x0, SMSA_BLOCK_SIZE );
+		for ( i=0; i<filled; i++ ) {
+			key = keys[i];
+			if ( smsa_put_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID, buf) ) {
+				smsa_close_cache();
+				free( keys );
+				return( -1 );
+			}
+		}
+
+		// Probe the cached keys
+		found = 0;
+		start = bench_now();
+		for ( i=0; i<ops; i++ ) {
+			key = keys[i%filled];
+			found += (smsa_get_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID) != NULL);
+		}
+		hit = (bench_now()-start)*1e9/ops;
+
+		// Probe the keys that were left out
+		start = bench_now();
+		for ( i=0; i<ops; i++ ) {
+			key = keys[filled+(i%(SMSA_CACHE_MAX_KEYS-filled))];
+			found += (smsa_get_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID) != NULL);
+		}
+		miss = (bench_now()-start)*1e9/ops;
+
+		// Sanity check that hits hit and misses missed
+		if ( found != ops ) {
+			logMessage( LOG_ERROR_LEVEL, "Cache lookups inconsistent [%lu != %u]", found, ops );
+		}
+		logMessage( LOG_OUTPUT_LEVEL, "%8u %8u %12.1f %12.1f", lines, filled, hit, miss );
+		smsa_close_cache();
+	}
+
+	// Return successfully
+	free( keys );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_cache_threads
+// Description  : Time a shared cache of 1024 lines from 1 to 32 threads,
+//                first with one shard (one lock) and then with shards.
+//                The hit run only looks up cached blocks, on the lock free
+//                path.  The mixed run picks any block in the array and
+//                puts it on a miss, so about three lookups in four take a
+//                shard lock to replace a line.
+//
+// Inputs       : ops - the total lookups per measurement, split over the threads
+//                shards - the number of shards for the second set of runs
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_cache_threads( uint32_t ops, uint32_t shards ) {
+
+	// Local variables
+	SMSA_BENCH_WORKER workers[SMSA_BENCH_MAX_THREADS];
+	uint32_t config[2], resident[SMSA_CACHE_MAX_KEYS], all[SMSA_CACHE_MAX_KEYS];
+	uint32_t c, i, key, nres;
+	unsigned char buf[SMSA_BLOCK_SIZE];
+	int threads, t, fill;
+	double hit, mixed;
+
+	config[0] = 1;
+	config[1] = shards;
+	logMessage( LOG_OUTPUT_LEVEL, "%8s %8s %14s %14s", "shards", "threads", "hit Mops/s", "mixed Mops/s" );
+	for ( c=0; c<2; c++ ) {
+		for ( threads=1; threads<=SMSA_BENCH_MAX_THREADS; threads*=2 ) {
+
+			hit = mixed = 0.0;
+			for ( fill=0; fill<2; fill++ ) {
+
+				// Fill the cache with as much of the array as it holds
+				if ( smsa_set_cache_shards(config[c]) || smsa_init_cache(SMSA_BENCH_THREAD_LINES) ) {
+					return( -1 );
+				}
+				memset( buf, 0x0, SMSA_BLOCK_SIZE );
+				for ( key=0; key<SMSA_CACHE_MAX_KEYS; key++ ) {
+					all[key] = key;
+					if ( smsa_put_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID, buf) ) {
+						smsa_close_cache();
+						return( -1 );
+					}
+				}
+				for ( key=0, nres=0; key<SMSA_CACHE_MAX_KEYS; key++ ) {
+					if ( smsa_probe_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID) ) {
+						resident[nres++] = key;
+					}
+				}
+
+				// Split the lookups over the threads
+				for ( t=0; t<threads; t++ ) {
+					workers[t].ops = ops/threads;
+					workers[t].seed = 311*(t+1);
+					workers[t].keys = fill ? all : resident;
+					workers[t].nkeys = fill ? SMSA_CACHE_MAX_KEYS : nres;
+					workers[t].fill = fill;
+					workers[t].hits = 0;
+				}
+				if ( fill ) {
+					mixed = bench_run_threads( workers, threads );
+				} else {
+					hit = bench_run_threads( workers, threads );
+				}
+				smsa_close_cache();
+
+				// Every lookup of a resident block has to hit
+				if ( hit < 0 || mixed < 0 ) {
+					return( -1 );
+				}
+				for ( t=0, i=0; !fill && t<threads; t++ ) {
+					i += (workers[t].hits != workers[t].ops);
+				}
+				if ( i ) {
+					logMessage( LOG_ERROR_LEVEL, "Resident blocks missed in the hit run" );
+				}
+			}
+			logMessage( LOG_OUTPUT_LEVEL, "%8u %8d %14.2f %14.2f", config[c], threads, hit, mixed );
+		}
+	}
+	smsa_set_cache_shards( 1 );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_run_threads
+// Description  : Start the workers, wait for them all and work out the
+//                combined rate
+//
+// Inputs       : workers - the workers to run
+//                threads - how many of them
+// Outputs      : millions of lookups per second, -1 if failure
+
+double bench_run_threads( SMSA_BENCH_WORKER *workers, int threads ) {
+
+	// Local variables
+	double start, elapsed;
+	uint64_t total = 0;
+	int t;
+
+	start = bench_now();
+	for ( t=0; t<threads; t++ ) {
+		if ( pthread_create(&workers[t].thread, NULL, bench_worker, &workers[t]) ) {
+			logMessage( LOG_ERROR_LEVEL, "Cannot start benchmark thread %d", t );
+			return( -1 );
+		}
+	}
+	for ( t=0; t<threads; t++ ) {
+		pthread_join( workers[t].thread, NULL );
+		total += workers[t].ops;
+	}
+	elapsed = bench_now()-start;
+	return( total/elapsed/1e6 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_worker
+// Description  : One benchmark thread, reads a block's worth out of the
+//                cache for each key in its (xorshift) stream
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
+
+void *bench_worker( void *arg ) {
+
+	// Local variables
+	SMSA_BENCH_WORKER *w = arg;
+	unsigned char buf[SMSA_BLOCK_SIZE];
+	uint32_t i, x = w->seed, key;
+
+	for ( i=0; i<w->ops; i++ ) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		key = w->keys[x % w->nkeys];
+		if ( smsa_read_cache_line(key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID, 0, SMSA_BLOCK_SIZE, buf) == 0 ) {
+			w->hits++;
+		} else if ( w->fill ) {
+			smsa_put_cache_line( key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID, buf );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_array_threads
+// Description  : Time the array itself from 1 to 16 threads, each with its
+//                own session, the way the server's workers drive it.  The
+//                first run has every thread reading the same drum, which
+//                should scale as they share its lock.  The second gives
+//                each thread its own drum with one write in four, which
+//                should scale as drums never wait on each other.  The
+//                third puts that mix on one drum, where the writes do
+//                wait, to show the difference.  Scaling stops at the
+//                number of cores the machine has.
+//
+// Inputs       : ops - the total operations per measurement, split over the threads
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_array_threads( uint32_t ops ) {
+
+	// Local variables
+	SMSA_BENCH_ARRAY_WORKER workers[SMSA_BENCH_ARRAY_THREADS];
+	SMSA_SESSION session;
+	double start, rate[3];
+	int threads, t, run, failed;
+
+	// Keep the array mounted between runs
+	smsa_init_session( &session );
+	if ( smsa_operation(&session, SMSA_MOUNT<<26, NULL) ) {
+		return( -1 );
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "array threads on %ld cores", sysconf(_SC_NPROCESSORS_ONLN) );
+	logMessage( LOG_OUTPUT_LEVEL, "%8s %18s %18s %18s", "threads", "1 drum rd Mops/s",
+			"n drums rw Mops/s", "1 drum rw Mops/s" );
+	for ( threads=1; threads<=SMSA_BENCH_ARRAY_THREADS; threads*=2 ) {
+		for ( run=0, failed=0; run<3; run++ ) {
+
+			// Split the operations over the threads
+			for ( t=0; t<threads; t++ ) {
+				workers[t].ops = ops/threads;
+				workers[t].seed = 311*(t+1);
+				workers[t].drum = (run == 1) ? t%SMSA_DISK_ARRAY_SIZE : 0;
+				workers[t].writes = (run > 0);
+				workers[t].failed = 0;
+			}
+
+			start = bench_now();
+			for ( t=0; t<threads; t++ ) {
+				if ( pthread_create(&workers[t].thread, NULL, bench_array_worker, &workers[t]) ) {
+					logMessage( LOG_ERROR_LEVEL, "Cannot start benchmark thread %d", t );
+					return( -1 );
+				}
+			}
+			for ( t=0; t<threads; t++ ) {
+				pthread_join( workers[t].thread, NULL );
+				failed += workers[t].failed;
+			}
+			rate[run] = (ops/threads)*threads/(bench_now()-start)/1e6;
+		}
+		if ( failed ) {
+			logMessage( LOG_ERROR_LEVEL, "Array refused %d benchmark operations", failed );
+		}
+		logMessage( LOG_OUTPUT_LEVEL, "%8d %18.2f %18.2f %18.2f", threads, rate[0], rate[1], rate[2] );
+	}
+
+	// Return successfully
+	smsa_operation( &session, SMSA_UNMOUNT<<26, NULL );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_array_worker
+// Description  : One array benchmark thread, mounts its own session on its
+//                drum and seeks to and reads (or writes) a block from its
+//                (xorshift) stream for each operation
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
+
+void *bench_array_worker( void *arg ) {
+
+	// Local variables
+	SMSA_BENCH_ARRAY_WORKER *w = arg;
+	unsigned char buf[SMSA_BLOCK_SIZE];
+	SMSA_SESSION session;
+	uint32_t i, x = w->seed, cmd;
+
+	smsa_init_session( &session );
+	memset( buf, 0x0, SMSA_BLOCK_SIZE );
+	w->failed += (smsa_operation(&session, SMSA_MOUNT<<26, NULL) != 0);
+	w->failed += (smsa_operation(&session, (SMSA_SEEK_DRUM<<26)|(w->drum<<22), NULL) != 0);
+	for ( i=0; i<w->ops; i++ ) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		cmd = (w->writes && (i%4 == 3)) ? SMSA_DISK_WRITE : SMSA_DISK_READ;
+		w->failed += (smsa_operation(&session, (SMSA_SEEK_BLOCK<<26)|(w->drum<<22)|(x%SMSA_MAX_BLOCK_ID), NULL) != 0);
+		w->failed += (smsa_operation(&session, (cmd<<26)|(w->drum<<22), buf) != 0);
+	}
+	w->failed += (smsa_operation(&session, SMSA_UNMOUNT<<26, NULL) != 0);
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_now
+// Description  : Return a monotonic timestamp in seconds
+//
+// Inputs       : none
+// Outputs      : the current time
+
+double bench_now( void ) {
+
+	// Local variables
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return( ts.tv_sec + ts.tv_nsec/1e9 );
+}
@@ -9,20 +9,179 @@
 //
 
 // Include Files
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Project Include Files
 #include <smsa_cache.h>
 
-// GlobalVariable 
+// Defines
+#define LIST_LRU   0 // LRU: the recency list
+#define LIST_A1IN  0 // 2Q: blocks seen once, FIFO
+#define LIST_AM    1 // 2Q: blocks seen again, LRU
+#define LIST_A1OUT 2 // 2Q: ghosts of blocks pushed out of A1in
+#define LIST_T1    0 // ARC: resident, seen once
+#define LIST_T2    1 // ARC: resident, seen at least twice
+#define LIST_B1    2 // ARC: ghosts evicted from T1
+#define LIST_B2    3 // ARC: ghosts evicted from T2
+
+// Counters are bumped from the lock free hit path too
+#define CACHE_COUNT(sh,drm,field,n) __atomic_fetch_add(&(sh)->stats[drm].field, (n), __ATOMIC_RELAXED)
+
+// One shard of the cache.  Each key belongs to exactly one shard, which
+// owns the entries, slab slots and replacement state for it.  Entry
+// indexes are global, a shard uses the entries first..first+entries-1.
+typedef struct {
+	pthread_mutex_t   lock;                       // Held to change anything in the shard
+	int32_t           first;                      // First entry of the shard
+	uint32_t          lines;                      // Lines the shard can hold
+	uint32_t          entries;                    // Entries (lines plus ghosts)
+	uint32_t          resident;                   // Entries holding a line
+	SMSA_CACHE_LIST   list[SMSA_CACHE_MAX_LISTS]; // Policy lists, most recent at the head
+	uint64_t          clock;                      // Logical clock for the used stamps
+	int32_t           free_entry;                 // Unused entries, chained through next
+	unsigned char   **free_slot;                  // Unused slab slots
+	uint32_t          free_slots;                 // Number of unused slab slots
+	int               flush_failed;               // A write back failed since the last put
+	uint32_t          hand;                       // CLOCK: next entry to look at
+	uint32_t          arc_target;                 // ARC: target size of T1 ("p" in the paper)
+	SMSA_CACHE_STATS  stats[SMSA_DISK_ARRAY_SIZE];
+} __attribute__((aligned(64))) SMSA_CACHE_SHARD;
+
+// The operations every replacement policy provides
+typedef struct {
+	const char *name;                                         // Name used to pick the policy
+	void (*hit) (SMSA_CACHE_SHARD *sh, int32_t ent);          // A resident entry was used again
+	int32_t (*miss) (SMSA_CACHE_SHARD *sh, uint32_t key);     // Make room for key, return its new entry
+} SMSA_CACHE_POLICY_OPS;
+
+// GlobalVariable
 SMSA_CACHE_LINE *Cache=NULL;
-uint32_t NUM_Cache_Line; 
+unsigned char *CacheSlab=NULL;
+unsigned char **CacheFreeSlot=NULL;
+uint32_t NUM_Cache_Line;
+uint32_t NUM_Cache_Entries;
+
+// The shards, and how many the next smsa_init_cache() makes
+SMSA_CACHE_SHARD *CacheShard=NULL;
+uint32_t NUM_Cache_Shards = 1;
+
+// Index from (drum, block) key to the cache entry holding it, -1 if absent
+int32_t CacheIndex[SMSA_CACHE_MAX_KEYS];
+
+// Write-back of dirty lines
+SMSA_CACHE_FLUSH CacheFlush = NULL;
+
+// Start of a snapshot file, followed by one (key, block) record per line,
+// least recently used first.  Written and read on the same host, so the
+// fields are in host byte order.
+typedef struct {
+	char              magic[8];                    // SMSA_CACHE_SNAPSHOT_MAGIC
+	uint32_t          lines;                       // Records that follow
+	uint32_t          reserved;
+	uint64_t          state[SMSA_DISK_ARRAY_SIZE]; // Drum hashes the lines were taken against
+} SMSA_CACHE_SNAPSHOT;
+#define SMSA_CACHE_SNAPSHOT_MAGIC "SMSACSH1"
 
 // Functions
+SMSA_CACHE_SHARD *shard_of (uint32_t key);
+void seq_begin (int index);
+void seq_end (int index);
 void export (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, int index);
+void unlink_line (SMSA_CACHE_SHARD *sh, int index);
+void push_line (SMSA_CACHE_SHARD *sh, uint8_t list, int index);
+void touch_line (SMSA_CACHE_SHARD *sh, int index);
+int32_t new_line (SMSA_CACHE_SHARD *sh, uint32_t key);
+void evict_line (SMSA_CACHE_SHARD *sh, int index, uint8_t ghost);
+void drop_line (SMSA_CACHE_SHARD *sh, int index);
+int flush_line (SMSA_CACHE_SHARD *sh, int index);
+int used_order (const void *a, const void *b);
+
+void lru_hit (SMSA_CACHE_SHARD *sh, int32_t ent);
+int32_t lru_miss (SMSA_CACHE_SHARD *sh, uint32_t key);
+void clock_hit (SMSA_CACHE_SHARD *sh, int32_t ent);
+int32_t clock_miss (SMSA_CACHE_SHARD *sh, uint32_t key);
+void twoq_hit (SMSA_CACHE_SHARD *sh, int32_t ent);
+int32_t twoq_miss (SMSA_CACHE_SHARD *sh, uint32_t key);
+void arc_hit (SMSA_CACHE_SHARD *sh, int32_t ent);
+int32_t arc_miss (SMSA_CACHE_SHARD *sh, uint32_t key);
+void arc_replace (SMSA_CACHE_SHARD *sh, int ghost_in_b2);
+void lfu_hit (SMSA_CACHE_SHARD *sh, int32_t ent);
+int32_t lfu_miss (SMSA_CACHE_SHARD *sh, uint32_t key);
+
+// The policy table, indexed by SMSA_CACHE_POLICY
+static const SMSA_CACHE_POLICY_OPS CachePolicies[SMSA_CACHE_MAX_POLICY] = {
+	{ "lru",   lru_hit,   lru_miss },
+	{ "clock", clock_hit, clock_miss },
+	{ "2q",    twoq_hit,  twoq_miss },
+	{ "arc",   arc_hit,   arc_miss },
+	{ "lfu",   lfu_hit,   lfu_miss },
+};
+SMSA_CACHE_POLICY CachePolicy = SMSA_CACHE_LRU;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_cache_policy
+// Description  : Select the replacement policy used by the next smsa_init_cache()
+//
+// Inputs       : policy - the policy to use
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_cache_policy( SMSA_CACHE_POLICY policy ) {
+
+	// Only switch to a policy we know about, and never under a live cache
+	if (policy >= SMSA_CACHE_MAX_POLICY || Cache != NULL){
+		logMessage(LOG_INFO_LEVEL, "Cannot set cache policy [%d].\n", policy);
+		return(-1);
+	}
+	CachePolicy = policy;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_cache_policy_lookup
+// Description  : Find a policy by name
+//
+// Inputs       : name - the policy name, case insensitive
+// Outputs      : the policy, or -1 if there is no such policy
+
+int smsa_cache_policy_lookup( const char *name ) {
+
+	int i;
+
+	for (i=0; i<SMSA_CACHE_MAX_POLICY; i++){
+		if (strcasecmp(name, CachePolicies[i].name) == 0){
+			return(i);
+		}
+	}
+	return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_cache_shards
+// Description  : Select how many shards the next smsa_init_cache() splits
+//                the cache into
+//
+// Inputs       : shards - the number of shards
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_cache_shards( uint32_t shards ) {
+
+	if (shards < 1 || shards > SMSA_CACHE_MAX_SHARDS || Cache != NULL){
+		logMessage(LOG_INFO_LEVEL, "Cannot set cache shards [%u].\n", shards);
+		return(-1);
+	}
+	NUM_Cache_Shards = shards;
+	return(0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -33,24 +192,95 @@ void export (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, int index)
 // Outputs      : 0 if successful test, -1 if failure
 
 int smsa_init_cache( uint32_t lines ) {
-	
+
+	SMSA_CACHE_SHARD *sh;
+	uint32_t s, slot;
+	int32_t first;
 	int i;
 
-	// Use calloc to allocate memory
-	Cache = calloc (lines, sizeof(SMSA_CACHE_LINE));
- 	// setting to -1 
-		for (i =0; i<NUM_Cache_Line; i++){
-			Cache[i].drum = -1;
-			Cache[i].block = -1;
-		}	
-	// storing the # lines in G.V
-	NUM_Cache_Line = lines;
-	
+	// There are only so many blocks in the array, lines past that are never used
+	if (lines > SMSA_CACHE_MAX_KEYS){
+		logMessage(LOG_INFO_LEVEL, "Cache of %u lines clamped to %u.\n", lines, SMSA_CACHE_MAX_KEYS);
+		lines = SMSA_CACHE_MAX_KEYS;
+	}
+
+	// Use calloc to allocate memory.  2Q and ARC keep up to one ghost
+	// per line besides the lines themselves (one spare per shard so a
+	// zero line shard still allocates).
+	NUM_Cache_Entries = 2*lines+NUM_Cache_Shards;
+	Cache = calloc (NUM_Cache_Entries, sizeof(SMSA_CACHE_LINE));
+	CacheFreeSlot = calloc (lines+1, sizeof(unsigned char *));
+	if (posix_memalign((void **)&CacheShard, 64, NUM_Cache_Shards*sizeof(SMSA_CACHE_SHARD)) != 0){
+		CacheShard = NULL;
+	}
+
+	// All the line storage comes from one aligned slab, carved up once here
+	// and recycled on eviction, so misses never allocate.
+	if (Cache == NULL || CacheFreeSlot == NULL || CacheShard == NULL || posix_memalign((void **)&CacheSlab,
+				SMSA_CACHE_ALIGNMENT, ((size_t)lines+1)*SMSA_BLOCK_SIZE) != 0){
+		CacheSlab = NULL;
+		free(Cache);
+		Cache = NULL;
+		free(CacheFreeSlot);
+		CacheFreeSlot = NULL;
+		free(CacheShard);
+		CacheShard = NULL;
+	}
+
 	// Using log message to check if cache points to null
 	if (Cache == NULL){
 		logMessage(LOG_INFO_LEVEL, "CACHE is pointing to NULL\n");
 		return(-1);
 	}
+
+	// storing the # lines in G.V
+	NUM_Cache_Line = lines;
+
+	// Deal the lines out to the shards, each gets its own run of entries
+	// and slab slots.
+	memset(CacheShard, 0x0, NUM_Cache_Shards*sizeof(SMSA_CACHE_SHARD));
+	first = 0;
+	slot = 0;
+	for (s=0; s<NUM_Cache_Shards; s++){
+		sh = &CacheShard[s];
+		pthread_mutex_init (&sh->lock, NULL);
+		sh->lines = lines/NUM_Cache_Shards + (s < lines%NUM_Cache_Shards);
+		sh->entries = 2*sh->lines+1;
+		sh->first = first;
+		first += sh->entries;
+
+	 	// setting to -1, and chaining every entry onto the free list in order
+		sh->free_entry = -1;
+		for (i=sh->first+sh->entries-1; i>=sh->first; i--){
+			Cache[i].drum = -1;
+			Cache[i].block = -1;
+			Cache[i].list = SMSA_CACHE_NO_LIST;
+			Cache[i].line = NULL;
+			Cache[i].prev = -1;
+			Cache[i].next = sh->free_entry;
+			sh->free_entry = i;
+		}
+
+		// Every slab slot starts out free
+		sh->free_slot = &CacheFreeSlot[slot];
+		for (i=0; i<sh->lines; i++){
+			sh->free_slot[i] = &CacheSlab[(size_t)(slot+sh->lines-1-i)*SMSA_BLOCK_SIZE];
+		}
+		sh->free_slots = sh->lines;
+		slot += sh->lines;
+
+		for (i=0; i<SMSA_CACHE_MAX_LISTS; i++){
+			sh->list[i].head = sh->list[i].tail = -1;
+		}
+	}
+
+	// Nothing is cached yet, so every key points nowhere
+	for (i=0; i<SMSA_CACHE_MAX_KEYS; i++){
+		CacheIndex[i] = -1;
+	}
+
+	logMessage(LOG_INFO_LEVEL, "Cache of %u lines in %u shards using %s replacement.\n",
+			NUM_Cache_Line, NUM_Cache_Shards, CachePolicies[CachePolicy].name);
 	return(0);
 }
 
@@ -63,56 +293,172 @@ int smsa_init_cache( uint32_t lines ) {
 // Outputs      : 0 if successful test, -1 if failure
 
 int smsa_close_cache( void ) {
-	
+
 	int i;
 
-	// Setting a loop that will free cache line and set it to null.
-	for (i=0; i<NUM_Cache_Line; i++){
-		if (Cache[i].line != NULL){	
-		free(Cache[i].line);
-		Cache[i].line = NULL;
-		}
+	//Returning the allocated memory to OS, the lines all live in the slab.
+	if (CacheShard != NULL){
+	for (i=0; i<NUM_Cache_Shards; i++){
+		pthread_mutex_destroy (&CacheShard[i].lock);
+	}
+	free(CacheShard);
+	CacheShard=NULL;
 	}
-
-	//Returning the allocated memory to OS.
 	if (Cache != NULL){
 	free(Cache);
 	Cache=NULL;
 	}
+	if (CacheSlab != NULL){
+	free(CacheSlab);
+	CacheSlab=NULL;
+	}
+	if (CacheFreeSlot != NULL){
+	free(CacheFreeSlot);
+	CacheFreeSlot=NULL;
+	}
+
+	// Drop the index along with the lines it pointed at
+	for (i=0; i<SMSA_CACHE_MAX_KEYS; i++){
+		CacheIndex[i] = -1;
+	}
+	NUM_Cache_Line = 0;
+	NUM_Cache_Entries = 0;
 	return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_get_cache_line
-// Description  : Check to see if the cache entry is available
+// Description  : Check to see if the cache entry is available.  The line is
+//                handed out directly, so the pointer is only safe to use
+//                while no other thread is using the cache.
 //
 // Inputs       : drm - the drum ID to look for
 //                blk - the block ID to lookm for
 // Outputs      : pointer to cache entry if found, NULL otherwise
 
 unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
-	
-	int i; // i is loop controller & time is store return value. 
-
-	// Setting up loop that will check for the drum_id and block_id in cache
-	for (i=0; i<NUM_Cache_Line; i++){
-	
-		if (Cache[i].drum == drm && Cache[i].block == blk){
-			
-			// Updating the time in the struct for the cache LRU 
-			// policy purpose
-			if( gettimeofday(&Cache[i].used,NULL) == -1){
-				logMessage (LOG_INFO_LEVEL, "Error updating time.\n");
-			}
-			
-			// Returning the pointer pointing to that line in cache
-			return(Cache[i].line);
+
+	SMSA_CACHE_SHARD *sh;
+	unsigned char *line = NULL;
+	int i; // i is the entry the index points at
+
+	// Anything outside the array can never be cached
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(NULL);
+	}
+	sh = shard_of (SMSA_CACHE_KEY(drm,blk));
+	pthread_mutex_lock (&sh->lock);
+
+	// Look the key up directly instead of walking every line, a ghost
+	// entry only remembers the block so it is still a miss.
+	i = CacheIndex[SMSA_CACHE_KEY(drm,blk)];
+	if (i == -1 || Cache[i].line == NULL){
+		// if not found in cache return null.
+		CACHE_COUNT (sh, drm, misses, 1);
+	}
+	else {
+		// Let the policy know the line was used
+		CACHE_COUNT (sh, drm, hits, 1);
+		Cache[i].used = ++sh->clock;
+		CachePolicies[CachePolicy].hit (sh, i);
+		line = Cache[i].line;
+	}
+
+	// Returning the pointer pointing to that line in cache
+	pthread_mutex_unlock (&sh->lock);
+	return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_read_cache_line
+// Description  : Copy part of a cached block out to the caller, counting
+//                the bytes served from the cache.  This takes no lock: the
+//                copy is checked against the entry's sequence count and
+//                retried if the line changed under it.  The policy hears
+//                about the use only if the shard lock is free right now,
+//                so under contention some recency updates are dropped.
+//
+// Inputs       : drm - the drum ID to look for
+//                blk - the block ID to look for
+//                off - the offset in the block to start at
+//                len - the number of bytes to copy
+//                buf - where to copy them
+// Outputs      : 0 if the block was cached, -1 otherwise
+
+int smsa_read_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t off, uint32_t len, unsigned char *buf ) {
+
+	SMSA_CACHE_SHARD *sh;
+	unsigned char *line;
+	uint32_t key, before, after;
+	int i, found;
+
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID ||
+			off > SMSA_BLOCK_SIZE || len > SMSA_BLOCK_SIZE - off){
+		return(-1);
+	}
+	key = SMSA_CACHE_KEY(drm,blk);
+	sh = shard_of (key);
+
+	do {
+		i = __atomic_load_n (&CacheIndex[key], __ATOMIC_ACQUIRE);
+		found = 0;
+		if (i == -1){
+			break;
 		}
+
+		// An odd count means a writer is part way through the entry
+		before = __atomic_load_n (&Cache[i].seq, __ATOMIC_ACQUIRE);
+		if (before & 1){
+			continue;
+		}
+		line = Cache[i].line;
+		found = (line != NULL && Cache[i].drum == drm && Cache[i].block == blk);
+		if (found){
+			memcpy(buf, &line[off], len);
+		}
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		after = __atomic_load_n (&Cache[i].seq, __ATOMIC_RELAXED);
+	} while ((before & 1) || before != after);
+
+	if (!found){
+		CACHE_COUNT (sh, drm, misses, 1);
+		return(-1);
 	}
-	// if not found in cache return null.
-	// use a log message to notify it is returning null.
-		return(NULL);
+	CACHE_COUNT (sh, drm, hits, 1);
+	CACHE_COUNT (sh, drm, bytes_served, len);
+
+	// Recency is a hint, skip it rather than wait for the lock
+	if (pthread_mutex_trylock (&sh->lock) == 0){
+		if (CacheIndex[key] == i && Cache[i].line != NULL){
+			Cache[i].used = ++sh->clock;
+			CachePolicies[CachePolicy].hit (sh, i);
+		}
+		pthread_mutex_unlock (&sh->lock);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_probe_cache_line
+// Description  : Check whether a block is cached.  Unlike a lookup this is
+//                not a use, the policy and the counters do not see it.
+//
+// Inputs       : drm - the drum ID to look for
+//                blk - the block ID to look for
+// Outputs      : 1 if the block is cached, 0 otherwise
+
+int smsa_probe_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
+
+	int i;
+
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(0);
+	}
+	i = __atomic_load_n (&CacheIndex[SMSA_CACHE_KEY(drm,blk)], __ATOMIC_ACQUIRE);
+	return(i != -1 && Cache[i].line != NULL);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -126,59 +472,437 @@ unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
 // Outputs      : 0 if successful, -1 otherwise
 
 int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf ) {
-	
+
 	// local variabels.
-	int i, iLRU=0;
-	long result;
-	
-	// looping through cache to find null and enter new data.
-	for (i=0; i<NUM_Cache_Line; i++){
-	
-		if (Cache[i].line == NULL){
-			
-			// Calling a function to enter new data.
-			export (drm,blk,buf,i);
-			
-			// Updating the time for LRU policy.
-			if( gettimeofday(&Cache[i].used, NULL) == -1){
-				logMessage (LOG_INFO_LEVEL, "Error updating time.\n");
-				return(-1);
-			}
-			
-			// Setting iLRU for LRU policy.
-			iLRU = i;			
-			return(0); // for success.	
-		}	
+	SMSA_CACHE_SHARD *sh;
+	int i, failed;
+	uint32_t key;
+
+	// Check the key is inside the array before indexing on it
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		logMessage (LOG_INFO_LEVEL, "Bad cache key [%d/%d].\n", drm, blk);
+		return(-1);
 	}
+	key = SMSA_CACHE_KEY(drm,blk);
+	sh = shard_of (key);
 
-	// looping through loop if no space available then LRU kicks in saves the day.
-	for(i=0; i<NUM_Cache_Line; i++){
+	// A zero line cache holds nothing
+	if (sh->lines == 0){
+		return(0);
+	}
+	pthread_mutex_lock (&sh->lock);
 
-		// Use the inbuilt function from util.c
-		result = compareTimes (&Cache[iLRU].used , &Cache[i].used);
-		
-		// If Cache at i was LRU then set iLRU to i
-		 if (result > 0)
-			iLRU = i;
+	// If the block is already cached just refresh that line in place,
+	// otherwise the same block would end up in two lines.  The caller
+	// looked it up first, so the policy has already seen this use.
+	i = CacheIndex[key];
+	if (i != -1 && Cache[i].line != NULL){
+		seq_begin (i);
+		export (drm,blk,buf,i);
+		seq_end (i);
+		Cache[i].used = ++sh->clock;
+		pthread_mutex_unlock (&sh->lock);
+		return(0);
 	}
 
-	//Now calling the function to store new data.
-	export(drm,blk,buf,iLRU);
-	
-	// updating the time stamp in struct for LRU policy.
-	if( gettimeofday(&Cache[iLRU].used, NULL) == -1){
-		logMessage(LOG_INFO_LEVEL, "Error in updating time stamp.\n");
+	// Otherwise the policy makes room and hands back the entry to fill,
+	// still marked as being written.
+	sh->flush_failed = 0;
+	i = CachePolicies[CachePolicy].miss (sh, key);
+	export (drm,blk,buf,i);
+	seq_end (i);
+	Cache[i].used = ++sh->clock;
+	CACHE_COUNT (sh, drm, insertions, 1);
+	failed = sh->flush_failed;
+	pthread_mutex_unlock (&sh->lock);
+
+	// Making room may have had to write back a dirty line
+	if (failed){
+		logMessage (LOG_ERROR_LEVEL, "Write back of an evicted line failed.\n");
 		return(-1);
 	}
-		
 	return(0); // for success
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_cache_writeback
+// Description  : Set the function used to write dirty lines back to the array
+//
+// Inputs       : flush - the write back function
+// Outputs      : none
+
+void smsa_set_cache_writeback( SMSA_CACHE_FLUSH flush ) {
+
+	CacheFlush = flush;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_dirty_cache_line
+// Description  : Mark a cached line as modified.  Repeated writes to the
+//                line just keep it dirty, it goes back to the array once.
+//
+// Inputs       : drm - the drum ID of the line
+//                blk - the block ID of the line
+// Outputs      : 0 if successful, -1 if the block is not cached
+
+int smsa_dirty_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
+
+	SMSA_CACHE_SHARD *sh;
+	int i;
+
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(-1);
+	}
+	sh = shard_of (SMSA_CACHE_KEY(drm,blk));
+	pthread_mutex_lock (&sh->lock);
+	i = CacheIndex[SMSA_CACHE_KEY(drm,blk)];
+	if (i == -1 || Cache[i].line == NULL || CacheFlush == NULL){
+		pthread_mutex_unlock (&sh->lock);
+		logMessage (LOG_INFO_LEVEL, "Cannot dirty uncached line [%d/%d].\n", drm, blk);
+		return(-1);
+	}
+	Cache[i].dirty = 1;
+	pthread_mutex_unlock (&sh->lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_clean_cache_line
+// Description  : Write a dirty line back to the array now, it stays cached
+//
+// Inputs       : drm - the drum ID of the line
+//                blk - the block ID of the line
+// Outputs      : 0 if successful (or nothing to write), -1 if the write back failed
+
+int smsa_clean_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
+
+	SMSA_CACHE_SHARD *sh;
+	int i, ret = 0;
+
+	if (Cache == NULL || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(0);
+	}
+	sh = shard_of (SMSA_CACHE_KEY(drm,blk));
+	pthread_mutex_lock (&sh->lock);
+	i = CacheIndex[SMSA_CACHE_KEY(drm,blk)];
+	if (i != -1 && Cache[i].line != NULL && Cache[i].dirty){
+		ret = flush_line (sh, i);
+	}
+	pthread_mutex_unlock (&sh->lock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_drop_cache_line
+// Description  : Forget a cached block the array was changed under.  A
+//                dirty line is thrown away, the array holds newer contents.
+//
+// Inputs       : drm - the drum ID of the line
+//                blk - the block ID of the line
+// Outputs      : 0 if successful, -1 if the key is bad
+
+int smsa_drop_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
+
+	SMSA_CACHE_SHARD *sh;
+	int i;
+
+	if (Cache == NULL){
+		return(0);
+	}
+	if (drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(-1);
+	}
+	sh = shard_of (SMSA_CACHE_KEY(drm,blk));
+	pthread_mutex_lock (&sh->lock);
+	i = CacheIndex[SMSA_CACHE_KEY(drm,blk)];
+	if (i != -1 && Cache[i].line != NULL){
+
+		// Readers copying out of the slot see the change and retry
+		Cache[i].dirty = 0;
+		seq_begin (i);
+		sh->free_slot[sh->free_slots++] = Cache[i].line;
+		Cache[i].line = NULL;
+		seq_end (i);
+		sh->resident--;
+		drop_line (sh, i);
+	}
+	pthread_mutex_unlock (&sh->lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_flush_cache
+// Description  : Write back every dirty line.  Going by key keeps the
+//                writes in drum/block order so the head mostly moves forward.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if any write back failed
+
+int smsa_flush_cache( void ) {
+
+	SMSA_CACHE_SHARD *sh;
+	int key, i, ret = 0;
+
+	if (Cache == NULL){
+		return(0);
+	}
+	for (key=0; key<SMSA_CACHE_MAX_KEYS; key++){
+		sh = shard_of (key);
+		pthread_mutex_lock (&sh->lock);
+		i = CacheIndex[key];
+		if (i != -1 && Cache[i].line != NULL && Cache[i].dirty){
+			if (flush_line (sh, i) == -1){
+				ret = -1;
+			}
+		}
+		pthread_mutex_unlock (&sh->lock);
+	}
+	return(ret);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : export 
-// Description  : stores data in cache 
+// Function     : smsa_save_cache
+// Description  : Write the key and contents of every clean line to a
+//                snapshot file, oldest first so reloading it in order
+//                rebuilds the recency.  Dirty lines are left out, they are
+//                newer than the array the state describes.
+//
+// Inputs       : path - the snapshot file
+//                state - the drum hashes (SMSA_GET_STATE) of the array now
+// Outputs      : number of lines saved, -1 if failure
+
+int smsa_save_cache( const char *path, const uint64_t *state ) {
+
+	SMSA_CACHE_SNAPSHOT snap;
+	char tmp[1024];
+	int32_t *order;
+	uint32_t key, n = 0;
+	FILE *fp;
+	int i, ret = 0;
+
+	if (Cache == NULL || path == NULL || state == NULL){
+		return(-1);
+	}
+
+	// Gather the resident lines and put them in the order they were used
+	order = calloc (NUM_Cache_Line+1, sizeof(int32_t));
+	if (order == NULL){
+		logMessage (LOG_ERROR_LEVEL, "Unable to allocate cache snapshot.\n");
+		return(-1);
+	}
+	for (i=0; i<NUM_Cache_Entries && n<NUM_Cache_Line; i++){
+		if (Cache[i].line != NULL && !Cache[i].dirty){
+			order[n++] = i;
+		}
+	}
+	qsort (order, n, sizeof(int32_t), used_order);
+
+	// Write to the side and rename, so a crash never leaves half a snapshot
+	snprintf (tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen (tmp, "w")) == NULL){
+		logMessage (LOG_ERROR_LEVEL, "Unable to create cache snapshot [%s].\n", tmp);
+		free (order);
+		return(-1);
+	}
+	memset (&snap, 0x0, sizeof(snap));
+	memcpy (snap.magic, SMSA_CACHE_SNAPSHOT_MAGIC, sizeof(snap.magic));
+	snap.lines = n;
+	memcpy (snap.state, state, sizeof(snap.state));
+	if (fwrite (&snap, sizeof(snap), 1, fp) != 1){
+		ret = -1;
+	}
+	for (i=0; ret == 0 && i<n; i++){
+		key = SMSA_CACHE_KEY(Cache[order[i]].drum, Cache[order[i]].block);
+		if (fwrite (&key, sizeof(key), 1, fp) != 1 ||
+				fwrite (Cache[order[i]].line, SMSA_BLOCK_SIZE, 1, fp) != 1){
+			ret = -1;
+		}
+	}
+	free (order);
+	if (fclose (fp) != 0 || ret == -1 || rename (tmp, path) == -1){
+		logMessage (LOG_ERROR_LEVEL, "Unable to write cache snapshot [%s].\n", path);
+		remove (tmp);
+		return(-1);
+	}
+	logMessage (LOG_INFO_LEVEL, "Saved %u cache lines to [%s].\n", n, path);
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_load_cache
+// Description  : Put the lines of a snapshot file back into the cache,
+//                keeping only the ones whose drum still has the hash it
+//                had when the snapshot was taken.  A missing file is not
+//                an error, the cache just starts cold.
+//
+// Inputs       : path - the snapshot file
+//                state - the drum hashes (SMSA_GET_STATE) of the array now
+// Outputs      : number of lines loaded, -1 if failure
+
+int smsa_load_cache( const char *path, const uint64_t *state ) {
+
+	SMSA_CACHE_SNAPSHOT snap;
+	unsigned char block[SMSA_BLOCK_SIZE];
+	uint32_t key, i, loaded = 0, stale = 0;
+	FILE *fp;
+
+	if (Cache == NULL || path == NULL || state == NULL){
+		return(-1);
+	}
+	if ((fp = fopen (path, "r")) == NULL){
+		logMessage (LOG_INFO_LEVEL, "No cache snapshot [%s], starting cold.\n", path);
+		return(0);
+	}
+	if (fread (&snap, sizeof(snap), 1, fp) != 1 ||
+			memcmp (snap.magic, SMSA_CACHE_SNAPSHOT_MAGIC, sizeof(snap.magic)) != 0){
+		logMessage (LOG_ERROR_LEVEL, "Bad cache snapshot [%s], ignoring it.\n", path);
+		fclose (fp);
+		return(-1);
+	}
+
+	// Revalidate drum by drum, anything on a drum that changed is dropped
+	for (i=0; i<snap.lines; i++){
+		if (fread (&key, sizeof(key), 1, fp) != 1 || fread (block, SMSA_BLOCK_SIZE, 1, fp) != 1 ||
+				key >= SMSA_CACHE_MAX_KEYS){
+			logMessage (LOG_ERROR_LEVEL, "Truncated cache snapshot [%s].\n", path);
+			break;
+		}
+		if (snap.state[key/SMSA_MAX_BLOCK_ID] != state[key/SMSA_MAX_BLOCK_ID]){
+			stale++;
+			continue;
+		}
+		if (smsa_put_cache_line (key/SMSA_MAX_BLOCK_ID, key%SMSA_MAX_BLOCK_ID, block) == 0){
+			loaded++;
+		}
+	}
+	fclose (fp);
+	logMessage (LOG_INFO_LEVEL, "Warmed %u cache lines from [%s], %u stale.\n", loaded, path, stale);
+	return(loaded);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_get_cache_stats
+// Description  : Get the counters for one drum, or summed over the array
+//
+// Inputs       : drm - the drum ID, SMSA_DISK_ARRAY_SIZE for the totals
+//                stats - where to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_get_cache_stats( SMSA_DRUM_ID drm, SMSA_CACHE_STATS *stats ) {
+
+	SMSA_CACHE_STATS *st;
+	int i, s;
+
+	if (stats == NULL || drm > SMSA_DISK_ARRAY_SIZE){
+		return(-1);
+	}
+
+	// Every shard keeps its own counters, add them up
+	memset(stats, 0x0, sizeof(SMSA_CACHE_STATS));
+	for (s=0; CacheShard != NULL && s<NUM_Cache_Shards; s++){
+		for (i=0; i<SMSA_DISK_ARRAY_SIZE; i++){
+			if (drm != SMSA_DISK_ARRAY_SIZE && drm != i){
+				continue;
+			}
+			st = &CacheShard[s].stats[i];
+			stats->hits += st->hits;
+			stats->misses += st->misses;
+			stats->insertions += st->insertions;
+			stats->evictions += st->evictions;
+			stats->dirty_flushes += st->dirty_flushes;
+			stats->bytes_served += st->bytes_served;
+		}
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_cache_stats
+// Description  : Log the counters for every drum that saw any traffic,
+//                followed by the totals
+//
+// Inputs       : level - the log level to write the table at
+// Outputs      : none
+
+void smsa_log_cache_stats( unsigned long level ) {
+
+	SMSA_CACHE_STATS st;
+	char name[8];
+	int i;
+
+	logMessage (level, "Cache stats (%s, %u lines):",
+			CachePolicies[CachePolicy].name, NUM_Cache_Line);
+	logMessage (level, "%5s %10s %10s %7s %10s %10s %8s %12s", "drum",
+			"hits", "misses", "hit%", "inserts", "evicts", "flushes", "bytes");
+	for (i=0; i<=SMSA_DISK_ARRAY_SIZE; i++){
+		smsa_get_cache_stats (i, &st);
+		if (i < SMSA_DISK_ARRAY_SIZE && st.hits + st.misses + st.insertions == 0){
+			continue;
+		}
+		if (i == SMSA_DISK_ARRAY_SIZE)
+			strcpy(name, "all");
+		else
+			snprintf(name, sizeof(name), "%d", i);
+		logMessage (level, "%5s %10lu %10lu %6.2f%% %10lu %10lu %8lu %12lu",
+				name, st.hits, st.misses,
+				(st.hits + st.misses) ? 100.0*st.hits/(st.hits + st.misses) : 0.0,
+				st.insertions, st.evictions, st.dirty_flushes, st.bytes_served);
+	}
+	return;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_of
+// Description  : find the shard a key belongs to.  The multiplicative hash
+//                spreads neighbouring blocks over different shards.
+//
+// Inputs       : key - the (drum, block) key
+// Outputs      : the shard
+
+SMSA_CACHE_SHARD *shard_of (uint32_t key){
+
+	return(&CacheShard[((key * 2654435761u) >> 16) % NUM_Cache_Shards]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : seq_begin / seq_end
+// Description  : bracket a change to an entry's block or line, so lock free
+//                readers can tell they raced with it (odd while changing)
+//
+// Inputs       : index - the entry being changed
+// Outputs      : void function
+
+void seq_begin (int index){
+
+	__atomic_store_n (&Cache[index].seq, Cache[index].seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	return;
+}
+
+void seq_end (int index){
+
+	__atomic_store_n (&Cache[index].seq, Cache[index].seq+1, __ATOMIC_RELEASE);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : export
+// Description  : stores data in cache, copying the buffer into the line's
+//                slab slot unless it already is that slot
 //
 // Inputs       : drm - the drum ID to place
 //                blk - the block ID to lplace
@@ -187,14 +911,448 @@ int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf
 // Outputs      : void function
 
 void export (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, int index){
-	
+
 	// Storing data in the struct.
 	Cache[index].drum = drm;
 	Cache[index].block = blk;
-	Cache[index].line = buf;
-	
+	if (Cache[index].line != buf){
+		memcpy(Cache[index].line, buf, SMSA_BLOCK_SIZE);
+	}
+
+	return;
+}
+
+//
+// Entry and list helpers shared by the policies, all called with the
+// shard lock held
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlink_line
+// Description  : take an entry off whatever policy list it is on
+//
+// Inputs       : sh - the shard of the entry
+//                index - the entry to remove
+// Outputs      : void function
+
+void unlink_line (SMSA_CACHE_SHARD *sh, int index){
+
+	SMSA_CACHE_LIST *l;
+
+	if (Cache[index].list == SMSA_CACHE_NO_LIST)
+		return;
+	l = &sh->list[Cache[index].list];
+
+	// Point the neighbours (or the list ends) past this entry
+	if (Cache[index].prev != -1)
+		Cache[Cache[index].prev].next = Cache[index].next;
+	else
+		l->head = Cache[index].next;
+
+	if (Cache[index].next != -1)
+		Cache[Cache[index].next].prev = Cache[index].prev;
+	else
+		l->tail = Cache[index].prev;
+
+	l->size--;
+	Cache[index].prev = Cache[index].next = -1;
+	Cache[index].list = SMSA_CACHE_NO_LIST;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : push_line
+// Description  : put an entry at the head (most recent end) of a list
+//
+// Inputs       : sh - the shard of the entry
+//                list - the list to add to
+//                index - the entry to add
+// Outputs      : void function
+
+void push_line (SMSA_CACHE_SHARD *sh, uint8_t list, int index){
+
+	SMSA_CACHE_LIST *l = &sh->list[list];
+
+	unlink_line (sh, index);
+	Cache[index].prev = -1;
+	Cache[index].next = l->head;
+	if (l->head != -1)
+		Cache[l->head].prev = index;
+	l->head = index;
+	if (l->tail == -1)
+		l->tail = index;
+	l->size++;
+	Cache[index].list = list;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : touch_line
+// Description  : move an entry to the head of the list it is already on
+//
+// Inputs       : sh - the shard of the entry
+//                index - the entry that was used
+// Outputs      : void function
+
+void touch_line (SMSA_CACHE_SHARD *sh, int index){
+
+	// Already the most recent, nothing to move
+	if (sh->list[Cache[index].list].head == index)
+		return;
+
+	push_line (sh, Cache[index].list, index);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : new_line
+// Description  : make key resident in a free slab slot.  A ghost entry for
+//                the key is reused, otherwise a free entry is taken.  The
+//                caller must have made sure a slot is free.  The entry is
+//                left marked as being written until the caller has filled
+//                the line and called seq_end().
+//
+// Inputs       : sh - the shard of the key
+//                key - the (drum, block) key to make resident
+// Outputs      : the entry, not yet on any list
+
+int32_t new_line (SMSA_CACHE_SHARD *sh, uint32_t key){
+
+	int32_t index = CacheIndex[key];
+
+	if (index == -1){
+		index = sh->free_entry;
+		sh->free_entry = Cache[index].next;
+		Cache[index].prev = Cache[index].next = -1;
+		Cache[index].list = SMSA_CACHE_NO_LIST;
+		seq_begin (index);
+		__atomic_store_n (&CacheIndex[key], index, __ATOMIC_RELEASE);
+	} else {
+		seq_begin (index);
+		unlink_line (sh, index);
+	}
+
+	Cache[index].drum = key/SMSA_MAX_BLOCK_ID;
+	Cache[index].block = key%SMSA_MAX_BLOCK_ID;
+	Cache[index].line = sh->free_slot[--sh->free_slots];
+	Cache[index].ref = 0;
+	Cache[index].freq = 1;
+	Cache[index].dirty = 0;
+	sh->resident++;
+	return(index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : evict_line
+// Description  : give up a resident entry's slot, either forgetting the
+//                block or keeping it on a ghost list
+//
+// Inputs       : sh - the shard of the entry
+//                index - the entry to evict
+//                ghost - ghost list to remember it on, or SMSA_CACHE_NO_LIST
+// Outputs      : void function
+
+void evict_line (SMSA_CACHE_SHARD *sh, int index, uint8_t ghost){
+
+	// A dirty line has to reach the array before its slot is reused
+	if (Cache[index].dirty && flush_line (sh, index) == -1){
+		sh->flush_failed = 1;
+	}
+	Cache[index].dirty = 0;
+	CACHE_COUNT (sh, Cache[index].drum, evictions, 1);
+
+	// Readers copying out of the slot see the change and retry
+	seq_begin (index);
+	sh->free_slot[sh->free_slots++] = Cache[index].line;
+	Cache[index].line = NULL;
+	seq_end (index);
+	sh->resident--;
+
+	if (ghost == SMSA_CACHE_NO_LIST)
+		drop_line (sh, index);
+	else
+		push_line (sh, ghost, index);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_line
+// Description  : forget a non-resident entry entirely
+//
+// Inputs       : sh - the shard of the entry
+//                index - the entry to drop
+// Outputs      : void function
+
+void drop_line (SMSA_CACHE_SHARD *sh, int index){
+
+	unlink_line (sh, index);
+	__atomic_store_n (&CacheIndex[SMSA_CACHE_KEY(Cache[index].drum,Cache[index].block)], -1, __ATOMIC_RELEASE);
+	Cache[index].drum = -1;
+	Cache[index].block = -1;
+	Cache[index].next = sh->free_entry;
+	sh->free_entry = index;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_line
+// Description  : write a dirty line back to the array and mark it clean
+//
+// Inputs       : sh - the shard of the entry
+//                index - the entry to write back
+// Outputs      : 0 if successful, -1 if failure
+
+int flush_line (SMSA_CACHE_SHARD *sh, int index){
+
+	if (CacheFlush (Cache[index].drum, Cache[index].block, Cache[index].line) == -1){
+		logMessage (LOG_ERROR_LEVEL, "Write back failed [%d/%d].\n",
+				Cache[index].drum, Cache[index].block);
+		return(-1);
+	}
+	Cache[index].dirty = 0;
+	CACHE_COUNT (sh, Cache[index].drum, dirty_flushes, 1);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : used_order
+// Description  : qsort comparison putting entries in order of last use
+//
+// Inputs       : a, b - the entries to compare
+// Outputs      : <0, 0, >0 as a was used before, with or after b
+
+int used_order (const void *a, const void *b){
+
+	uint64_t ua = Cache[*(const int32_t *)a].used, ub = Cache[*(const int32_t *)b].used;
+
+	return((ua > ub) - (ua < ub));
+}
+
+//
+// Replacement policies, each shard runs its own copy
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_hit / lru_miss
+// Description  : LRU keeps one recency list and evicts its tail
+//
+// Inputs       : sh - the shard /
+//                ent - the entry used / key - the block to make room for
+// Outputs      : lru_miss returns the new entry
+
+void lru_hit (SMSA_CACHE_SHARD *sh, int32_t ent){
+
+	touch_line (sh, ent);
+	return;
+}
+
+int32_t lru_miss (SMSA_CACHE_SHARD *sh, uint32_t key){
+
+	int32_t ent;
+
+	if (sh->free_slots == 0)
+		evict_line (sh, sh->list[LIST_LRU].tail, SMSA_CACHE_NO_LIST);
+	ent = new_line (sh, key);
+	push_line (sh, LIST_LRU, ent);
+	return(ent);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_hit / clock_miss
+// Description  : CLOCK sets a reference bit on use and sweeps a hand over
+//                the lines, clearing bits until it finds an unreferenced
+//                line to replace.  New lines start unreferenced, so a block
+//                read once during a scan goes before the working set does.
+//
+// Inputs       : sh - the shard /
+//                ent - the entry used / key - the block to make room for
+// Outputs      : clock_miss returns the new entry
+
+void clock_hit (SMSA_CACHE_SHARD *sh, int32_t ent){
+
+	Cache[ent].ref = 1;
+	return;
+}
+
+int32_t clock_miss (SMSA_CACHE_SHARD *sh, uint32_t key){
+
+	int32_t ent;
+
+	// Lines fill the shard's first entries in order before the hand ever moves
+	if (sh->free_slots == 0){
+		while (Cache[sh->first+sh->hand].ref){
+			Cache[sh->first+sh->hand].ref = 0;
+			sh->hand = (sh->hand+1) % sh->lines;
+		}
+		ent = sh->first+sh->hand;
+		sh->hand = (sh->hand+1) % sh->lines;
+		evict_line (sh, ent, SMSA_CACHE_NO_LIST);
+	}
+	return(new_line (sh, key));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_hit / twoq_miss
+// Description  : 2Q admits new blocks to a small FIFO (A1in).  Blocks
+//                pushed out of it are remembered in A1out, and only a block
+//                that comes back while remembered is promoted to the main
+//                LRU (Am).  A1in is a quarter of the cache, A1out half.
+//
+// Inputs       : sh - the shard /
+//                ent - the entry used / key - the block to make room for
+// Outputs      : twoq_miss returns the new entry
+
+void twoq_hit (SMSA_CACHE_SHARD *sh, int32_t ent){
+
+	// A1in is FIFO, a re-reference there does not move the block
+	if (Cache[ent].list == LIST_AM)
+		touch_line (sh, ent);
+	return;
+}
+
+int32_t twoq_miss (SMSA_CACHE_SHARD *sh, uint32_t key){
+
+	int32_t ent;
+	uint32_t kin = (sh->lines/4) ? sh->lines/4 : 1;
+	uint32_t kout = (sh->lines/2) ? sh->lines/2 : 1;
+	int remembered = (CacheIndex[key] != -1);
+
+	// Reclaim a slot from A1in if it is over target (or Am is empty)
+	if (sh->free_slots == 0){
+		if (sh->list[LIST_A1IN].size > kin || sh->list[LIST_AM].size == 0){
+			evict_line (sh, sh->list[LIST_A1IN].tail, LIST_A1OUT);
+			if (sh->list[LIST_A1OUT].size > kout)
+				drop_line (sh, sh->list[LIST_A1OUT].tail);
+		} else {
+			evict_line (sh, sh->list[LIST_AM].tail, SMSA_CACHE_NO_LIST);
+		}
+	}
+
+	ent = new_line (sh, key);
+	push_line (sh, remembered ? LIST_AM : LIST_A1IN, ent);
+	return(ent);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_hit / arc_miss / arc_replace
+// Description  : ARC splits the cache between blocks seen once (T1) and
+//                blocks seen again (T2), with ghost lists B1/B2 of what
+//                each recently evicted.  A ghost hit moves the T1 target
+//                toward the list that would have kept the block.
+//
+// Inputs       : sh - the shard /
+//                ent - the entry used / key - the block to make room for /
+//                ghost_in_b2 - the missing block is a B2 ghost
+// Outputs      : arc_miss returns the new entry
+
+void arc_hit (SMSA_CACHE_SHARD *sh, int32_t ent){
+
+	push_line (sh, LIST_T2, ent);
 	return;
 }
 
+int32_t arc_miss (SMSA_CACHE_SHARD *sh, uint32_t key){
 
+	int32_t ent = CacheIndex[key];
+	uint32_t c = sh->lines, b1, b2, delta;
 
+	b1 = sh->list[LIST_B1].size;
+	b2 = sh->list[LIST_B2].size;
+
+	if (ent != -1 && Cache[ent].list == LIST_B1){
+		// Recently evicted from T1: T1 should have been bigger
+		delta = (b2 > b1) ? b2/b1 : 1;
+		sh->arc_target = (sh->arc_target+delta < c) ? sh->arc_target+delta : c;
+		if (sh->free_slots == 0)
+			arc_replace (sh, 0);
+		ent = new_line (sh, key);
+		push_line (sh, LIST_T2, ent);
+		return(ent);
+	}
+
+	if (ent != -1 && Cache[ent].list == LIST_B2){
+		// Recently evicted from T2: T2 should have been bigger
+		delta = (b1 > b2) ? b1/b2 : 1;
+		sh->arc_target = (sh->arc_target > delta) ? sh->arc_target-delta : 0;
+		if (sh->free_slots == 0)
+			arc_replace (sh, 1);
+		ent = new_line (sh, key);
+		push_line (sh, LIST_T2, ent);
+		return(ent);
+	}
+
+	// A brand new block, keep the directory within 2c entries
+	if (sh->list[LIST_T1].size + b1 == c){
+		if (sh->list[LIST_T1].size < c){
+			drop_line (sh, sh->list[LIST_B1].tail);
+			if (sh->free_slots == 0)
+				arc_replace (sh, 0);
+		} else {
+			evict_line (sh, sh->list[LIST_T1].tail, SMSA_CACHE_NO_LIST);
+		}
+	} else if (sh->resident + b1 + b2 >= c) {
+		if (sh->resident + b1 + b2 >= 2*c)
+			drop_line (sh, sh->list[LIST_B2].tail);
+		if (sh->free_slots == 0)
+			arc_replace (sh, 0);
+	}
+
+	ent = new_line (sh, key);
+	push_line (sh, LIST_T1, ent);
+	return(ent);
+}
+
+void arc_replace (SMSA_CACHE_SHARD *sh, int ghost_in_b2){
+
+	uint32_t t1 = sh->list[LIST_T1].size;
+
+	if (t1 > 0 && (t1 > sh->arc_target || (ghost_in_b2 && t1 == sh->arc_target)))
+		evict_line (sh, sh->list[LIST_T1].tail, LIST_B1);
+	else
+		evict_line (sh, sh->list[LIST_T2].tail, LIST_B2);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lfu_hit / lfu_miss
+// Description  : LFU keeps one list per use count (list n holds blocks used
+//                n times) and evicts the least recent block of the lowest
+//                non-empty count.  Counts saturate so the lists stay bounded.
+//
+// Inputs       : sh - the shard /
+//                ent - the entry used / key - the block to make room for
+// Outputs      : lfu_miss returns the new entry
+
+void lfu_hit (SMSA_CACHE_SHARD *sh, int32_t ent){
+
+	if (Cache[ent].freq < SMSA_CACHE_LFU_MAX_FREQ)
+		Cache[ent].freq++;
+	push_line (sh, Cache[ent].freq, ent);
+	return;
+}
+
+int32_t lfu_miss (SMSA_CACHE_SHARD *sh, uint32_t key){
+
+	int32_t ent;
+	int f;
+
+	if (sh->free_slots == 0){
+		for (f=1; sh->list[f].size == 0; f++)
+			;
+		evict_line (sh, sh->list[f].tail, SMSA_CACHE_NO_LIST);
+	}
+	ent = new_line (sh, key);
+	push_line (sh, Cache[ent].freq, ent);
+	return(ent);
+}
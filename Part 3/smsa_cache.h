@@ -12,35 +12,123 @@
 
 // Include Files
 #include <stdint.h>
-#include <sys/time.h>
 
 // Project Include Files
 #include <smsa.h>
 
+// Defines
+#define SMSA_CACHE_MAX_KEYS (SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID)
+#define SMSA_CACHE_KEY(drm,blk) (((uint32_t)(drm)*SMSA_MAX_BLOCK_ID)+(blk))
+#define SMSA_CACHE_ALIGNMENT 4096
+#define SMSA_CACHE_NO_LIST 0xff
+#define SMSA_CACHE_LFU_MAX_FREQ 31
+#define SMSA_CACHE_MAX_LISTS (SMSA_CACHE_LFU_MAX_FREQ+1)
+#define SMSA_CACHE_MAX_SHARDS 64
+
 //
 // Type Definitions
 
-// This is the structure for the cache line
+// The replacement policies the cache can run
+typedef enum {
+	SMSA_CACHE_LRU		= 0,  // Least recently used
+	SMSA_CACHE_CLOCK	= 1,  // Second chance clock sweep
+	SMSA_CACHE_2Q		= 2,  // Johnson/Shasha 2Q (A1in, A1out, Am)
+	SMSA_CACHE_ARC		= 3,  // Megiddo/Modha adaptive replacement
+	SMSA_CACHE_LFU		= 4,  // Least frequently used (ties broken by LRU)
+	SMSA_CACHE_MAX_POLICY	= 5,  // The largest value of a policy (+1)
+} SMSA_CACHE_POLICY;
+
+// This is the structure for the cache line.  2Q and ARC also remember
+// recently evicted blocks as "ghost" entries, which have no line.
 typedef struct {
     SMSA_DRUM_ID     drum;  // This is the drum for the cache line
     SMSA_BLOCK_ID    block; // This is the block ID for the cache line
-    struct timeval   used;  // A timestamp of the last use of this entry
-    unsigned char   *line;  // This is cache entru itslef
+    uint64_t         used;  // Logical clock value at the last use of this entry
+    int32_t          prev;  // More recently used entry on the same list (-1 if head)
+    int32_t          next;  // Less recently used entry on the same list (-1 if tail)
+    uint8_t          list;  // Policy list holding the entry (SMSA_CACHE_NO_LIST if none)
+    uint8_t          ref;   // CLOCK reference bit
+    uint8_t          freq;  // LFU use count (saturates at SMSA_CACHE_LFU_MAX_FREQ)
+    uint8_t          dirty; // 1 if the line is newer than the array (write-back)
+    uint32_t         seq;   // Bumped around every change to block/line, odd while changing
+    unsigned char   *line;  // This is cache entru itslef (a slot in the slab, NULL for ghosts)
 } SMSA_CACHE_LINE;
 
+// Writes a dirty line back to the array, 0 if successful, -1 if failure
+typedef int (*SMSA_CACHE_FLUSH)( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf );
+
+// A doubly linked list of entries, threaded through prev/next
+typedef struct {
+    int32_t          head;  // Most recent entry (-1 if empty)
+    int32_t          tail;  // Least recent entry (-1 if empty)
+    uint32_t         size;  // Number of entries on the list
+} SMSA_CACHE_LIST;
+
+// What the cache did for one drum since smsa_init_cache()
+typedef struct {
+    uint64_t         hits;          // Lookups that found the block cached
+    uint64_t         misses;        // Lookups that did not
+    uint64_t         insertions;    // Blocks brought into a line
+    uint64_t         evictions;     // Lines given up to make room
+    uint64_t         dirty_flushes; // Dirty lines written back to the array
+    uint64_t         bytes_served;  // Bytes handed out of cached lines
+} SMSA_CACHE_STATS;
+
 //
 // Funtional Prototypes
 
+// Select the replacement policy used by the next smsa_init_cache()
+int smsa_set_cache_policy( SMSA_CACHE_POLICY policy );
+
+// Find a policy by name ("lru", "clock", "2q", "arc", "lfu"), -1 if unknown
+int smsa_cache_policy_lookup( const char *name );
+
+// Select how many independently locked shards smsa_init_cache() makes
+int smsa_set_cache_shards( uint32_t shards );
+
 // Setup the block cache
 int smsa_init_cache( uint32_t lines );
 
 // Clear cache and free associated memory
 int smsa_close_cache( void );
 
-// Check to see if the cache entry is available
+// Check to see if the cache entry is available (single threaded use only)
 unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
 
-// Put a new line into the cache
+// Copy len bytes at offset off out of a cached block, -1 if not cached (lock free)
+int smsa_read_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t off, uint32_t len, unsigned char *buf );
+
+// Check whether a block is cached, without counting it as a use
+int smsa_probe_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
+
+// Put a new line into the cache (the buffer is copied into the cache)
 int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf );
 
+// Set the function used to write dirty lines back to the array
+void smsa_set_cache_writeback( SMSA_CACHE_FLUSH flush );
+
+// Mark a cached line as modified, it is written back when evicted or flushed
+int smsa_dirty_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
+
+// Write a dirty line back to the array now, keeping it cached
+int smsa_clean_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
+
+// Forget a cached line without writing it back (the array changed under it)
+int smsa_drop_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
+
+// Write back every dirty line, in block order
+int smsa_flush_cache( void );
+
+// Snapshot the clean lines to a file, tagged with the array state (drum hashes)
+int smsa_save_cache( const char *path, const uint64_t *state );
+
+// Reload a snapshot, keeping lines whose drum hash still matches state
+int smsa_load_cache( const char *path, const uint64_t *state );
+
+// Get the counters for a drum (SMSA_DISK_ARRAY_SIZE for the whole array)
+int smsa_get_cache_stats( SMSA_DRUM_ID drm, SMSA_CACHE_STATS *stats );
+
+// Log the counters for every drum that saw any traffic, and the totals, at a log level
+void smsa_log_cache_stats( unsigned long level );
+
 #endif
@@ -12,26 +12,83 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sched.h>
 
 // Project Include Files
 #include <smsa_network.h>
+#include <smsa_shm.h>
 #include <smsa.h>
 #include <cmpsc311_log.h>
 
+// Defines
+#define SMSA_CLIENT_WINDOW 64 // Most requests in flight at once
+#define SMSA_CLIENT_SHM_WAIT 1000  // Milliseconds asleep on a ring before checking the server is there
+#define SMSA_CLIENT_SHM_SPINS 100000  // Spins on a ring before checking the server is there
+#define SMSA_CLIENT_OUT_PARTS (SMSA_CLIENT_WINDOW+2*SMSA_NET_MAX_BATCH+1)  // Pieces of the packets held to send
+#define SMSA_CLIENT_IN_PARTS (2+SMSA_NET_MAX_BATCH)  // Pieces a reply is read into
+
+// Type Definitions
+
+// One request in flight, kept in the slot id%SMSA_CLIENT_WINDOW
+typedef struct {
+	uint32_t id;             // The request id (0 if the slot is free)
+	uint32_t op;             // The opcode sent
+	unsigned char *block;    // Where the reply block goes (NULL to drop it)
+	int done;                // 1 once the reply has arrived
+	int16_t ret;             // The server's return code
+	int waited;              // 1 if the sender took the id to wait for it
+	int count;               // Operations in a batch (0 if not a batch)
+	uint32_t *ops;           // The opcodes of the batch
+	unsigned char **blocks;  // Where each one's blocks go (NULL to drop them)
+	int16_t *rets;           // Where each one's return code goes (NULL if not wanted)
+	unsigned char header[SMSA_NET_HEADER_SIZE];  // The packet header, sent from here
+} SMSA_CLIENT_REQUEST;
+
 // Global variables
 int Socket = -1;
-int Flag, FlagW;
+SMSA_NET_TRANSPORT Transport = SMSA_NET_TCP;  // How the next connection goes
+SMSA_SHM_SEGMENT *Shm = NULL;   // The rings, if the connection uses them
 unsigned char buf[SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE];
 int Length;
 
+// Requests sent but not yet waited for.  Packets are held in Out until
+// the client waits for a reply (or flushes), so a run of requests goes to
+// the server in one write.  Out only points at the headers in the window
+// and at the caller's blocks, writev gathers them, and replies are read
+// with readv straight to where they go.
+SMSA_CLIENT_REQUEST Window[SMSA_CLIENT_WINDOW];
+uint32_t NextId = 1;      // Id of the next request
+uint32_t Oldest = 0;      // Id of the request the next reply is for
+uint32_t InFlight = 0;    // Requests sent whose replies have not arrived
+int Failed = 0;           // Requests nobody waits for that failed since the last wait for all
+struct iovec Out[SMSA_CLIENT_OUT_PARTS];
+int OutCount = 0;
+uint32_t BatchOps[SMSA_NET_MAX_BATCH];  // The opcodes of a batch frame, in network order
+unsigned char Drop[SMSA_BLOCK_SIZE];    // Where blocks nobody wants are read
+
 // Functional Prototypes
 int Client_Connect (void);
-void Construct ( unsigned char *block, uint32_t op);
-int Deconstruct (uint16_t *len, uint32_t op);
+int Client_Attach (void);
+int Client_Alive (void);
+void Client_Close (void);
+int Submit (uint32_t op, unsigned char *block, struct iovec *data, int count, int size, uint32_t *id);
+void Construct (unsigned char *header, uint32_t op, uint32_t id, int size);
+int Deconstruct (uint16_t *len, uint32_t *op, int16_t *ret, uint32_t *id);
+int Flush (void);
+int Receive (void);
+int Scatter (SMSA_CLIENT_REQUEST *req, struct iovec *in, unsigned char *rets, int *len);
+int Transfer (unsigned char *data, int len, int sending);
+int TransferV (struct iovec *iov, int count, int sending);
+int ShmTransfer (unsigned char *data, int len, int sending);
+int Payload (uint32_t op, int reply);
 //
 // Functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,7 +97,7 @@ int Deconstruct (uint16_t *len, uint32_t op);
 // Description  : This the client operation that sends a reques to the SMSA
 //                server.   It will:
 //
-//                1) if mounting make a connection to the server 
+//                1) if mounting make a connection to the server
 //                2) send any request to the server, returning results
 //                3) if unmounting, will close the connection
 //
@@ -50,12 +107,42 @@ int Deconstruct (uint16_t *len, uint32_t op);
 
 int smsa_client_operation( uint32_t op, unsigned char *block ) {
 
-	// Local variable 
-	uint16_t len;
-       	int rb = 0;
+	// Local variable
+	uint32_t id;
+
+	// Send the request and wait for its reply
+	if (smsa_client_send(op, block, &id) == -1){
+		return(-1);
+	}
+	return (smsa_client_wait(id));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_send
+// Description  : Send a request without waiting for its reply.  The server
+//                runs requests in the order they are sent, so a later
+//                request sees what an earlier one did.  A failure of a
+//                request nobody waits for (no id taken) is reported by the
+//                next wait for all of them, smsa_client_wait(0).
+//
+// Inputs       : op - the operation code for the command
+//                block - the block to write (WRITE) or to read into
+//                        (READ/GET_STATE).  It is sent from where it is, so
+//                        a block written has to stay put until the next
+//                        smsa_client_flush or wait, one read into until
+//                        the reply is waited for.  Extents write or read
+//                        their run of blocks the same way, a partial
+//                        write just the bytes it writes.
+//                id - where to put the request id (NULL if not wanted)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_send( uint32_t op, unsigned char *block, uint32_t *id ) {
 
 	// Declare variable to store the data from op code
 	SMSA_DISK_COMMAND op_code = op>>26;
+	int size = Payload(op, 0);
+	struct iovec data;
 
 	// calling fucntion to extract data.
 	if (op_code == SMSA_MOUNT){
@@ -68,85 +155,266 @@ int smsa_client_operation( uint32_t op, unsigned char *block ) {
 			}
 		}
 	}
-	
-	// Assigning the size of len based on the op code.
-	if (op_code == SMSA_DISK_WRITE){
-		FlagW = 1;
-		Flag = 1;
+
+	// Writes send the block, everything else may read into it
+	data.iov_base = block;
+	data.iov_len = size;
+	return (Submit(op, (size > 0) ? NULL : block, &data, (size > 0) ? 1 : 0, size, id));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_operation_batch
+// Description  : Run many operations with one request and one reply per
+//                batch frame (a frame holds up to SMSA_NET_MAX_BATCH of
+//                them).  The server runs them in order, after every
+//                request sent before.  Mounting and unmounting are left
+//                to smsa_client_operation.
+//
+// Inputs       : ops - the operation codes
+//                blocks - the block each operation writes or reads into,
+//                         as for smsa_client_send (NULL if none do)
+//                rets - where to put each operation's return code (NULL
+//                       if not wanted)
+//                count - the number of operations
+// Outputs      : 0 if all succeeded, -1 if any failed
+
+int smsa_client_operation_batch( uint32_t *ops, unsigned char **blocks, int16_t *rets, int count ) {
+
+	// Local variables
+	SMSA_CLIENT_REQUEST *req;
+	struct iovec data[2*SMSA_NET_MAX_BATCH];
+	uint32_t id = 0;
+	int first, n, size, parts, reply, blk, i;
+
+	// Pack as many operations into each frame as its length allows
+	for (first = 0; first < count; first += n){
+		size = 0;
+		parts = 0;
+		reply = SMSA_NET_HEADER_SIZE;
+		for (n = 0; (n < SMSA_NET_MAX_BATCH) && (first+n < count); n++){
+			i = first+n;
+			if ((ops[i]>>26) == SMSA_MOUNT || (ops[i]>>26) == SMSA_UNMOUNT){
+				logMessage (LOG_INFO_LEVEL,"Mount and unmount cannot be batched.\n");
+				return(-1);
+			}
+			blk = Payload(ops[i], 0);
+			if (SMSA_NET_HEADER_SIZE+size+sizeof(uint32_t)+blk > SMSA_NET_MAX_FRAME ||
+					reply+sizeof(int16_t)+Payload(ops[i], 1) > SMSA_NET_MAX_FRAME){
+				break;
+			}
+			BatchOps[n] = htonl(ops[i]);
+			data[parts].iov_base = &BatchOps[n];
+			data[parts++].iov_len = sizeof(uint32_t);
+			size += sizeof(uint32_t);
+			if (blk > 0){
+				data[parts].iov_base = blocks[i];
+				data[parts++].iov_len = blk;
+				size += blk;
+			}
+			reply += sizeof(int16_t)+Payload(ops[i], 1);
+		}
+
+		// Send the frame, the reply says where its parts go
+		if (Submit(SMSA_NET_BATCH_OP(n), NULL, data, parts, size, &id) == -1){
+			return(-1);
+		}
+
+		// The next frame puts its opcodes where this one's are
+		if (Flush() == -1){
+			return(-1);
+		}
+		req = &Window[id % SMSA_CLIENT_WINDOW];
+		req->count = n;
+		req->ops = &ops[first];
+		req->blocks = (blocks != NULL) ? &blocks[first] : NULL;
+		req->rets = (rets != NULL) ? &rets[first] : NULL;
 	}
-	else 
-		Flag=0;
 
-	//Calling Calling a function that will construct the packet.
-	Construct(block, op);
+	// The last frame's reply comes after all the others
+	return ((id != 0) ? smsa_client_wait(id) : 0);
+}
 
-	// Calling write to write across the network.
-	if (write (Socket, &buf, Length) < 0){
-		logMessage (LOG_INFO_LEVEL, "Error sending packet over network.\n");
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Submit
+// Description  : Take a window slot for a request and add its packet to
+//                the ones going out.  The bytes after the header are sent
+//                from where the caller has them when the packets are
+//                flushed.
+//
+// Inputs       : op - the operation code for the packet
+//                block - where the reply's blocks go (NULL to drop them)
+//                data - the pieces of the bytes that follow the header
+//                count - the number of pieces
+//                size - the number of bytes in all of them
+//                id - where to put the request id (NULL if not wanted)
+// Outputs      : 0 if successful, -1 if failure
+
+int Submit (uint32_t op, unsigned char *block, struct iovec *data, int count, int size, uint32_t *id){
+
+	// Local variables
+	SMSA_CLIENT_REQUEST *req;
+	int i;
+
+	if (Socket == -1){
+		logMessage (LOG_INFO_LEVEL,"Not connected to server.\n");
 		return(-1);
-	}	
-	
-	// To recieve what server did we call read
-	// but this time if op is write we dont want to send buf
-	// and if op is any thing other than write we want to send 
-	// buf.
-	if (op_code == SMSA_DISK_WRITE)
-		Flag=0;
-	else 
-		Flag=1;
-
-	// Calling constuct to create new package.
-	Construct (block, op);
-
-	// Calling read to read across the network.
-	if (read(Socket, &buf, Length) < 0) {
-		logMessage (LOG_INFO_LEVEL,"Error reading across the network.\n");
+	}
+
+	// Make room in the window, the oldest request may still be in it
+	req = &Window[NextId % SMSA_CLIENT_WINDOW];
+	while (req->id != 0 && !req->done){
+		if (Flush() == -1 || Receive() == -1){
+			return(-1);
+		}
+	}
+
+	// Take the slot, its reply is the next one if nothing else is out
+	req->id = NextId++;
+	req->op = op;
+	req->block = block;
+	req->done = 0;
+	req->ret = 0;
+	req->waited = (id != NULL);
+	req->count = 0;
+	if (NextId == 0){
+		NextId = 1;
+	}
+	if (InFlight++ == 0){
+		Oldest = req->id;
+	}
+	if (id != NULL){
+		*id = req->id;
+	}
+
+	// Add the header and the bytes to the pieces going out
+	if (OutCount+1+count > SMSA_CLIENT_OUT_PARTS && Flush() == -1){
 		return(-1);
 	}
+	Construct (req->header, op, req->id, size);
+	Out[OutCount].iov_base = req->header;
+	Out[OutCount++].iov_len = SMSA_NET_HEADER_SIZE;
+	for (i = 0; i < count; i++){
+		Out[OutCount++] = data[i];
+	}
 
-	// Calling a fucntion to recieve what we read across the network.
-	if (Deconstruct(&len , op) == -1){
-		logMessage (LOG_INFO_LEVEL,"Error recieveing packet across the network.\n");
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_wait
+// Description  : Wait for the reply to a request.  Every request sent before
+//                it is answered first, but the wait only fails if this
+//                request did.  Waiting for all of them fails if any request
+//                nobody waits for failed since the last such wait.  Waiting
+//                for the unmount closes the connection.
+//                A request has to be waited for before SMSA_CLIENT_WINDOW
+//                more are sent.
+//
+// Inputs       : id - the request id from smsa_client_send (0 for all
+//                     the requests sent so far)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_wait( uint32_t id ) {
+
+	// Local variable
+	SMSA_CLIENT_REQUEST *req = &Window[id % SMSA_CLIENT_WINDOW];
+	int ret;
+
+	// Wait for everything in flight
+	if (id == 0){
+		if (Flush() == -1){
+			return(-1);
+		}
+		while (InFlight > 0){
+			if (Receive() == -1){
+				return(-1);
+			}
+		}
+		ret = Failed ? -1 : 0;
+		Failed = 0;
+		return(ret);
+	}
+
+	// Check that the request is the one in the slot
+	if (req->id != id){
+		logMessage (LOG_INFO_LEVEL,"Waiting for unknown request [%u].\n", id);
 		return(-1);
-	}	
-	
-	// Copy buf from the packet to block.
-	if (len > SMSA_NET_HEADER_SIZE){
-		
-		if (read (Socket, &block[rb], len-SMSA_NET_HEADER_SIZE-rb) < 0){
-			logMessage (LOG_INFO_LEVEL, "Error reading the block.\n");
+	}
+
+	// Send what is held and read replies until this one is in
+	if (Flush() == -1){
+		return(-1);
+	}
+	while (!req->done){
+		if (Receive() == -1){
 			return(-1);
 		}
-			
 	}
+
+	// Free the slot, fail if this request did
+	ret = (req->ret != 0) ? -1 : 0;
+	req->id = 0;
+
 	// Close the socket if the utility of this function is done.
-	if (op_code == SMSA_UNMOUNT){
-		close(Socket);
-		Socket = -1;
+	if ((req->op>>26) == SMSA_UNMOUNT){
+		Client_Close();
 	}
-		
-	// return 0 for success.
-	return (0);
+	return (ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_flush
+// Description  : Send the requests being held without waiting for any
+//                reply, after which the blocks they write may be reused
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_flush( void ) {
+	return (Flush());
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_transport
+// Description  : Pick how the next connection reaches the server.  The
+//                shared memory ones need the server on this host.
+//
+// Inputs       : transport - SMSA_NET_TCP, SMSA_NET_SHM or SMSA_NET_SHM_POLL
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_set_transport( SMSA_NET_TRANSPORT transport ) {
+
+	if (transport > SMSA_NET_SHM_POLL){
+		logMessage (LOG_INFO_LEVEL,"Unknown transport [%d].\n", transport);
+		return(-1);
+	}
+	Transport = transport;
+	return(0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : Client_Connect 
+// Function     : Client_Connect
 // Description  : This function makes connection to server.
-//                
+//
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
 int Client_Connect (void){
-	
+
 	struct sockaddr_in caddr;
-	
+	int optval = 1;
+
 	// Setting up the server and bind it to the define port
 	// from smsa_network.h
 	caddr.sin_family = AF_INET;
 	caddr.sin_port = htons(SMSA_DEFAULT_PORT);
-	
+
 	// Connecting address to sever.
 	if (inet_aton (SMSA_DEFAULT_IP, &caddr.sin_addr) == 0){
 		logMessage (LOG_INFO_LEVEL,"Error in connecting address.\n");
@@ -164,6 +432,18 @@ int Client_Connect (void){
 	// Connecting socket to server.
 	if (connect (Socket, (const struct sockaddr *)&caddr, sizeof(struct sockaddr)) == -1){
 		logMessage(LOG_INFO_LEVEL,"Error connecting to socket to server.\n");
+		close(Socket);
+		Socket = -1;
+		return(-1);
+	}
+
+	// Requests go out as soon as they are flushed, not held for acks
+	setsockopt (Socket, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+	// Move to shared memory if asked to
+	if (Transport != SMSA_NET_TCP && Client_Attach() == -1){
+		close(Socket);
+		Socket = -1;
 		return(-1);
 	}
 
@@ -171,93 +451,456 @@ int Client_Connect (void){
 	return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Client_Attach
+// Description  : Make the shared memory rings and move the connection to
+//                them once the server says it has them mapped
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int Client_Attach (void){
+
+	// Local variables
+	SMSA_SHM_SEGMENT *seg;
+	char name[SMSA_SHM_NAME_SIZE];
+	uint16_t len;
+	uint32_t op, id;
+	int16_t ret;
+
+	memset (name, 0x0, sizeof(name));
+	if ((seg = smsa_shm_create(name)) == NULL){
+		return(-1);
+	}
+
+	// Send the name on the socket and wait for the server to map it
+	Construct (buf, SMSA_NET_ATTACH<<26, 0, SMSA_SHM_NAME_SIZE);
+	if (Transfer(buf, SMSA_NET_HEADER_SIZE, 1) == -1 || Transfer((unsigned char *)name, SMSA_SHM_NAME_SIZE, 1) == -1 ||
+			Transfer(buf, SMSA_NET_HEADER_SIZE, 0) == -1 || Deconstruct(&len, &op, &ret, &id) == -1 ||
+			len != SMSA_NET_HEADER_SIZE || ret != 0){
+		logMessage (LOG_INFO_LEVEL, "Server did not attach the shared memory.\n");
+		smsa_shm_unlink(name);
+		smsa_shm_detach(seg);
+		return(-1);
+	}
+	Shm = seg;
+
+	// Both sides have it mapped, the name is not needed any more
+	smsa_shm_unlink(name);
+	logMessage (LOG_INFO_LEVEL, "Using shared memory [%s].\n", name);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Client_Alive
+// Description  : Check the server has not closed the connection, it sends
+//                nothing on the socket once on shared memory
+//
+// Inputs       : none
+// Outputs      : 1 if the connection is up, 0 if not
+
+int Client_Alive (void){
+
+	// Local variables
+	unsigned char c;
+	int rb;
+
+	rb = recv(Socket, &c, 1, MSG_PEEK|MSG_DONTWAIT);
+	return (rb > 0 || (rb == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Client_Close
+// Description  : Close the connection and forget the requests in flight
+//
+// Inputs       : none
+// Outputs      : none
+
+void Client_Close (void){
+
+	close(Socket);
+	Socket = -1;
+	if (Shm != NULL){
+		smsa_shm_detach(Shm);
+		Shm = NULL;
+	}
+	memset (Window, 0x0, sizeof(Window));
+	InFlight = 0;
+	OutCount = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : Construct
-// Description  : This will create the package 
+// Description  : This will create the package header, the blocks written
+//                follow it
 //
-// Inputs       : buf - the buf which will hold the package.
-// 		  op - the operation code for the command
-//                block - the block to be read/writen from (READ/WRITE)
+// Inputs       : header - where the header goes (SMSA_NET_HEADER_SIZE bytes)
+//                op - the operation code for the command
+//                id - the request id
+//                size - the number of bytes that follow the header
 // Outputs      : none
 
-void Construct ( unsigned char *block, uint32_t op){
-	
+void Construct (unsigned char *header, uint32_t op, uint32_t id, int size){
+
 	// local varialbes
 	uint16_t len, ret;
 
-	if (Flag == 1)
-		len = SMSA_NET_HEADER_SIZE + SMSA_BLOCK_SIZE;
-	else
-		len = SMSA_NET_HEADER_SIZE;
+	len = SMSA_NET_HEADER_SIZE + size;
 
 	// Converting to network byte order
 	len = htons(len);
 	op = htonl(op);
 	ret = htons(0);
-	
-	// storing the packet in buf.
+	id = htonl(id);
+
+	// storing the header in its place.
 	Length = 0;
-	memcpy(&buf[Length], &len, sizeof(len)); 
+	memcpy(&header[Length], &len, sizeof(len));
 	Length += sizeof(uint16_t);
-	memcpy(&buf[Length], &op, sizeof(op));
+	memcpy(&header[Length], &op, sizeof(op));
 	Length += sizeof(uint32_t);
-	memcpy(&buf[Length], &ret, sizeof(ret));
+	memcpy(&header[Length], &ret, sizeof(ret));
 	Length += sizeof(uint16_t);
-	
-	// If writing include the block to packet.
-	if (Flag == 1 && FlagW == 1 && block != NULL){
-	
-		FlagW = 0;
-		// Adding block to the packet.
-		memcpy(&buf[Length], block, SMSA_BLOCK_SIZE);
-		
-		Length += SMSA_BLOCK_SIZE;
-	}	
-	
+	memcpy(&header[Length], &id, sizeof(id));
+	Length += sizeof(uint32_t);
+
 	return;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : Deconstruct 
-// Description  : This will deconsrtuct the package recieved from the server. 
+// Function     : Deconstruct
+// Description  : This will deconsrtuct the package header recieved from
+//                the server.
 //
-// Inputs       : buf - the buf which will hold the package.
-// 		  op - the operation code for the command
-//                block - the block to be read/writen from (READ/WRITE)
+// Inputs       : len, op, ret, id - where to put the header fields
 // Outputs      : 0 for success -1 for failure
 
-int  Deconstruct (uint16_t *len, uint32_t op){
-	
-	// Local variables
-	uint32_t op_code;
-	uint16_t length, ret;
-	
+int  Deconstruct (uint16_t *len, uint32_t *op, int16_t *ret, uint32_t *id){
+
 	// deconstructing the packet received from the server
 	// and converting to host byte order.
 	Length = 0;
-	memcpy( &length, buf, sizeof(uint16_t));
+	memcpy(len, buf, sizeof(uint16_t));
 	Length += sizeof(uint16_t);
-	length = ntohs(length);
-	memcpy(&op_code, &buf[Length], sizeof(uint32_t));
+	*len = ntohs(*len);
+	memcpy(op, &buf[Length], sizeof(uint32_t));
 	Length+= sizeof(uint32_t);
-	op_code = ntohs(op_code);
-	memcpy (&ret, &buf[Length], sizeof(uint16_t));
+	*op = ntohl(*op);
+	memcpy (ret, &buf[Length], sizeof(uint16_t));
 	Length += sizeof(uint16_t);
-	ret = ntohs(ret);
-	
+	*ret = ntohs(*ret);
+	memcpy (id, &buf[Length], sizeof(uint32_t));
+	Length += sizeof(uint32_t);
+	*id = ntohl(*id);
+
+	if (*len < SMSA_NET_HEADER_SIZE){
+		logMessage (LOG_INFO_LEVEL, "Bad reply length [%u].\n", *len);
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Flush
+// Description  : Send the packets held for the server
+//
+// Inputs       : none
+// Outputs      : 0 for success -1 for failure
+
+int Flush (void){
+
+	if (OutCount > 0 && TransferV(Out, OutCount, 1) == -1){
+		logMessage (LOG_INFO_LEVEL, "Error sending packet over network.\n");
+		return(-1);
+	}
+	OutCount = 0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Receive
+// Description  : Read one reply.  Replies come in the order the requests
+//                went, so it is known whose it is before it arrives and
+//                its header and blocks are read in one go, the blocks
+//                straight to where the request wants them.
+//
+// Inputs       : none
+// Outputs      : 0 for success -1 for failure
+
+int Receive (void){
+
+	// Local variables
+	SMSA_CLIENT_REQUEST *req = &Window[Oldest % SMSA_CLIENT_WINDOW];
+	struct iovec in[SMSA_CLIENT_IN_PARTS];
+	unsigned char rets[SMSA_NET_MAX_BATCH*sizeof(int16_t)];
+	uint16_t len;
+	uint32_t op, id;
+	int16_t ret;
+	int count, size, i;
+
+	if (InFlight == 0){
+		logMessage (LOG_INFO_LEVEL,"No reply to wait for.\n");
+		return(-1);
+	}
+	if (req->id != Oldest || req->done){
+		logMessage (LOG_INFO_LEVEL,"Lost track of request [%u].\n", Oldest);
+		return(-1);
+	}
+
+	// Read the reply, then check it is the one expected
+	count = Scatter(req, in, rets, &size);
+	if (TransferV(in, count, 0) == -1){
+		logMessage (LOG_INFO_LEVEL,"Error reading across the network.\n");
+		return(-1);
+	}
+	if (Deconstruct(&len, &op, &ret, &id) == -1){
+		logMessage (LOG_INFO_LEVEL,"Error recieveing packet across the network.\n");
+		return(-1);
+	}
+	if (id != req->id){
+		logMessage (LOG_INFO_LEVEL,"Reply for unknown request [%u].\n", id);
+		return(-1);
+	}
+	if (len != size){
+		logMessage (LOG_INFO_LEVEL, "Bad reply length [%u].\n", len);
+		return(-1);
+	}
+	if (op != req->op){
+		logMessage (LOG_INFO_LEVEL,"Differnet op codes.\n");
+	}
+
+	// A batch reply has the return codes of its operations
+	if (req->count > 0 && req->rets != NULL){
+		for (i = 0; i < req->count; i++){
+			memcpy (&req->rets[i], &rets[i*sizeof(int16_t)], sizeof(int16_t));
+			req->rets[i] = ntohs(req->rets[i]);
+		}
+	}
+
 	// To check if the package was recieved was succesfull.
 	if (ret != 0){
 		logMessage (LOG_INFO_LEVEL, "Return value not equal to 0.\n");
-		if (op_code != op)
-			logMessage (LOG_INFO_LEVEL,"Differnet op codes.\n");
-		return(-1);
+		if (!req->waited){
+			Failed = 1;
+		}
 	}
+	req->ret = ret;
+	req->done = 1;
+	InFlight--;
+	if (++Oldest == 0){
+		Oldest = 1;
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Scatter
+// Description  : Say where each part of a request's reply goes: the header
+//                to buf, a batch's return codes to rets, and the blocks to
+//                the request (or a block at a time to Drop if it does not
+//                want them)
+//
+// Inputs       : req - the request
+//                in - the pieces to fill (SMSA_CLIENT_IN_PARTS of them)
+//                rets - where a batch's return codes go
+//                len - where to put the length of the reply
+// Outputs      : the number of pieces
+
+int Scatter (SMSA_CLIENT_REQUEST *req, struct iovec *in, unsigned char *rets, int *len){
+
+	// Local variables
+	unsigned char *to;
+	int count = 0, ops = (req->count > 0) ? req->count : 1, blk, i;
+
+	in[count].iov_base = buf;
+	in[count++].iov_len = SMSA_NET_HEADER_SIZE;
+	*len = SMSA_NET_HEADER_SIZE;
+	if (req->count > 0){
+		in[count].iov_base = rets;
+		in[count++].iov_len = req->count*sizeof(int16_t);
+		*len += req->count*sizeof(int16_t);
+	}
+
+	// The blocks of each operation, in order
+	for (i = 0; i < ops; i++){
+		if (req->count > 0){
+			blk = Payload(req->ops[i], 1);
+			to = (req->blocks != NULL) ? req->blocks[i] : NULL;
+		}
+		else{
+			blk = Payload(req->op, 1);
+			to = req->block;
+		}
+		*len += blk;
+		if (blk > 0 && to != NULL){
+			in[count].iov_base = to;
+			in[count++].iov_len = blk;
+			continue;
+		}
+		for (; blk > 0; blk -= SMSA_BLOCK_SIZE){
+			in[count].iov_base = Drop;
+			in[count++].iov_len = SMSA_BLOCK_SIZE;
+		}
+	}
+	return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Payload
+// Description  : Number of bytes that follow the header of a request or
+//                of its reply
+//
+// Inputs       : op - the operation code for the command
+//                reply - 1 for the reply, 0 for the request
+// Outputs      : the number of bytes
+
+int Payload (uint32_t op, int reply){
+
+	switch (op>>26){
+	case SMSA_DISK_WRITE:
+	case SMSA_DISK_WRITE_AT:
+		return (reply ? 0 : SMSA_BLOCK_SIZE);
+	case SMSA_DISK_READ:
+	case SMSA_DISK_READ_AT:
+	case SMSA_GET_STATE:
+		return (reply ? SMSA_BLOCK_SIZE : 0);
+	case SMSA_DISK_WRITE_EXTENT:
+		return (reply ? 0 : SMSA_EXTENTLEN(op)*SMSA_BLOCK_SIZE);
+	case SMSA_DISK_READ_EXTENT:
+		return (reply ? SMSA_EXTENTLEN(op)*SMSA_BLOCK_SIZE : 0);
+	case SMSA_DISK_WRITE_PART:
+		return (reply ? 0 : SMSA_EXTENTLEN(op));
+	}
+	return (0);
+}
 
-	// if this lenght is greater than header size 
-	// that means buf is returned.
-	*len = length;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : Transfer
+// Description  : Send or read exactly len bytes on the socket
+//
+// Inputs       : data - the bytes to send or the place to read into
+//                len - the number of bytes
+//                sending - 1 to send, 0 to read
+// Outputs      : 0 for success -1 for failure
+
+int Transfer (unsigned char *data, int len, int sending){
+
+	// Local variables
+	struct iovec iov;
+
+	iov.iov_base = data;
+	iov.iov_len = len;
+	return (TransferV(&iov, 1, sending));
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : TransferV
+// Description  : Send or read exactly the bytes of all the pieces, with as
+//                few system calls as the socket allows.  The pieces are
+//                used up on the way.
+//
+// Inputs       : iov - the pieces, in order
+//                count - the number of them
+//                sending - 1 to send, 0 to read
+// Outputs      : 0 for success -1 for failure
+
+int TransferV (struct iovec *iov, int count, int sending){
+
+	// Local variables
+	ssize_t rb;
+	int i;
+
+	if (Shm != NULL){
+		for (i = 0; i < count; i++){
+			if (ShmTransfer(iov[i].iov_base, iov[i].iov_len, sending) == -1)
+				return(-1);
+		}
+		return(0);
+	}
+
+	while (count > 0){
+		if (sending)
+			rb = writev(Socket, iov, count);
+		else
+			rb = readv(Socket, iov, count);
+		if (rb < 0 && errno == EINTR)
+			continue;
+		if (rb <= 0)
+			return(-1);
+
+		// Step past the pieces that are done, into the one cut short
+		for (; count > 0 && (size_t)rb >= iov->iov_len; iov++, count--)
+			rb -= iov->iov_len;
+		if (count > 0){
+			iov->iov_base = (unsigned char *)iov->iov_base + rb;
+			iov->iov_len -= rb;
+		}
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ShmTransfer
+// Description  : Put or get exactly len bytes on the shared memory rings.
+//                The server is woken with a doorbell byte on the socket if
+//                it went to sleep; this side sleeps on the ring's futex,
+//                or spins in the polling transport.
+//
+// Inputs       : data - the bytes to send or the place to read into
+//                len - the number of bytes
+//                sending - 1 to send, 0 to read
+// Outputs      : 0 for success -1 for failure
+
+int ShmTransfer (unsigned char *data, int len, int sending){
+
+	// Local variables
+	SMSA_SHM_RING *ring = (sending) ? &Shm->req : &Shm->rep;
+	uint32_t *word = (sending) ? &ring->head : &ring->tail;
+	uint32_t seen;
+	int done = 0, n, spins = 0;
+
+	while (done < len){
+		if (sending)
+			n = smsa_shm_put(ring, &data[done], len-done);
+		else
+			n = smsa_shm_get(ring, &data[done], len-done);
+
+		// Ring the doorbell if the server sleeps until this moves
+		if (n > 0){
+			done += n;
+			spins = 0;
+			if (smsa_shm_notify(ring, sending) && write(Socket, "", 1) != 1){
+				return(-1);
+			}
+			continue;
+		}
+
+		// Nothing moved, wait for the server
+		if (Transport == SMSA_NET_SHM_POLL){
+			if (++spins % SMSA_CLIENT_SHM_SPINS == 0 && !Client_Alive()){
+				return(-1);
+			}
+			sched_yield();
+			continue;
+		}
+		seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+		if (smsa_shm_idle(ring, sending) && smsa_shm_wait(word, seen, SMSA_CLIENT_SHM_WAIT) == -1 &&
+				!Client_Alive()){
+			return(-1);
+		}
+		__atomic_store_n((sending) ? &ring->producer_waiting : &ring->consumer_waiting, 0, __ATOMIC_RELAXED);
+	}
 	return(0);
 }
@@ -10,10 +10,13 @@
 // Include Files
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 // Project Include Files
 #include <smsa_driver.h>
 #include <cmpsc311_log.h>
 #include <smsa_cache.h>
+#include <smsa_readahead.h>
 #include <smsa_network.h>
 
 // Notes:
@@ -24,6 +27,7 @@
 // use malloc to instead of temp array. 
 
 // Defines
+#define PART_RUN_SIZE (16*SMSA_BLOCK_SIZE) // Bytes of partial writes kept until sent
 
 // Functional Prototypes
 uint32_t op_generator (SMSA_DISK_COMMAND op_code, SMSA_DRUM_ID Drum_id, SMSA_BLOCK_ID Block_id);
@@ -31,10 +35,68 @@ uint32_t op_generator (SMSA_DISK_COMMAND op_code, SMSA_DRUM_ID Drum_id, SMSA_BLO
 int extract (SMSA_VIRTUAL_ADDRESS addr,SMSA_DRUM_ID *drum,SMSA_BLOCK_ID *block,uint32_t *offset);
 
 int seek (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk);
+
+int read_block (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block);
+
+int write_block (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block);
+
+int write_back (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block);
+
+int read_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block);
+
+int read_ahead (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block, uint32_t *id);
+
+int write_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block);
+
+int fill_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char ch);
+
+int write_part (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t off, uint32_t cnt, unsigned char *bytes);
+
+int copy_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, SMSA_DRUM_ID to_drm, SMSA_BLOCK_ID to_blk);
+
+void copy_cache (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, SMSA_DRUM_ID to_drm, SMSA_BLOCK_ID to_blk);
+
+int uniform_block (unsigned char *block, unsigned char *ch);
+
+int queue_write (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block);
+
+int flush_writes (void);
+
+void check_stats (void);
+
+int get_state (uint64_t *state);
 //
 // Global data
 SMSA_DRUM_ID Cdrm;
 SMSA_BLOCK_ID Cblk;
+int WriteBack = 0; // 1 if writes stay dirty in the cache until flushed
+uint32_t Readahead = 0; // Largest readahead window in blocks, 0 if off
+volatile sig_atomic_t DumpStats = 0; // Set by SIGUSR1, stats logged on the next call
+const char *CacheFile = NULL; // Cache snapshot kept across mounts, NULL if none
+
+// Runs of blocks moved in one extent.  A vread reads the uncached blocks
+// it needs in a row into ReadRun, a write-through vwrite collects the
+// blocks it writes in a row in WriteRun and sends them when the run ends
+// (blocks of one byte value as fills, which carry no data).
+// The client sends blocks from where they are when it flushes, so a sent
+// run has to be flushed before WriteRun is filled again.
+unsigned char ReadRun[SMSA_MAX_EXTENT*SMSA_BLOCK_SIZE];
+unsigned char WriteRun[SMSA_MAX_EXTENT*SMSA_BLOCK_SIZE];
+uint32_t Pending = 0; // Blocks in WriteRun not yet sent
+SMSA_DRUM_ID PendDrm; // Where the blocks in WriteRun start
+SMSA_BLOCK_ID PendBlk;
+
+// The bytes of partial writes, kept here rather than in the caller's
+// buffer until the client has sent them
+unsigned char PartRun[PART_RUN_SIZE];
+uint32_t PartUsed = 0;
+
+// The bytes a vcopy cannot copy on the array (the ends of a copy that
+// only cover part of a block, or all of one between addresses that are
+// not the same distance into their blocks) go through here
+unsigned char CopyRun[SMSA_MAX_EXTENT*SMSA_BLOCK_SIZE];
+
+void stats_signal_handler (int no);
 // Interfaces
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -46,12 +108,29 @@ SMSA_BLOCK_ID Cblk;
 // Outputs      : -1 if failure or 0 if successful
 
 int smsa_vmount( int lines ) {
+
+	struct sigaction new_action;
+	uint64_t state[SMSA_DISK_ARRAY_SIZE];
 		
 	// call intia cache and pass the # of line.
 	if (smsa_init_cache (lines) == -1){
 		logMessage(LOG_INFO_LEVEL, "Error in intializing cache.\n");
 		return(-1);
 	}
+
+	// Dirty lines are written out through write_back when evicted, and
+	// there is nowhere to keep them without any lines.
+	smsa_set_cache_writeback (write_back);
+	if (WriteBack == 1 && lines <= 0){
+		logMessage(LOG_INFO_LEVEL, "No cache lines, using write-through.\n");
+		WriteBack = 0;
+	}
+
+	// Prefetched blocks live in the cache too, so no lines means no readahead
+	if (smsa_init_readahead ((lines > 0) ? Readahead : 0, read_ahead, smsa_client_wait) == -1){
+		logMessage(LOG_INFO_LEVEL, "Error in intializing readahead.\n");
+		return(-1);
+	}
 	
 	//Calling smsa_operation and passing the op_code as argument 
 	if (smsa_client_operation(op_generator(SMSA_MOUNT,0,0),NULL) == -1){
@@ -62,6 +141,20 @@ int smsa_vmount( int lines ) {
 	// Setting the current drum and block to zero
 	Cdrm = 0;
 	Cblk = 0;
+
+	// Warm the cache from the last unmount's snapshot.  Only drums whose
+	// contents hash the same as they did then are trusted, and a snapshot
+	// that cannot be used just leaves the cache cold.
+	if (CacheFile != NULL && lines > 0 && get_state (state) == 0){
+		smsa_load_cache (CacheFile, state);
+	}
+
+	// SIGUSR1 asks for the cache counters.  The handler only sets a flag,
+	// they are logged from the next driver call.
+	new_action.sa_handler = stats_signal_handler;
+	sigemptyset( &new_action.sa_mask );
+	new_action.sa_flags = SA_RESTART;
+	sigaction( SIGUSR1, &new_action, NULL );
 	
 	return(0);// Returning the value that is stored in the 
 	// variable; -1 means error and 0 means success. 	
@@ -76,6 +169,9 @@ int smsa_vmount( int lines ) {
 // Outputs      : -1 if failure or 0 if successful
 
 int smsa_vunmount( void )  {
+
+	uint64_t state[SMSA_DISK_ARRAY_SIZE];
+	int failed = 0; // 1 if a write sent earlier failed
 	
 	// Call close cache to turn it off. 
 	/*if (smsa_close_cache() == -1){
@@ -83,13 +179,107 @@ int smsa_vunmount( void )  {
 		return(-1);
 	}*/
 
+	// Anything still dirty in the cache has to reach the array first.  A
+	// write that failed is reported here, the array is still unmounted.
+	if (smsa_vsync() == -1){
+		logMessage(LOG_INFO_LEVEL,"Error flushing the cache.\n");
+		failed = 1;
+	}
+
+	// Log how the cache did over the mount (not as output, which has to
+	// match the master file)
+	smsa_log_cache_stats(LOG_INFO_LEVEL);
+	smsa_log_readahead_stats();
+	DumpStats = 0;
+
+	// Keep the cache for the next mount, tagged with what the array holds
+	// now so the next mount can tell whether it is still good.  After a
+	// failed write the cache may hold what the array does not.
+	if (CacheFile != NULL && !failed && get_state (state) == 0){
+		smsa_save_cache (CacheFile, state);
+	}
+
 	// Calling Smsa operation to unmount the disk.
 	if (smsa_client_operation(op_generator(SMSA_UNMOUNT,0,0),NULL) == -1){
 		logMessage(LOG_INFO_LEVEL,"Error mounting disk:");
 		return(-1);
 	}
 
-	return(0);// Returning the value that is stored in return_value. 
+	return(failed ? -1 : 0);// Returning the value that is stored in return_value. 
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vsync
+// Description  : Write every dirty cache line back to the disk array and
+//                wait for the array to have taken every write.  Writes are
+//                sent without waiting, this is where one that failed since
+//                the last sync is reported.
+//
+// Inputs       : none
+// Outputs      : -1 if failure (of any write since the last sync) or 0 if successful
+
+int smsa_vsync( void ) {
+
+	int failed;
+
+	check_stats();
+
+	// Prefetches still out land first, one that failed is reported here
+	failed = (smsa_land_readahead() == -1);
+
+	// Nothing is ever dirty in write-through mode
+	if (WriteBack == 1 && smsa_flush_cache() == -1){
+		return(-1);
+	}
+	if (smsa_client_wait(0) == -1 || failed){
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vset_write_back
+// Description  : Choose write-back (1) or write-through (0) caching for
+//                the next mount
+//
+// Inputs       : enable - 1 for write-back, 0 for write-through
+// Outputs      : none
+
+void smsa_vset_write_back( int enable ) {
+
+	WriteBack = (enable != 0);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vset_readahead
+// Description  : Set the largest readahead window for the next mount
+//
+// Inputs       : window - the most blocks to prefetch ahead, 0 for none
+// Outputs      : none
+
+void smsa_vset_readahead( uint32_t window ) {
+
+	Readahead = window;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vset_cache_file
+// Description  : Snapshot the cache to path at unmount and warm it from
+//                there at the next mount
+//
+// Inputs       : path - the snapshot file, NULL for none
+// Outputs      : none
+
+void smsa_vset_cache_file( const char *path ) {
+
+	CacheFile = path;
+	return;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -104,23 +294,25 @@ int smsa_vunmount( void )  {
 
 int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 		
-	int rb = 0, i; // rb and i loop contollers.. 
+	int rb = 0, i, n; // rb and i loop contollers, n bytes wanted from the block
+	int hit;
 	// Flag for setting i
 	int Flag = 0;	
-	//unsigned char Temp[SMSA_BLOCK_SIZE];// Decalring a tempory char array 
 	unsigned char *Temp=NULL;
-	unsigned char *cache_ptr=NULL;
 	
 	// decalring variables that will hold drum,block and offset 
-	SMSA_DRUM_ID drum_id;
-	SMSA_BLOCK_ID block_id;
-	uint32_t offset;
+	SMSA_DRUM_ID drum_id, d;
+	SMSA_BLOCK_ID block_id, b;
+	uint32_t offset, run, need, k;
+	int first = -1, count = 0; // Blocks in ReadRun, keyed drum*SMSA_MAX_BLOCK_ID+block
+	int key;
 
 	// Calling a function that will extract the drum, block and offset from addr
 	if (extract(addr,&drum_id,&block_id,&offset) == -1)
 	{
 		return(-1);// Error the addr is not in range.
 	}
+	check_stats();
 	
 	// Using the log message to check if the len is within the range.	
 	if ((((addr+len)>>16) >16 || (addr+len)>>16)<0){
@@ -128,11 +320,6 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 		return (-1);
 	}
 	
-	// Seeking drum and block for first time.
-	 if (seek(drum_id, block_id) == -1){
-	 	logMessage (LOG_INFO_LEVEL,"Error Seeking.\n");
-		return(-1);
-	 }	 
 	//Creating a loop that will read through the virtual disk array
 	do{
 
@@ -148,62 +335,84 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 
 		drum_id = drum_id + 1;// Incrementing drum_id if block_id>255.
 		block_id = 0;// Entering new drum
-		Cblk = 0;
-		seek(drum_id,block_id);
 	}	
 	
-	// Call get cache line to see if its in cache memory.
-	cache_ptr = smsa_get_cache_line (drum_id, block_id);
+	// If the block is cached the cache copies the bytes out directly, no
+	// need to touch the array (the head is moved lazily by the next miss).
+	// A block on its way from a prefetch lands in the cache first.  One
+	// that came in with the blocks before it is taken from ReadRun.
+	n = SMSA_BLOCK_SIZE - i;
+	if (n > len - rb)
+		n = len - rb;
+	key = drum_id*SMSA_MAX_BLOCK_ID+block_id;
+	hit = 0;
+	if (first < 0 || key - first >= count){
+		if (smsa_readahead_flying (drum_id, block_id) && smsa_land_readahead() == -1){
+			return(-1);
+		}
+		hit = (smsa_read_cache_line (drum_id, block_id, i, n, &buf[rb]) == 0);
+	}
+	if (hit){
+		rb += n;
+	}
+
+	// Otherwise read new data.
+	else{
 
-	// If funciton returns Null than read new data.
-	if (cache_ptr == NULL){
+	// Read the block and the blocks after it the read still needs, up to
+	// the first one that is cached, in one extent.  The prefetches out
+	// are answered before it anyway, so they land first and none of the
+	// run is read twice.
+	if (first < 0 || key - first >= count){
+		if (smsa_land_readahead() == -1){
+			return(-1);
+		}
+		need = (i + len - rb + SMSA_BLOCK_SIZE - 1) / SMSA_BLOCK_SIZE;
+		d = drum_id;
+		b = block_id;
+		for (run = 1; run < need && run < SMSA_MAX_EXTENT; run++){
+			if (++b > SMSA_MAX_BLOCK_ID-1){
+				d++;
+				b = 0;
+			}
+			if (smsa_probe_cache_line (d, b))
+				break;
+		}
 
-	// Use malloc to get memory from os and pass that to read.
-	Temp = (unsigned char *)malloc(SMSA_BLOCK_SIZE);
-		
-	// Calling smsa operation to read the virtual disk array
-	if(smsa_client_operation (op_generator (SMSA_DISK_READ, drum_id,block_id) , Temp) == -1){
-		logMessage(LOG_INFO_LEVEL,"There was a error in reading[%d]",-1);
-		return (-1);
+		// Calling smsa operation to read the virtual disk array
+		if(read_extent (drum_id, block_id, run, ReadRun) == -1){
+			logMessage(LOG_INFO_LEVEL,"There was a error in reading[%d]",-1);
+			return (-1);
+		}
+		first = key;
+		count = run;
+
+		// The whole run goes in the cache (each block into its own slab)
+		// before the readahead sees any of it, so it never fetches a
+		// block this read already has
+		for (k = 0; k < run; k++){
+			if (smsa_put_cache_line ((first+k) / SMSA_MAX_BLOCK_ID, (first+k) % SMSA_MAX_BLOCK_ID,
+					&ReadRun[k*SMSA_BLOCK_SIZE]) == -1){
+				logMessage (LOG_INFO_LEVEL, "Error while putting in cache.\n");
+				return(-1);
+			}
+		}
 	}
+	Temp = &ReadRun[(key - first) * SMSA_BLOCK_SIZE];
 
 	do{
 		buf[rb]=Temp[i]; // Storing data in Temp array from buf.
 		rb++; // Incremeanting rb
 		i++;  // Incremeanting i 
 	}while(i<SMSA_MAX_BLOCK_ID && rb<len);
-
-	// Call smsa_put_cache to update the cache memory.
-	if (smsa_put_cache_line (drum_id, block_id, Temp) == -1){
-		
-		logMessage (LOG_INFO_LEVEL, "Error while putting in cache.\n");
-		return(-1);
-	}
-	block_id++;
-	Cblk++;
 	
 	}
-	// else the pointer points to the line in cache.
-	else{
-		logMessage (LOG_INFO_LEVEL, "Get pointer not null.\n");
-		Temp = cache_ptr;
-		
-		do{
-		buf[rb]=Temp[i]; // Storing data in Temp array from buf.
-		rb++; // Incremeanting rb
-		i++;  // Incremeanting i 
-		}while(i<SMSA_MAX_BLOCK_ID && rb<len);
 
-		// seek next block 
-		block_id++;
-		Cblk++;
-		smsa_client_operation(op_generator(SMSA_SEEK_BLOCK,0,block_id),NULL);
-			
-	}
-
-		if (Temp != NULL){
-		Temp = NULL;
+	// Let the readahead see the read, it may prefetch what comes next
+	if (smsa_readahead (drum_id, block_id, hit, rb >= len) == -1){
+		return(-1);
 	}
+	block_id++;
 	
 	}while (rb<len);
 	
@@ -224,10 +433,14 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 
 	
 	int rb = 0, i; // rb and i are loop controllers 
+	int n; // bytes written to the block
+	int partial; // 1 if the write covers only part of the block
 
-	// variables for dynamic memory allocation	
+	// block being patched
+	unsigned char Block[SMSA_BLOCK_SIZE];
 	unsigned char *Temp=NULL;
-	unsigned char *cache_ptr = NULL;
+	int hit; // 1 if the cache had the block
+	int cached; // 1 if the written block goes in the cache
 	
 	// flag for first block 
 	int Flag_b =0;
@@ -241,6 +454,7 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 	if(extract(addr,&drum_id,&block_id,&offset) == -1){
 		return(-1);
 	}
+	check_stats();
 
 	// Using log message to check if len is within the range. 
 	if (((addr+len)>>16) >16 || ((addr+len)>>16)<0){
@@ -248,11 +462,6 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 		return (-1);
 	}
 	
-	if (seek (drum_id,block_id) == -1){
-		logMessage (LOG_INFO_LEVEL,"Error in seeking.\n");
-		return(-1);
-	}
-
 	do{
 		// Setting the map index for Temp	
 		if (Flag_b == 0){
@@ -265,70 +474,190 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 		if (block_id > SMSA_MAX_BLOCK_ID -1){// implies new drum
 	   		drum_id++;
 	 		block_id = 0; // entering new drum
-			Cblk = 0;
-			seek (drum_id, block_id);
 	  	 }
 
-		// Calling function smsa-get cache to see if data already in cache memory.
-		cache_ptr = smsa_get_cache_line (drum_id, block_id);
-			
-		if (cache_ptr == NULL ){	
-		// if null do normal write function
-			
-		// malloc memory to allocate memory dynamically
-		Temp = (unsigned char *)malloc(SMSA_BLOCK_SIZE);
-			
-		// Calling smsa operation to read 
-		if(smsa_client_operation (op_generator (SMSA_DISK_READ,drum_id,block_id),Temp) == -1){
-			logMessage(LOG_INFO_LEVEL,"Error in seeking block.");
+		// A prefetch sent before this write must not land over it later
+		if (smsa_land_readahead() == -1){
 			return(-1);
 		}
-			
-		block_id++;// Increment block and Cblk.
-		Cblk++;
-	
+
+		partial = (i != 0 || len-rb < SMSA_BLOCK_SIZE);
+		n = SMSA_BLOCK_SIZE - i;
+		if (n > len - rb)
+			n = len - rb;
+
+		// The block is patched in the stack copy and put back whole, the
+		// cache line itself is never written in place.
+		Temp = Block;
+
+		// Only a block the write covers partly needs its old contents, a
+		// fully covered one is overwritten whole.  If the cache has them
+		// the block is patched there.  Otherwise in write-back mode it is
+		// read, so the writes to it after this one are merged in the
+		// dirty line; writing through it is not read at all, the array
+		// patches it from just the bytes written and it stays out of the
+		// cache.
+		// A fully covered block is only probed, it is not a use of the
+		// old contents.
+		if (partial)
+			hit = (smsa_read_cache_line (drum_id, block_id, 0, SMSA_BLOCK_SIZE, Temp) == 0);
+		else
+			hit = smsa_probe_cache_line (drum_id, block_id);
+
+		if (partial && !hit && WriteBack == 1){
+			if (read_block (drum_id, block_id, Temp) == -1){
+				logMessage(LOG_INFO_LEVEL,"Error in seeking block.");
+				return(-1);
+			}
+		}
+		else if (partial && !hit){
+			if (write_part (drum_id, block_id, i, n, &buf[rb]) == -1){
+	  			logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+				return(-1);
+			}
+		}
+		cached = (hit || !partial || WriteBack == 1);
+
 		do{
 		    Temp[i] = buf[rb];
 		    rb++; i++;
 		}while (rb<len && i<SMSA_BLOCK_SIZE);
 		
+		// In write-back mode the cache keeps the block dirty until it is
+		// evicted or synced, otherwise write it through, in one extent
+		// with the blocks next to it.
+		if (WriteBack == 0 && cached){
+			if (queue_write (drum_id, block_id, Temp) == -1){
+	  			logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+				return(-1);
+			}
 		}
-	
-		else // if get cache returns pointer in the cache memory
-		{
-			Temp = cache_ptr;
-			do{
-			    Temp[i] = buf[rb];
-			    rb++; i++;
-			}while (rb<len && i<SMSA_BLOCK_SIZE);
-			
-			   block_id++;
-			   Cblk++;
-		}	
 		
-		// Calling smsa operation to seek block for write
-		if(smsa_client_operation (op_generator (SMSA_SEEK_BLOCK, drum_id, block_id-1), NULL) == -1){
-			logMessage(LOG_INFO_LEVEL,"Error in seeking block.");
+		// Calling smsa put cache to update cache memory
+		if (cached && smsa_put_cache_line (drum_id, block_id, Temp) == -1){
+			logMessage (LOG_INFO_LEVEL, "Error while putting in cache.\n");
 			return(-1);
 		}
-		
-		// Calling smsa operation to write
-	   	if(smsa_client_operation (op_generator (SMSA_DISK_WRITE, drum_id, block_id),Temp) == -1){
-	  		logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+		if (WriteBack == 1 && smsa_dirty_cache_line (drum_id, block_id) == -1){
+			logMessage (LOG_INFO_LEVEL, "Error marking cache line dirty.\n");
 			return(-1);
 		}
-		
-		// Calling smsa put cache to update cache memory
-		if (smsa_put_cache_line (drum_id, block_id-1, Temp) == -1){
-			logMessage (LOG_INFO_LEVEL, "Error while putting in cache.\n");
+
+		// Writes move along the same streams as reads.  Only a partly
+		// covered block needed its old contents, prefetching a block
+		// that is then overwritten whole saved nothing.
+		if (smsa_readahead (drum_id, block_id, hit && partial, rb >= len) == -1){
 			return(-1);
 		}
 
-		if (Temp != NULL ){
-			Temp = NULL;
+		block_id++;// Increment block
+	}while (rb<len );	
+
+	// Send the last run of writes
+	return(flush_writes());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vcopy
+// Description  : Copy within the SMSA virtual address space.  Whole blocks
+//                are copied by the array, without being sent either way;
+//                the rest is read and written back through CopyRun.  The
+//                ranges may overlap, the copy then goes from the end.
+//
+// Inputs       : src - the address to copy from
+//                dst - the address to copy to
+//                len - the number of bytes to copy
+// Outputs      : -1 if failure or 0 if successful
+
+int smsa_vcopy( SMSA_VIRTUAL_ADDRESS src, SMSA_VIRTUAL_ADDRESS dst, uint32_t len ) {
+
+	uint32_t done, at, n, r, cnt, k, j, off;
+	int back; // 1 if the copy goes from the end
+	int same; // 1 if src and dst are the same distance into their blocks
+	SMSA_DRUM_ID drum_id, to_drum;
+	SMSA_BLOCK_ID block_id, to_block;
+
+	// Both ranges have to be inside the array
+	if ((uint64_t)src+len > SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID*SMSA_BLOCK_SIZE ||
+			(uint64_t)dst+len > SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID*SMSA_BLOCK_SIZE){
+		logMessage (LOG_INFO_LEVEL,"The copy is out of range [%u->%u for %u]",src,dst,len);
+		return (-1);
+	}
+	check_stats();
+	if (len == 0 || src == dst){
+		return (0);
+	}
+
+	// Prefetches land before the blocks they read are copied over
+	if (smsa_land_readahead() == -1){
+		return (-1);
+	}
+
+	// Copying up over itself has to move the end first, like memmove
+	back = (dst > src && dst < src+len);
+	same = (src%SMSA_BLOCK_SIZE == dst%SMSA_BLOCK_SIZE);
+
+	for (done = 0; done < len; done += n){
+
+		// Pick the next piece, [at, at+n) of the copy: a run of whole
+		// blocks, the part of a block at either end, or a CopyRun full
+		if (back){
+			r = (src + len - done) % SMSA_BLOCK_SIZE;
+			if (same && r == 0 && len-done >= SMSA_BLOCK_SIZE)
+				n = SMSA_BLOCK_SIZE * ((len-done)/SMSA_BLOCK_SIZE < SMSA_MAX_EXTENT ?
+						(len-done)/SMSA_BLOCK_SIZE : SMSA_MAX_EXTENT);
+			else if (same && r != 0 && r < len-done)
+				n = r;
+			else
+				n = (len-done < sizeof(CopyRun)) ? len-done : sizeof(CopyRun);
+			at = len - done - n;
+		} else {
+			at = done;
+			r = (src + at) % SMSA_BLOCK_SIZE;
+			if (same && r == 0 && len-at >= SMSA_BLOCK_SIZE)
+				n = SMSA_BLOCK_SIZE * ((len-at)/SMSA_BLOCK_SIZE < SMSA_MAX_EXTENT ?
+						(len-at)/SMSA_BLOCK_SIZE : SMSA_MAX_EXTENT);
+			else if (same && SMSA_BLOCK_SIZE-r < len-at)
+				n = SMSA_BLOCK_SIZE - r;
+			else
+				n = (len-at < sizeof(CopyRun)) ? len-at : sizeof(CopyRun);
 		}
 
-	}while (rb<len );	
+		// Anything but whole blocks is read and written, a piece is read
+		// all before any of it is written so it may overlap itself
+		if (!same || (src+at) % SMSA_BLOCK_SIZE != 0 || n % SMSA_BLOCK_SIZE != 0){
+			if (smsa_vread (src+at, n, CopyRun) == -1 || smsa_vwrite (dst+at, n, CopyRun) == -1){
+				return(-1);
+			}
+			continue;
+		}
+
+		// The array copies what it holds, so dirty cached source blocks
+		// have to reach it first
+		extract (src+at, &drum_id, &block_id, &off);
+		extract (dst+at, &to_drum, &to_block, &off);
+		cnt = n / SMSA_BLOCK_SIZE;
+		if (WriteBack){
+			for (k = 0; k < cnt; k++){
+				j = block_id + k;
+				if (smsa_clean_cache_line (drum_id + j/SMSA_MAX_BLOCK_ID, j%SMSA_MAX_BLOCK_ID) == -1){
+					return(-1);
+				}
+			}
+		}
+		if (copy_extent (drum_id, block_id, cnt, to_drum, to_block) == -1){
+			return(-1);
+		}
+
+		// Then the cached copies of the blocks copied over follow, in
+		// the copy's order so no source line is changed before it is used
+		for (k = 0; k < cnt; k++){
+			j = back ? cnt-1-k : k;
+			copy_cache (drum_id + (block_id+j)/SMSA_MAX_BLOCK_ID, (block_id+j)%SMSA_MAX_BLOCK_ID,
+					to_drum + (to_block+j)/SMSA_MAX_BLOCK_ID, (to_block+j)%SMSA_MAX_BLOCK_ID);
+		}
+	}
 	return(0);
 }
 
@@ -393,7 +722,9 @@ int extract (SMSA_VIRTUAL_ADDRESS addr,SMSA_DRUM_ID *drum,SMSA_BLOCK_ID *block,u
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : seek
-// Description  : seeks drum and block when needed. 
+// Description  : seeks drum and block when needed.  The seeks are not
+//                waited for, the read or write after them is what needs
+//                the head there and the server runs them in order.
 //
 // Inputs       : drum and block
 // 		
@@ -404,7 +735,7 @@ int seek (SMSA_DRUM_ID drm , SMSA_BLOCK_ID blk){
 	if (drm != Cdrm){
 			
 		// Calling smsa operation to seek drum.
-		if(smsa_client_operation (op_generator (SMSA_SEEK_DRUM, drm, blk) , NULL) == -1){
+		if(smsa_client_send (op_generator (SMSA_SEEK_DRUM, drm, blk) , NULL, NULL) == -1){
 		logMessage(LOG_INFO_LEVEL,"Error in seeking drum.");
 		return(-1);
 		}
@@ -415,7 +746,7 @@ int seek (SMSA_DRUM_ID drm , SMSA_BLOCK_ID blk){
 				
 	
 	if (blk != Cblk){
-		if(smsa_client_operation (op_generator (SMSA_SEEK_BLOCK, drm, blk), NULL) == -1){
+		if(smsa_client_send (op_generator (SMSA_SEEK_BLOCK, drm, blk), NULL, NULL) == -1){
 			logMessage(LOG_INFO_LEVEL,"Error in seeking block.");
 			return(-1);
 		}
@@ -424,3 +755,484 @@ int seek (SMSA_DRUM_ID drm , SMSA_BLOCK_ID blk){
 	
 	return(0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_block
+// Description  : reads one block from the array.  The read carries the
+//                block's address, the array seeks to it first if the
+//                head is somewhere else.
+//
+// Inputs       : drm, blk - the block to read
+//                block - where to put the data
+// Outputs      : Returns 0 if success or -1 for failure
+
+int read_block (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block){
+
+	// Writes still being collected go first
+	if (flush_writes() == -1){
+		return(-1);
+	}
+
+	if (smsa_client_operation(op_generator(SMSA_DISK_READ_AT, drm, blk), block) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error reading block.");
+		return(-1);
+	}
+
+	// The read leaves the head on the next block
+	Cdrm = drm;
+	Cblk = blk + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_block
+// Description  : writes one block to the array, at the address the write
+//                carries like read_block.  Also used by the cache to
+//                write back dirty lines.  The write is sent but not waited
+//                for, a failure shows up at the next read or sync.  The
+//                block has to stay put until the client flushes.
+//
+// Inputs       : drm, blk - the block to write
+//                block - the data to write
+// Outputs      : Returns 0 if success or -1 for failure
+
+int write_block (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block){
+
+	// Writes still being collected go first
+	if (flush_writes() == -1){
+		return(-1);
+	}
+
+	if (smsa_client_send(op_generator(SMSA_DISK_WRITE_AT, drm, blk), block, NULL) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+		return(-1);
+	}
+
+	// The write leaves the head on the next block
+	Cdrm = drm;
+	Cblk = blk + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_back
+// Description  : writes a dirty cache line back to the array.  The cache
+//                may reuse or change the line as soon as this returns, so
+//                the write goes out now rather than with the next request.
+//
+// Inputs       : drm, blk - the block to write
+//                block - the cache line
+// Outputs      : Returns 0 if success or -1 for failure
+
+int write_back (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block){
+
+	unsigned char ch;
+
+	// A line of one byte value goes as a fill, nothing is kept from it
+	if (uniform_block (block, &ch)){
+		return (fill_extent (drm, blk, 1, ch));
+	}
+	if (write_block (drm, blk, block) == -1 || smsa_client_flush() == -1){
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_extent
+// Description  : reads a run of blocks from the array in one request,
+//                going on to the next drum at the end of one.  A run of
+//                one block is just a read.
+//
+// Inputs       : drm, blk - the first block to read
+//                cnt - the number of blocks (up to SMSA_MAX_EXTENT)
+//                block - where to put the data
+// Outputs      : Returns 0 if success or -1 for failure
+
+int read_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block){
+
+	uint32_t last = blk + cnt - 1;
+
+	if (cnt == 1){
+		return (read_block (drm, blk, block));
+	}
+
+	if (flush_writes() == -1 || seek(drm, blk) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to read.");
+		return(-1);
+	}
+
+	if (smsa_client_operation(op_generator(SMSA_DISK_READ_EXTENT, drm, blk) | (cnt<<8), block) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error reading blocks.");
+		return(-1);
+	}
+
+	// The reads leave the head after the last block, on its drum
+	Cdrm = drm + last/SMSA_MAX_BLOCK_ID;
+	Cblk = last%SMSA_MAX_BLOCK_ID + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_ahead
+// Description  : sends the read of a run of blocks for the readahead
+//                without waiting for it.  The blocks come into block with
+//                the reply, which the readahead waits for by its id.
+//
+// Inputs       : drm, blk - the first block to read
+//                cnt - the number of blocks (up to SMSA_MAX_EXTENT)
+//                block - where the data goes
+//                id - where to put the request id
+// Outputs      : Returns 0 if success or -1 for failure
+
+int read_ahead (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block, uint32_t *id){
+
+	uint32_t last = blk + cnt - 1;
+	uint32_t op = op_generator(SMSA_DISK_READ_AT, drm, blk);
+
+	// Writes still being collected go first, a run needs the head there
+	if (flush_writes() == -1 || (cnt > 1 && seek(drm, blk) == -1)){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to read.");
+		return(-1);
+	}
+	if (cnt > 1){
+		op = op_generator(SMSA_DISK_READ_EXTENT, drm, blk) | (cnt<<8);
+	}
+
+	if (smsa_client_send(op, block, id) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error reading blocks.");
+		return(-1);
+	}
+
+	// The reads leave the head after the last block, on its drum
+	Cdrm = drm + last/SMSA_MAX_BLOCK_ID;
+	Cblk = last%SMSA_MAX_BLOCK_ID + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_extent
+// Description  : writes a run of blocks to the array in one request,
+//                going on to the next drum at the end of one.  Like
+//                write_block the request is not waited for.
+//
+// Inputs       : drm, blk - the first block to write
+//                cnt - the number of blocks (up to SMSA_MAX_EXTENT)
+//                block - the data to write
+// Outputs      : Returns 0 if success or -1 for failure
+
+int write_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *block){
+
+	uint32_t last = blk + cnt - 1;
+
+	if (cnt == 1){
+		return (write_block (drm, blk, block));
+	}
+
+	if (seek(drm, blk) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to write.");
+		return(-1);
+	}
+
+	if (smsa_client_send(op_generator(SMSA_DISK_WRITE_EXTENT, drm, blk) | (cnt<<8), block, NULL) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+		return(-1);
+	}
+
+	// The writes leave the head after the last block, on its drum
+	Cdrm = drm + last/SMSA_MAX_BLOCK_ID;
+	Cblk = last%SMSA_MAX_BLOCK_ID + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill_extent
+// Description  : writes a run of blocks all holding one byte value with a
+//                fill, which only sends the count and the value.  Like
+//                write_extent the request is not waited for.
+//
+// Inputs       : drm, blk - the first block to write
+//                cnt - the number of blocks (up to SMSA_MAX_EXTENT)
+//                ch - the byte value
+// Outputs      : Returns 0 if success or -1 for failure
+
+int fill_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char ch){
+
+	uint32_t last = blk + cnt - 1;
+
+	if (flush_writes() == -1 || seek(drm, blk) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to write.");
+		return(-1);
+	}
+
+	if (smsa_client_send(op_generator(SMSA_DISK_FILL, drm, ch) | (cnt<<8), NULL, NULL) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+		return(-1);
+	}
+
+	// The writes leave the head after the last block, on its drum
+	Cdrm = drm + last/SMSA_MAX_BLOCK_ID;
+	Cblk = last%SMSA_MAX_BLOCK_ID + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_extent
+// Description  : copies a run of blocks to another place on the array with
+//                a copy, which sends no data either way.  The heads start at
+//                the first block copied and end after the last one written.
+//                Like write_extent the request is not waited for.
+//
+// Inputs       : drm, blk - the first block to copy
+//                cnt - the number of blocks (up to SMSA_MAX_EXTENT)
+//                to_drm, to_blk - where the first block goes
+// Outputs      : Returns 0 if success or -1 for failure
+
+int copy_extent (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, SMSA_DRUM_ID to_drm, SMSA_BLOCK_ID to_blk){
+
+	uint32_t last = to_blk + cnt - 1;
+
+	if (flush_writes() == -1 || seek(drm, blk) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to copy.");
+		return(-1);
+	}
+
+	if (smsa_client_send(op_generator(SMSA_DISK_COPY, to_drm, to_blk) | (cnt<<8), NULL, NULL) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error in copying on disk array.");
+		return(-1);
+	}
+
+	// The writes leave the head after the last block, on its drum
+	Cdrm = to_drm + last/SMSA_MAX_BLOCK_ID;
+	Cblk = last%SMSA_MAX_BLOCK_ID + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : copy_cache
+// Description  : brings a cached block the array copied over up to date.
+//                If the block copied is cached too its contents go in the
+//                line, otherwise the line is dropped.  A block that was not
+//                cached is left out.
+//
+// Inputs       : drm, blk - the block copied
+//                to_drm, to_blk - the block copied over
+// Outputs      : none
+
+void copy_cache (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, SMSA_DRUM_ID to_drm, SMSA_BLOCK_ID to_blk){
+
+	unsigned char Block[SMSA_BLOCK_SIZE];
+
+	if (!smsa_probe_cache_line (to_drm, to_blk)){
+		return;
+	}
+
+	// Dropping first also forgets a dirty line, the array has newer
+	// contents now; the copy put back in its place is clean
+	smsa_drop_cache_line (to_drm, to_blk);
+	if (smsa_read_cache_line (drm, blk, 0, SMSA_BLOCK_SIZE, Block) == 0){
+		smsa_put_cache_line (to_drm, to_blk, Block);
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_part
+// Description  : writes some bytes of a block, the array patches the
+//                block with them.  The bytes are kept in PartRun until
+//                sent, so the caller's buffer is free when this returns.
+//                Like write_block the request is not waited for.
+//
+// Inputs       : drm, blk - the block to write
+//                off - where in the block the bytes go
+//                cnt - the number of bytes (less than a block)
+//                bytes - the bytes to write
+// Outputs      : Returns 0 if success or -1 for failure
+
+int write_part (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t off, uint32_t cnt, unsigned char *bytes){
+
+	// The bytes of earlier partial writes have to be sent before PartRun
+	// is filled again
+	if (PartUsed + cnt > PART_RUN_SIZE){
+		if (smsa_client_flush() == -1){
+			return(-1);
+		}
+		PartUsed = 0;
+	}
+
+	if (flush_writes() == -1 || seek(drm, blk) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error seeking to write.");
+		return(-1);
+	}
+
+	memcpy (&PartRun[PartUsed], bytes, cnt);
+	if (smsa_client_send(op_generator(SMSA_DISK_WRITE_PART, drm, off) | (cnt<<8), &PartRun[PartUsed], NULL) == -1){
+		logMessage(LOG_INFO_LEVEL,"Error in writing to disk array.");
+		return(-1);
+	}
+	PartUsed += cnt;
+
+	// The write leaves the head on the next block
+	Cdrm = drm;
+	Cblk = blk + 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uniform_block
+// Description  : checks whether every byte of a block is the same.  Each
+//                byte is compared with the next in one memcmp, which the
+//                C library runs a vector register at a time.
+//
+// Inputs       : block - the block
+//                ch - where to put the byte value
+// Outputs      : Returns 1 if the block is all one value, 0 if not
+
+int uniform_block (unsigned char *block, unsigned char *ch){
+
+	*ch = block[0];
+	return (memcmp (block, &block[1], SMSA_BLOCK_SIZE-1) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queue_write
+// Description  : adds a block to the run of writes being collected,
+//                sending the run first if the block does not follow it
+//                or the run is full
+//
+// Inputs       : drm, blk - the block to write
+//                block - the data to write
+// Outputs      : Returns 0 if success or -1 for failure
+
+int queue_write (SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *block){
+
+	if (Pending > 0 && drm*SMSA_MAX_BLOCK_ID+blk != PendDrm*SMSA_MAX_BLOCK_ID+PendBlk+Pending){
+		if (flush_writes() == -1){
+			return(-1);
+		}
+	}
+	if (Pending == 0){
+		// The last run may still be waiting to go out of WriteRun
+		if (smsa_client_flush() == -1){
+			return(-1);
+		}
+		PendDrm = drm;
+		PendBlk = blk;
+	}
+	memcpy (&WriteRun[Pending*SMSA_BLOCK_SIZE], block, SMSA_BLOCK_SIZE);
+	if (++Pending == SMSA_MAX_EXTENT){
+		return (flush_writes());
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_writes
+// Description  : sends the run of writes being collected, if any.  Blocks
+//                in a row holding the same byte value go as one fill, the
+//                others in extents between them.
+//
+// Inputs       : none
+// Outputs      : Returns 0 if success or -1 for failure
+
+int flush_writes (void){
+
+	uint32_t cnt = Pending, i, j, at;
+	int fill[SMSA_MAX_EXTENT]; // Byte value of each block, -1 if mixed
+	unsigned char ch;
+	int r;
+
+	if (cnt == 0){
+		return(0);
+	}
+	Pending = 0;
+	for (i = 0; i < cnt; i++){
+		fill[i] = uniform_block (&WriteRun[i*SMSA_BLOCK_SIZE], &ch) ? ch : -1;
+	}
+
+	for (i = 0; i < cnt; i = j){
+		for (j = i + 1; j < cnt && (fill[j] == fill[i] || (fill[i] < 0 && fill[j] < 0)); j++);
+		at = PendBlk + i;
+		if (fill[i] >= 0)
+			r = fill_extent (PendDrm + at/SMSA_MAX_BLOCK_ID, at%SMSA_MAX_BLOCK_ID, j-i, fill[i]);
+		else
+			r = write_extent (PendDrm + at/SMSA_MAX_BLOCK_ID, at%SMSA_MAX_BLOCK_ID, j-i,
+					&WriteRun[i*SMSA_BLOCK_SIZE]);
+		if (r == -1){
+			return(-1);
+		}
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stats_signal_handler
+// Description  : SIGUSR1 handler, asks for the cache counters to be logged
+//
+// Inputs       : no - the signal number
+// Outputs      : none
+
+void stats_signal_handler (int no){
+
+	DumpStats = 1;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_stats
+// Description  : logs the cache counters if SIGUSR1 asked for them
+//
+// Inputs       : none
+// Outputs      : none
+
+void check_stats (void){
+
+	if (DumpStats){
+		DumpStats = 0;
+		smsa_log_cache_stats(LOG_OUTPUT_LEVEL);
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_state
+// Description  : Ask the array for the content hash of every drum
+//
+// Inputs       : state - where to put the SMSA_DISK_ARRAY_SIZE hashes
+// Outputs      : -1 if failure or 0 if successful
+
+int get_state (uint64_t *state){
+
+	unsigned char block[SMSA_BLOCK_SIZE];
+	int i, j;
+
+	if (smsa_client_operation (op_generator(SMSA_GET_STATE,0,0), block) == -1){
+		logMessage (LOG_INFO_LEVEL, "Error getting the array state.\n");
+		return(-1);
+	}
+
+	// The hashes come most significant byte first
+	for (i=0; i<SMSA_DISK_ARRAY_SIZE; i++){
+		state[i] = 0;
+		for (j=0; j<SMSA_STATE_HASH_SIZE; j++){
+			state[i] = (state[i] << 8) | block[i*SMSA_STATE_HASH_SIZE+j];
+		}
+	}
+	return(0);
+}
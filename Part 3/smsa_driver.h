@@ -26,12 +26,30 @@ int smsa_vmount( int lines );
 	// Mount the SMSA disk array virtual address space
 
 int smsa_vunmount( void );
-	// Unmount the SMSA disk array virtual address space
+	// Unmount the SMSA disk array virtual address space (-1 if a write failed since the last sync)
 
 int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf );
 	// Read from the SMSA virtual address space
 
 int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf );
-	// Write to the SMSA virtual address space
+	// Write to the SMSA virtual address space.  The writes are not waited for,
+	// one the array rejects fails the next smsa_vsync or smsa_vunmount.
+
+int smsa_vcopy( SMSA_VIRTUAL_ADDRESS src, SMSA_VIRTUAL_ADDRESS dst, uint32_t len );
+	// Copy within the SMSA virtual address space (whole blocks on the array),
+	// failures are reported as for smsa_vwrite
+
+int smsa_vsync( void );
+	// Write any dirty cached blocks back to the disk array, wait for every
+	// write and report any that failed since the last sync
+
+void smsa_vset_write_back( int enable );
+	// Use write-back (1) or write-through (0) caching from the next mount
+
+void smsa_vset_readahead( uint32_t window );
+	// Prefetch up to window blocks ahead of sequential reads (0 is off)
+
+void smsa_vset_cache_file( const char *path );
+	// Save the cache to path at unmount, warm it from there at mount (NULL is off)
 
 #endif
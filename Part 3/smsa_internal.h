@@ -18,21 +18,38 @@ typedef struct {
 	SMSA_DISK_COMMAND	cmd;	// The type of operation being performed
 	SMSA_DRUM_ID		did;	// This is the drum to be written to/read from
 	SMSA_BLOCK_ID		bid;	// This is the address to read/write
-	unsigned short		len;	// Number of bytes to be read/written
+	unsigned short		len;	// Number of bytes to be read/written (extents only)
 	unsigned char		*blk;	// The buffer to place read or write data
 } SMSA_OPERATION; 
 
+// A drum memory replaced while pinned, kept until its last pin is given back
+typedef struct smsa_retired {
+	unsigned char		*image;	// The old drum memory
+	uint32_t		pins;	// Pins still on it
+	struct smsa_retired	*next;	// The next retired drum memory
+} SMSA_RETIRED;
+
 //
 // Disk interface (internals)
 
 // SMSA Command functions
-int SMSAMountArray( void );
-int SMSAUnmountArray( void );
-int SMSASeekDrum( SMSA_DRUM_ID did );
-int SMSASeekBlock( SMSA_BLOCK_ID blk );
-int SMSAReadBlock( unsigned char *block );
-int SMSAWriteBlock( unsigned char *block );
-int SMSAFormatDrum( void );
+int SMSAMountArray( SMSA_SESSION *session );
+int SMSAUnmountArray( SMSA_SESSION *session );
+int SMSASeekDrum( SMSA_SESSION *session, SMSA_DRUM_ID did );
+int SMSASeekBlock( SMSA_SESSION *session, SMSA_BLOCK_ID blk );
+int SMSASeekAt( SMSA_SESSION *session, SMSA_DRUM_ID did, SMSA_BLOCK_ID blk );
+int SMSAReadBlock( SMSA_SESSION *session, unsigned char *block );
+int SMSAWriteBlock( SMSA_SESSION *session, unsigned char *block );
+int SMSAFormatDrum( SMSA_SESSION *session );
+int SMSAGetState( unsigned char *block );
+int SMSAReadExtent( SMSA_SESSION *session, unsigned char *block, uint32_t blocks );
+int SMSAWriteExtent( SMSA_SESSION *session, unsigned char *block, uint32_t blocks );
+int SMSAFillExtent( SMSA_SESSION *session, unsigned char value, uint32_t blocks );
+int SMSAWritePart( SMSA_SESSION *session, unsigned char *bytes, uint32_t offset, uint32_t len );
+int SMSACopyExtent( SMSA_SESSION *session, SMSA_DRUM_ID did, SMSA_BLOCK_ID blk, uint32_t blocks );
+int SMSAPinExtent( SMSA_SESSION *session, SMSA_PIN *pins, uint32_t blocks );
+int SMSAUnshareDrum( SMSA_DRUM_ID did, int copy );
+void SMSARetireDrum( SMSA_DRUM_ID did );
 
 // Utility functions
 int SMSAStoreArray( void );
@@ -40,6 +57,6 @@ int SMSALoadArray( void );
 int decode_SMSA_operation( SMSA_OPERATION *dop, uint32_t op, unsigned char *block );
 uint32_t encode_SMSA_operation( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID addr );
 unsigned char * block_address( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid );
-int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid );
+int operation_cycle_cost( SMSA_SESSION *session, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t blocks );
 
 #endif
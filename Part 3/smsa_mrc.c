@@ -0,0 +1,673 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_mrc.c
+//  Description   : This is the miss ratio curve tool for SMSA workloads.  It
+//                  reads a workload file once, works out the LRU stack
+//                  distance of every block the driver would touch, and from
+//                  that gives the hit ratio and cycle count of every cache
+//                  size at once, next to the Belady (OPT) bound.
+//
+//   Author        : Mohanish Sheth
+//
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Project Includes
+#include <smsa.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define SMSA_ARGUMENTS "hvajl:s:"
+#define USAGE \
+	"USAGE: smsamrc [-h] [-v] [-a] [-j] [-l <logfile>] [-s <sizes>] <workload-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -a - report every cache size up to the largest stack distance\n" \
+	"    -j - print JSON instead of CSV\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -s - comma separated cache sizes in lines (default 32,64,...,4096)\n" \
+	"\n" \
+	"    <workload-file> - file contain the workload to analyse\n" \
+	"\n" \
+
+#define SMSA_MRC_MAX_KEYS (SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID)
+#define SMSA_MRC_MAX_SIZES SMSA_MRC_MAX_KEYS
+#define SMSA_MRC_COLD 0                 // Stack distance of a first reference
+#define SMSA_MRC_NEVER UINT32_MAX       // Next use of a block not used again
+
+// The cycle costs of the array, as charged by operation_cycle_cost()
+#define SMSA_MRC_MOUNT_CYCLES 10000
+#define SMSA_MRC_DRUM_CYCLES 1000       // Per column the drum head moves
+#define SMSA_MRC_BLOCK_CYCLES 10        // Per block the read head moves
+#define SMSA_MRC_READ_CYCLES 50
+#define SMSA_MRC_WRITE_CYCLES 200
+
+// What the driver does for one block of a workload line
+typedef enum {
+	SMSA_MRC_READ		= 0,  // Read, the array is read on a miss
+	SMSA_MRC_WRITE		= 1,  // Partial write, written (just the bytes on a miss)
+	SMSA_MRC_WRITE_FULL	= 2,  // Whole block write, always written, never read
+	SMSA_MRC_MOUNT		= 3,  // Mount, the cache starts out empty
+	SMSA_MRC_UNMOUNT	= 4,  // Unmount
+} SMSA_MRC_KIND;
+
+// One reference of the trace
+typedef struct {
+	uint16_t   key;   // drum*SMSA_MAX_BLOCK_ID+block (not used by mount/unmount)
+	uint8_t    kind;  // SMSA_MRC_KIND
+	uint32_t   lru;   // LRU stack distance, 1 is the most recent block (SMSA_MRC_COLD if first)
+	uint32_t   opt;   // OPT stack distance
+	uint32_t   next;  // Index of the next reference to the same block (SMSA_MRC_NEVER if none)
+} SMSA_MRC_REF;
+
+// The trace of a workload
+typedef struct {
+	SMSA_MRC_REF  *ref;    // References in workload order
+	uint32_t       refs;   // Number of references (mount/unmount included)
+	uint32_t       blocks; // Number of block references
+	uint32_t       cold;   // Block references that are first in their mount
+	uint32_t       max;    // Largest LRU stack distance seen
+	uint32_t       alloc;  // References ref has room for
+	uint32_t       lru_hist[SMSA_MRC_MAX_KEYS+1]; // References at each LRU distance
+	uint32_t       opt_hist[SMSA_MRC_MAX_KEYS+1]; // References at each OPT distance
+} SMSA_MRC_TRACE;
+
+// The results for one cache size
+typedef struct {
+	uint32_t   lines;      // Cache size
+	uint64_t   lru_hits;   // Block references LRU finds cached
+	uint64_t   lru_cycles; // Cycles the array spends with LRU
+	uint64_t   opt_hits;   // Block references OPT finds cached
+	uint64_t   opt_cycles; // Cycles the array spends with OPT
+} SMSA_MRC_POINT;
+
+//
+// Functional Prototypes
+
+int mrc_load_trace( char *wload, SMSA_MRC_TRACE *trace );
+int mrc_add_ref( SMSA_MRC_TRACE *trace, SMSA_MRC_KIND kind, uint32_t key );
+int mrc_add_span( SMSA_MRC_TRACE *trace, int write, uint32_t addr, uint32_t len );
+int mrc_lru_distances( SMSA_MRC_TRACE *trace );
+int mrc_opt_distances( SMSA_MRC_TRACE *trace );
+uint64_t mrc_hits( SMSA_MRC_TRACE *trace, uint32_t lines, int opt );
+uint64_t mrc_cycles( SMSA_MRC_TRACE *trace, uint32_t lines, int opt );
+int mrc_parse_sizes( char *list, uint32_t *sizes, uint32_t *count );
+void mrc_print( char *wload, SMSA_MRC_TRACE *trace, SMSA_MRC_POINT *points, uint32_t count, int json );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the SMSA miss ratio curve tool
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] )
+{
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, every = 0, json = 0;
+	uint32_t sizes[SMSA_MRC_MAX_SIZES], count = 0, i;
+	static SMSA_MRC_TRACE trace;
+	SMSA_MRC_POINT *points;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'a': // Every size
+			every = 1;
+			break;
+
+		case 'j': // JSON output
+			json = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 's': // Set the cache sizes
+			if ( mrc_parse_sizes(optarg, sizes, &count) ) {
+			    fprintf( stderr, "Bad cache size list (%s), aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// The filename should be the next option
+	if ( optind >= argc ) {
+	    fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+	    return( -1 );
+	}
+
+	// Read the workload and work out the stack distances
+	memset( &trace, 0x0, sizeof(trace) );
+	if ( mrc_load_trace(argv[optind], &trace) || mrc_lru_distances(&trace) || mrc_opt_distances(&trace) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to analyse workload [%s].", argv[optind] );
+		free( trace.ref );
+		return( -1 );
+	}
+
+	// The sizes Part 2's batch.sh sweeps, or every size up to the one that
+	// holds everything that is ever reused
+	if ( every ) {
+		for ( count=0; (count<trace.max || count==0) && count<SMSA_MRC_MAX_SIZES; count++ ) {
+			sizes[count] = count+1;
+		}
+	} else if ( count == 0 ) {
+		for ( i=32; i<=SMSA_MRC_MAX_KEYS; i*=2 ) {
+			sizes[count++] = i;
+		}
+	}
+
+	// The hit counts come straight off the distances, the cycles need the
+	// head positions replayed.  A bigger cache hits on a superset of what a
+	// smaller one does, so sizes with the same hit count miss on exactly
+	// the same references and the replay can be skipped.
+	if ( (points = calloc(count, sizeof(SMSA_MRC_POINT))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to allocate the curve." );
+		free( trace.ref );
+		return( -1 );
+	}
+	for ( i=0; i<count; i++ ) {
+		points[i].lines = sizes[i];
+		points[i].lru_hits = mrc_hits( &trace, sizes[i], 0 );
+		points[i].opt_hits = mrc_hits( &trace, sizes[i], 1 );
+		if ( (i > 0) && (points[i].lru_hits == points[i-1].lru_hits) ) {
+			points[i].lru_cycles = points[i-1].lru_cycles;
+		} else {
+			points[i].lru_cycles = mrc_cycles( &trace, sizes[i], 0 );
+		}
+		if ( (i > 0) && (points[i].opt_hits == points[i-1].opt_hits) ) {
+			points[i].opt_cycles = points[i-1].opt_cycles;
+		} else {
+			points[i].opt_cycles = mrc_cycles( &trace, sizes[i], 1 );
+		}
+	}
+	mrc_print( argv[optind], &trace, points, count, json );
+
+	// Return successfully
+	free( points );
+	free( trace.ref );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_load_trace
+// Description  : Read a workload file into the blocks the driver touches,
+//                parsing it the same way simulate_SMSA() does
+//
+// Inputs       : wload - the name of the workload file
+//                trace - the trace to fill in
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_load_trace( char *wload, SMSA_MRC_TRACE *trace ) {
+
+	// Local variables
+	char line[256], cmd[32];
+	FILE *fhandle = NULL;
+	uint32_t addr, len, ch;
+	int err = 0;
+
+	// Open the workload file
+	if ( (fhandle=fopen(wload, "r")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
+		return( -1 );
+	}
+
+	// Turn every line into its references
+	while ( (err == 0) && (fgets(line, 256, fhandle) != NULL) ) {
+
+		if ( strncmp(SMSA_WORKLOAD_MOUNT,line,strlen(SMSA_WORKLOAD_MOUNT)) == 0 ) {
+			err = mrc_add_ref( trace, SMSA_MRC_MOUNT, 0 );
+		}
+
+		else if ( strncmp(SMSA_WORKLOAD_UNMOUNT,line,strlen(SMSA_WORKLOAD_UNMOUNT)) == 0 ) {
+			err = mrc_add_ref( trace, SMSA_MRC_UNMOUNT, 0 );
+		}
+
+		// Signing is free and write-through leaves nothing to sync
+		else if ( strncmp(SMSA_WORKLOAD_SIGNALL,line,strlen(SMSA_WORKLOAD_SIGNALL)) == 0 ) {
+			continue;
+		}
+
+		else if ( sscanf( line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch ) != 4 ) {
+			logMessage( LOG_ERROR_LEVEL, "Error parsing virtual command [%s\n]", line );
+			err = -1;
+		}
+
+		else if ( strncmp(SMSA_WORKLOAD_READ, cmd, strlen(SMSA_WORKLOAD_READ)) == 0 ) {
+			err = mrc_add_span( trace, 0, addr, len );
+		}
+
+		else if ( strncmp(SMSA_WORKLOAD_WRITE, cmd, strlen(SMSA_WORKLOAD_WRITE)) == 0 ) {
+			err = mrc_add_span( trace, 1, addr, len );
+		}
+
+		else {
+			logMessage( LOG_ERROR_LEVEL, "Unknown virtual command, aborting [%s]", cmd );
+			err = -1;
+		}
+	}
+
+	// Close the workload file
+	fclose( fhandle );
+	logMessage( LOG_INFO_LEVEL, "Loaded %u references (%u blocks) from [%s].",
+			trace->refs, trace->blocks, wload );
+	return( err );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_add_ref
+// Description  : Append one reference to the trace
+//
+// Inputs       : trace - the trace
+//                kind - what the reference does
+//                key - the block it touches
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_add_ref( SMSA_MRC_TRACE *trace, SMSA_MRC_KIND kind, uint32_t key ) {
+
+	// Local variables
+	SMSA_MRC_REF *ref;
+	uint32_t alloc;
+
+	// Grow the trace by doubling
+	if ( trace->refs == trace->alloc ) {
+		alloc = (trace->alloc) ? trace->alloc*2 : 4096;
+		if ( (ref = realloc(trace->ref, alloc*sizeof(SMSA_MRC_REF))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "Unable to grow the trace to %u references.", alloc );
+			return( -1 );
+		}
+		trace->ref = ref;
+		trace->alloc = alloc;
+	}
+
+	ref = &trace->ref[trace->refs++];
+	memset( ref, 0x0, sizeof(SMSA_MRC_REF) );
+	ref->key = key;
+	ref->kind = kind;
+	ref->next = SMSA_MRC_NEVER;
+	if ( kind <= SMSA_MRC_WRITE_FULL ) {
+		trace->blocks++;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_add_span
+// Description  : Append the blocks a smsa_vread/smsa_vwrite call touches.
+//                Like the driver, a span always touches its first block
+//                and runs on into the next drum past the last block.
+//
+// Inputs       : trace - the trace
+//                write - 1 for a write, 0 for a read
+//                addr - the virtual address
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_add_span( SMSA_MRC_TRACE *trace, int write, uint32_t addr, uint32_t len ) {
+
+	// Local variables
+	uint32_t drum, block, off, n, done = 0;
+	SMSA_MRC_KIND kind;
+
+	// Check the span is inside the array, the way extract() does
+	drum = addr >> 16;
+	block = (addr & 0xffff) >> 8;
+	off = addr & 0xff;
+	if ( (drum >= SMSA_DISK_ARRAY_SIZE) || (((addr+len)>>16) > SMSA_DISK_ARRAY_SIZE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Span out of range [%u/%u]", addr, len );
+		return( -1 );
+	}
+
+	do {
+		if ( block >= SMSA_MAX_BLOCK_ID ) {
+			drum++;
+			block = 0;
+		}
+		if ( drum >= SMSA_DISK_ARRAY_SIZE ) {
+			logMessage( LOG_ERROR_LEVEL, "Span runs off the array [%u/%u]", addr, len );
+			return( -1 );
+		}
+
+		// A block needs its old contents unless the write covers all of it
+		n = SMSA_BLOCK_SIZE - off;
+		if ( n > len-done ) {
+			n = (len > done) ? len-done : 1;
+		}
+		if ( write ) {
+			kind = (off != 0 || len-done < SMSA_BLOCK_SIZE) ? SMSA_MRC_WRITE : SMSA_MRC_WRITE_FULL;
+		} else {
+			kind = SMSA_MRC_READ;
+		}
+		if ( mrc_add_ref(trace, kind, drum*SMSA_MAX_BLOCK_ID+block) ) {
+			return( -1 );
+		}
+		done += n;
+		off = 0;
+		block++;
+	} while ( done < len );
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_lru_distances
+// Description  : Work out the LRU stack distance of every block reference.
+//                The distance is one more than the number of different
+//                blocks touched since the last use of the same block, which
+//                a Fenwick tree over the trace gives in log time: each
+//                block keeps a mark at its latest reference only, so the
+//                marks between two uses count the distinct blocks.  Also
+//                links every reference to the next use of its block.
+//
+// Inputs       : trace - the trace
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_lru_distances( SMSA_MRC_TRACE *trace ) {
+
+	// Local variables
+	uint32_t *tree, last[SMSA_MRC_MAX_KEYS], mount = 0, t, i, n, key, marks;
+	SMSA_MRC_REF *ref;
+
+	// One slot per reference (the tree is 1 based)
+	n = trace->refs;
+	if ( (tree = calloc(n+1, sizeof(uint32_t))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to allocate the LRU stack." );
+		return( -1 );
+	}
+	for ( i=0; i<SMSA_MRC_MAX_KEYS; i++ ) {
+		last[i] = SMSA_MRC_NEVER;
+	}
+
+	for ( t=0; t<n; t++ ) {
+		ref = &trace->ref[t];
+
+		// Every mount starts with an empty cache
+		if ( ref->kind == SMSA_MRC_MOUNT ) {
+			mount = t;
+			continue;
+		}
+		if ( ref->kind == SMSA_MRC_UNMOUNT ) {
+			continue;
+		}
+
+		// Count the marks after the previous use, then move its mark here
+		key = ref->key;
+		if ( (last[key] == SMSA_MRC_NEVER) || (last[key] < mount) ) {
+			ref->lru = SMSA_MRC_COLD;
+			trace->cold++;
+		} else {
+			marks = 0;
+			for ( i=t; i>0; i-=i&(-i) ) {
+				marks += tree[i];
+			}
+			for ( i=last[key]+1; i>0; i-=i&(-i) ) {
+				marks -= tree[i];
+			}
+			ref->lru = marks+1;
+			trace->lru_hist[ref->lru]++;
+			if ( ref->lru > trace->max ) {
+				trace->max = ref->lru;
+			}
+			for ( i=last[key]+1; i<=n; i+=i&(-i) ) {
+				tree[i]--;
+			}
+			trace->ref[last[key]].next = t;
+		}
+		for ( i=t+1; i<=n; i+=i&(-i) ) {
+			tree[i]++;
+		}
+		last[key] = t;
+	}
+
+	free( tree );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_opt_distances
+// Description  : Work out the OPT stack distance of every block reference,
+//                using Mattson's stack algorithm with the next use as the
+//                priority.  The referenced block goes on top, and each
+//                block it passes on the way keeps its place only if it is
+//                needed sooner than the one being pushed down.  A cache of
+//                N lines holds the top N, which is what Belady's MIN keeps.
+//
+// Inputs       : trace - the trace (next links filled in)
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_opt_distances( SMSA_MRC_TRACE *trace ) {
+
+	// Local variables
+	uint32_t stack[SMSA_MRC_MAX_KEYS], next[SMSA_MRC_MAX_KEYS], depth = 0, t, i, d, carry, swap;
+	SMSA_MRC_REF *ref;
+
+	for ( t=0; t<trace->refs; t++ ) {
+		ref = &trace->ref[t];
+		if ( ref->kind == SMSA_MRC_MOUNT ) {
+			depth = 0;
+			continue;
+		}
+		if ( ref->kind == SMSA_MRC_UNMOUNT ) {
+			continue;
+		}
+
+		// Find the block, the depth of the stack if it is not there
+		for ( d=0; d<depth && stack[d]!=ref->key; d++ );
+		ref->opt = (d < depth) ? d+1 : SMSA_MRC_COLD;
+		trace->opt_hist[ref->opt]++;
+
+		// Push down from the top to where the block was
+		if ( d > 0 ) {
+			carry = stack[0];
+			stack[0] = ref->key;
+			for ( i=1; i<d; i++ ) {
+				if ( next[carry] < next[stack[i]] ) {
+					swap = stack[i];
+					stack[i] = carry;
+					carry = swap;
+				}
+			}
+			stack[d] = carry;
+			if ( d == depth ) {
+				depth++;
+			}
+		} else if ( depth == 0 ) {
+			stack[depth++] = ref->key;
+		}
+		next[ref->key] = ref->next;
+	}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_hits
+// Description  : Count the block references a cache of the given size hits
+//
+// Inputs       : trace - the trace
+//                lines - the cache size
+//                opt - 1 to use the OPT distances, 0 for LRU
+// Outputs      : the number of hits
+
+uint64_t mrc_hits( SMSA_MRC_TRACE *trace, uint32_t lines, int opt ) {
+
+	// Local variables
+	uint32_t *hist = (opt) ? trace->opt_hist : trace->lru_hist, d;
+	uint64_t hits = 0;
+
+	for ( d=1; d<=lines && d<=SMSA_MRC_MAX_KEYS; d++ ) {
+		hits += hist[d];
+	}
+	return( hits );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_cycles
+// Description  : Replay the array head for one cache size, the way the
+//                driver drives it in write-through mode: a read miss seeks
+//                (lazily) and reads, every write seeks and writes without
+//                reading first, and a read or write leaves the head on the
+//                next block.
+//
+// Inputs       : trace - the trace
+//                lines - the cache size
+//                opt - 1 to use the OPT distances, 0 for LRU
+// Outputs      : the cycle count
+
+uint64_t mrc_cycles( SMSA_MRC_TRACE *trace, uint32_t lines, int opt ) {
+
+	// Local variables
+	uint64_t cycles = 0;
+	uint32_t t, dist, drum, block, head_drum = 0, head_block = 0;
+	int hit, io;
+	SMSA_MRC_REF *ref;
+
+	for ( t=0; t<trace->refs; t++ ) {
+		ref = &trace->ref[t];
+		if ( ref->kind == SMSA_MRC_MOUNT || ref->kind == SMSA_MRC_UNMOUNT ) {
+			cycles += SMSA_MRC_MOUNT_CYCLES;
+			head_drum = head_block = 0;
+			continue;
+		}
+		dist = (opt) ? ref->opt : ref->lru;
+		hit = (dist != SMSA_MRC_COLD) && (dist <= lines);
+
+		// A read hit never reaches the array, a write never reads (a
+		// partial write miss sends just its bytes)
+		drum = ref->key / SMSA_MAX_BLOCK_ID;
+		block = ref->key % SMSA_MAX_BLOCK_ID;
+		for ( io=(hit || ref->kind != SMSA_MRC_READ); io<2; io++ ) {
+			if ( (io == 1) && (ref->kind == SMSA_MRC_READ) ) {
+				break;
+			}
+			if ( drum != head_drum ) {
+				cycles += abs((int)(head_drum%4) - (int)(drum%4)) * SMSA_MRC_DRUM_CYCLES;
+				head_drum = drum;
+				head_block = 0;
+			}
+			if ( block != head_block ) {
+				cycles += abs((int)head_block - (int)block) * SMSA_MRC_BLOCK_CYCLES;
+				head_block = block;
+			}
+			cycles += (io == 0) ? SMSA_MRC_READ_CYCLES : SMSA_MRC_WRITE_CYCLES;
+			head_block++;
+		}
+	}
+
+	return( cycles );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_parse_sizes
+// Description  : Parse a comma separated list of cache sizes
+//
+// Inputs       : list - the list
+//                sizes - where to put the sizes
+//                count - where to put the number of sizes
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_parse_sizes( char *list, uint32_t *sizes, uint32_t *count ) {
+
+	// Local variables
+	char *tok, *end;
+	unsigned long sz;
+
+	*count = 0;
+	for ( tok=strtok(list, ","); tok!=NULL; tok=strtok(NULL, ",") ) {
+		sz = strtoul( tok, &end, 10 );
+		if ( (*end != '\0') || (end == tok) || (sz > SMSA_MRC_MAX_KEYS) || (*count == SMSA_MRC_MAX_SIZES) ) {
+			return( -1 );
+		}
+		sizes[(*count)++] = sz;
+	}
+	return( (*count) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_print
+// Description  : Print the curve as CSV (one row per size) or JSON
+//
+// Inputs       : wload - the name of the workload file
+//                trace - the trace
+//                points - the results, one per size
+//                count - the number of sizes
+//                json - 1 for JSON, 0 for CSV
+// Outputs      : none
+
+void mrc_print( char *wload, SMSA_MRC_TRACE *trace, SMSA_MRC_POINT *points, uint32_t count, int json ) {
+
+	// Local variables
+	double blocks = (trace->blocks) ? trace->blocks : 1;
+	uint32_t i;
+
+	if ( json ) {
+		printf( "{\n  \"workload\": \"%s\",\n  \"references\": %u,\n  \"cold_misses\": %u,\n"
+				"  \"max_distance\": %u,\n  \"curve\": [\n", wload, trace->blocks, trace->cold, trace->max );
+		for ( i=0; i<count; i++ ) {
+			printf( "    {\"lines\": %u, \"lru_hits\": %lu, \"lru_hit_ratio\": %.6f, \"lru_cycles\": %lu, "
+					"\"opt_hits\": %lu, \"opt_hit_ratio\": %.6f, \"opt_cycles\": %lu}%s\n",
+					points[i].lines, points[i].lru_hits, points[i].lru_hits/blocks, points[i].lru_cycles,
+					points[i].opt_hits, points[i].opt_hits/blocks, points[i].opt_cycles,
+					(i+1 < count) ? "," : "" );
+		}
+		printf( "  ]\n}\n" );
+		return;
+	}
+
+	printf( "lines,references,lru_hits,lru_hit_ratio,lru_cycles,opt_hits,opt_hit_ratio,opt_cycles\n" );
+	for ( i=0; i<count; i++ ) {
+		printf( "%u,%u,%lu,%.6f,%lu,%lu,%.6f,%lu\n", points[i].lines, trace->blocks,
+				points[i].lru_hits, points[i].lru_hits/blocks, points[i].lru_cycles,
+				points[i].opt_hits, points[i].opt_hits/blocks, points[i].opt_cycles );
+	}
+	return;
+}
@@ -14,23 +14,95 @@
 #include <stdint.h>
 
 // Project Include Files
+#include <smsa.h>
 
 // Defines
-#define SMSA_MAX_BACKLOG 5
-#define SMSA_NET_HEADER_SIZE (sizeof(uint16_t)+sizeof(uint32_t)+sizeof(uint16_t))
+#define SMSA_MAX_BACKLOG 512
+#define SMSA_NET_HEADER_SIZE (sizeof(uint16_t)+sizeof(uint32_t)+sizeof(uint16_t)+sizeof(uint32_t))
+#define SMSA_NET_MAX_PACKET (SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE)
+#define SMSA_NET_MAX_EXTENT_PACKET (SMSA_NET_HEADER_SIZE+SMSA_MAX_EXTENT*SMSA_BLOCK_SIZE)
+#define SMSA_NET_MAX_FRAME 0xffff      // Most bytes the length field can give
+#define SMSA_NET_BATCH 0x3f            // Command of a batch frame, never an array command
+#define SMSA_NET_MAX_BATCH 255         // Most operations in a batch frame
+#define SMSA_NET_BATCH_OP(n) ((SMSA_NET_BATCH<<26)|((n)<<8))
+#define SMSA_NET_ATTACH 0x3e           // Command moving a connection to shared memory
 #define SMSA_DEFAULT_IP "127.0.0.1"
 #define SMSA_DEFAULT_PORT 16784
 
 //
 // Type Definitions
 
+// How a client reaches the server
+typedef enum {
+	SMSA_NET_TCP       = 0,  // Packets over the socket
+	SMSA_NET_SHM       = 1,  // Shared memory rings, sleeping for replies
+	SMSA_NET_SHM_POLL  = 2,  // Shared memory rings, spinning for replies
+} SMSA_NET_TRANSPORT;
+
 //
 // Funtional Prototypes
 
+//
+// SMSA Packet definition (network byte order)
+//
+//  Bytes 0-1    : length - how many total bytes in packet
+//  Bytes 2-5    : opcode - the opcode for the command
+//  Bytes 6-7    : return - return code of comamnd
+//  Bytes 8-11   : request - id the client gave the request, echoed back
+//  Bytes 12-267 : block - as needed, SMSA_BLOCK (or the run of blocks of
+//                 an extent, up to SMSA_NET_MAX_EXTENT_PACKET in all)
+//
+// A client may send many requests before reading any replies, the server
+// runs them in order and replies in the same order.
+//
+// A batch frame (command SMSA_NET_BATCH, operation count in bits 8-15) runs
+// many operations for one header.  After the header come, for each
+// operation, its opcode (4 bytes) and the blocks it writes.  The reply
+// holds the return code of each operation (2 bytes each) and then the
+// blocks each one read, in order; its own return is -1 if any failed.
+//
+// A fill (SMSA_DISK_FILL) is only a header, the block count and the byte
+// value are in the opcode.  A partial write (SMSA_DISK_WRITE_PART) carries
+// only the bytes it writes, their count is in the opcode with the offset.
+// A copy (SMSA_DISK_COPY) is only a header too, it copies the block count
+// in the opcode from the heads to the drum/block in the opcode.
+//
+// A client on the same host may send an attach frame (command
+// SMSA_NET_ATTACH) first, holding the SMSA_SHM_NAME_SIZE byte name of a
+// shared memory segment it made (see smsa_shm.h).  The reply comes on the
+// socket, after a good one the packets go through the segment's rings and
+// the socket only carries one byte doorbells from the client when the
+// server sleeps, and its closing.
+
 int smsa_client_operation( uint32_t op, unsigned char *block );
     // This is the implementation of the client operation
 
+int smsa_client_send( uint32_t op, unsigned char *block, uint32_t *id );
+    // Send a request without waiting for the reply
+
+int smsa_client_wait( uint32_t id );
+    // Wait for the reply to a sent request (and all those before it), 0 waits
+    // for all and reports failures of the requests sent without an id
+
+int smsa_client_flush( void );
+    // Send the requests held so far, the blocks they write may be reused
+
+int smsa_client_set_transport( SMSA_NET_TRANSPORT transport );
+    // Pick how the next connection reaches the server
+
+int smsa_client_operation_batch( uint32_t *ops, unsigned char **blocks, int16_t *rets, int count );
+    // Run many operations with one request and one reply
+
 int smsa_server( void );
     // This is the implementation of the server application
 
+int smsa_server_set_workers( int workers );
+    // Run client operations on a pool of worker threads (0 for none)
+
+int smsa_server_set_uring( int on );
+    // Serve clients from an io_uring loop instead of epoll
+
+int smsa_server_set_zerocopy( int on );
+    // Send big extent reads to socket clients straight from the array
+
 #endif
@@ -0,0 +1,552 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_readahead.c
+//  Description    : This is the readahead engine for the SMSA driver.
+//
+//   Author        : Mohanish Sheth
+//
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project Include Files
+#include <smsa_readahead.h>
+#include <smsa_cache.h>
+
+// GlobalVariable
+SMSA_READAHEAD_STREAM Streams[SMSA_READAHEAD_STREAMS];
+SMSA_READAHEAD_STATS ReadaheadStats;
+SMSA_READAHEAD_FETCH ReadaheadFetch = NULL;
+SMSA_READAHEAD_WAIT ReadaheadWait = NULL;
+uint32_t ReadaheadWindow = 0;  // Largest window a stream may grow to, 0 if off
+uint64_t ReadaheadClock;
+
+// Stream (+1) that prefetched each key and has not read it yet, 0 if none
+uint8_t ReadaheadPending[SMSA_CACHE_MAX_KEYS];
+
+// Prefetches sent and not yet waited for.  Their blocks come into
+// ReadaheadBuf and go to the cache when they land, which the driver makes
+// happen before it looks for one of them or writes anything.
+SMSA_READAHEAD_FLIGHT ReadaheadFlight[SMSA_READAHEAD_FLIGHTS];
+int ReadaheadFlights = 0;
+unsigned char ReadaheadBuf[SMSA_READAHEAD_BUF_BLOCKS*SMSA_BLOCK_SIZE];
+uint32_t ReadaheadBufUsed = 0;
+uint8_t ReadaheadFlying[SMSA_CACHE_MAX_KEYS]; // 1 if a prefetch of the key is out
+
+// Functions
+int find_stream (int32_t key, int32_t *step);
+int new_stream (int32_t key);
+int retrain_stream (int s, int32_t key);
+void abandon_stream (int s);
+void grow_window (int s);
+void backoff_window (int s);
+int prefetch_stream (int s, int32_t key);
+int send_prefetch (int32_t key, uint32_t cnt);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_init_readahead
+// Description  : Setup the readahead, forgetting every stream
+//
+// Inputs       : window - the largest window a stream may grow to, 0 is off
+//                fetch - sends a read of blocks from the array
+//                wait - waits for a read fetch sent
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_init_readahead( uint32_t window, SMSA_READAHEAD_FETCH fetch, SMSA_READAHEAD_WAIT wait ) {
+
+	int i;
+
+	if (window > 0 && (fetch == NULL || wait == NULL)){
+		logMessage (LOG_ERROR_LEVEL, "Readahead needs fetch and wait functions.\n");
+		return(-1);
+	}
+
+	// Never prefetch more than the array holds
+	if (window > SMSA_MAX_BLOCK_ID){
+		window = SMSA_MAX_BLOCK_ID;
+	}
+	ReadaheadWindow = window;
+	ReadaheadFetch = fetch;
+	ReadaheadWait = wait;
+	ReadaheadClock = 0;
+	ReadaheadFlights = 0;
+	ReadaheadBufUsed = 0;
+	for (i=0; i<SMSA_READAHEAD_STREAMS; i++){
+		Streams[i].last = -1;
+	}
+	memset(ReadaheadPending, 0x0, sizeof(ReadaheadPending));
+	memset(ReadaheadFlying, 0x0, sizeof(ReadaheadFlying));
+	memset(&ReadaheadStats, 0x0, sizeof(ReadaheadStats));
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_readahead
+// Description  : Tell the readahead a block was read.  The read is matched
+//                to the stream it continues (or starts a new one), and once
+//                a stream has shown the same stride twice the blocks ahead
+//                of it are read into the cache.  The caller reads every
+//                block of a request itself, so the blocks ahead are only
+//                sent for after its last one.
+//
+// Inputs       : drm - the drum ID that was read
+//                blk - the block ID that was read
+//                hit - 1 if the block came from the cache, 0 otherwise
+//                last - 1 if it is the last block of the request
+// Outputs      : 0 if successful, -1 if a prefetch failed
+
+int smsa_readahead( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, int hit, int last ) {
+
+	int32_t key, step;
+	int s;
+
+	if (ReadaheadWindow == 0 || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(0);
+	}
+	key = SMSA_CACHE_KEY(drm,blk);
+	ReadaheadClock++;
+
+	// Settle up for the block if a stream prefetched it
+	if (ReadaheadPending[key]){
+		s = ReadaheadPending[key]-1;
+		ReadaheadPending[key] = 0;
+		if (hit){
+			ReadaheadStats.useful++;
+			grow_window (s);
+		}
+		else {
+			// It was pushed out of the cache before anyone read it
+			ReadaheadStats.wasted++;
+			backoff_window (s);
+		}
+	}
+
+	// Continue a stream, or start one
+	s = find_stream (key, &step);
+	if (s == -1){
+		return(new_stream (key));
+	}
+	Streams[s].used = ReadaheadClock;
+	if (step == 0){
+		// A block the stream already went past, nothing new
+		return(0);
+	}
+	if (step < 0){
+		return(retrain_stream (s, key));
+	}
+
+	// The stream moved on, possibly skipping blocks it had prefetched.  A
+	// stream that backed off all the way has to keep going for a while
+	// before it gets to prefetch again.
+	Streams[s].last = key;
+	Streams[s].confirm++;
+	if (Streams[s].window == 0){
+		if (++Streams[s].consumed < SMSA_READAHEAD_PROBATION){
+			return(0);
+		}
+		Streams[s].window = 1;
+		Streams[s].consumed = 0;
+	}
+	return(last ? prefetch_stream (s, key) : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_readahead_flying
+// Description  : Tell whether a prefetch of the block is on its way, so
+//                the cache does not have it yet
+//
+// Inputs       : drm - the drum ID
+//                blk - the block ID
+// Outputs      : 1 if it is, 0 if not
+
+int smsa_readahead_flying( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
+
+	if (ReadaheadFlights == 0 || drm >= SMSA_DISK_ARRAY_SIZE || blk >= SMSA_MAX_BLOCK_ID){
+		return(0);
+	}
+	return(ReadaheadFlying[SMSA_CACHE_KEY(drm,blk)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_land_readahead
+// Description  : Wait for the prefetches on their way and put their blocks
+//                in the cache.  A block cached since it was sent is newer
+//                than the prefetched one and is kept.  Every prefetch is
+//                waited for even if one failed.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if a prefetch failed
+
+int smsa_land_readahead( void ) {
+
+	SMSA_READAHEAD_FLIGHT *f;
+	SMSA_DRUM_ID drm;
+	SMSA_BLOCK_ID blk;
+	int32_t key;
+	uint32_t j;
+	int i, failed = 0;
+
+	for (i=0; i<ReadaheadFlights; i++){
+		f = &ReadaheadFlight[i];
+		if (ReadaheadWait (f->id) == -1){
+			logMessage (LOG_ERROR_LEVEL, "Prefetch failed [%d/%d].\n",
+					f->key / SMSA_MAX_BLOCK_ID, f->key % SMSA_MAX_BLOCK_ID);
+			failed = 1;
+		}
+		for (j=0; j<f->cnt; j++){
+			key = f->key + j;
+			ReadaheadFlying[key] = 0;
+			drm = key / SMSA_MAX_BLOCK_ID;
+			blk = key % SMSA_MAX_BLOCK_ID;
+			if (failed || smsa_probe_cache_line (drm, blk)){
+				continue;
+			}
+			if (smsa_put_cache_line (drm, blk, &ReadaheadBuf[(f->at+j)*SMSA_BLOCK_SIZE]) == -1){
+				logMessage (LOG_ERROR_LEVEL, "Prefetch failed [%d/%d].\n", drm, blk);
+				failed = 1;
+			}
+		}
+	}
+	ReadaheadFlights = 0;
+	ReadaheadBufUsed = 0;
+	return(failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_get_readahead_stats
+// Description  : Get the readahead counters
+//
+// Inputs       : stats - where to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_get_readahead_stats( SMSA_READAHEAD_STATS *stats ) {
+
+	if (stats == NULL){
+		return(-1);
+	}
+	*stats = ReadaheadStats;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_readahead_stats
+// Description  : Log the readahead counters.  Every useful prefetch is a
+//                demand read the driver did not have to wait for.
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_readahead_stats( void ) {
+
+	uint64_t pending = 0;
+	int i;
+
+	if (ReadaheadWindow == 0){
+		return;
+	}
+	for (i=0; i<SMSA_CACHE_MAX_KEYS; i++){
+		pending += (ReadaheadPending[i] != 0);
+	}
+	logMessage (LOG_INFO_LEVEL, "Readahead stats (window up to %u blocks):", ReadaheadWindow);
+	logMessage (LOG_INFO_LEVEL, "  prefetched %lu, used %lu, wasted %lu, still unread %lu",
+			ReadaheadStats.issued, ReadaheadStats.useful, ReadaheadStats.wasted, pending);
+	logMessage (LOG_INFO_LEVEL, "  accuracy %.2f%%, demand reads avoided %lu, window grown %lu, cut %lu",
+			ReadaheadStats.issued ? 100.0*ReadaheadStats.useful/ReadaheadStats.issued : 0.0,
+			ReadaheadStats.useful, ReadaheadStats.grown, ReadaheadStats.backoffs);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_stream
+// Description  : find the stream a read belongs to.  A stream the read lands
+//                on wins: either a stride or more ahead of the stream but no
+//                further than it has prefetched (it continues the stream),
+//                or a little behind it (a block the stream already read, so
+//                it is left alone).  Otherwise the closest stream within
+//                SMSA_READAHEAD_MAX_STRIDE blocks is retrained.
+//
+// Inputs       : key - the block that was read
+//                step - set to the strides moved forward, 0 if the read is
+//                       behind the stream and -1 if the stream has to retrain
+// Outputs      : the stream, -1 if none is close enough
+
+int find_stream (int32_t key, int32_t *step){
+
+	int i, best = -1;
+	int32_t dist, ahead, best_dist = SMSA_READAHEAD_MAX_STRIDE+1;
+
+	for (i=0; i<SMSA_READAHEAD_STREAMS; i++){
+		if (Streams[i].last == -1){
+			continue;
+		}
+		dist = key - Streams[i].last;
+		if (dist == 0){
+			*step = 0;
+			return(i);
+		}
+		if (Streams[i].stride != 0 && dist % Streams[i].stride == 0){
+			ahead = 1;
+			if (Streams[i].next != -1 && (Streams[i].next - Streams[i].last)/Streams[i].stride > 1){
+				ahead = (Streams[i].next - Streams[i].last)/Streams[i].stride - 1;
+			}
+			*step = dist / Streams[i].stride;
+			if (*step >= 1 && *step <= ahead){
+				return(i);
+			}
+			if (*step < 0 && abs(dist) <= SMSA_READAHEAD_MAX_STRIDE){
+				*step = 0;
+				return(i);
+			}
+		}
+		if (abs(dist) < best_dist){
+			best_dist = abs(dist);
+			best = i;
+		}
+	}
+	*step = -1;
+	return(best);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : new_stream
+// Description  : start a stream at key, taking a free slot or the least
+//                recently used stream
+//
+// Inputs       : key - the block that was read
+// Outputs      : 0 (always successful)
+
+int new_stream (int32_t key){
+
+	int i, s = 0;
+
+	for (i=0; i<SMSA_READAHEAD_STREAMS; i++){
+		if (Streams[i].last == -1){
+			s = i;
+			break;
+		}
+		if (Streams[i].used < Streams[s].used){
+			s = i;
+		}
+	}
+	if (Streams[s].last != -1){
+		abandon_stream (s);
+	}
+
+	Streams[s].last = key;
+	Streams[s].stride = 0;
+	Streams[s].next = -1;
+	Streams[s].window = SMSA_READAHEAD_MIN_WINDOW;
+	Streams[s].confirm = 0;
+	Streams[s].consumed = 0;
+	Streams[s].used = ReadaheadClock;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : retrain_stream
+// Description  : a read broke the stream's stride, take the new gap as the
+//                stride and wait for it to repeat before prefetching again
+//
+// Inputs       : s - the stream
+//                key - the block that was read
+// Outputs      : 0 (always successful)
+
+int retrain_stream (int s, int32_t key){
+
+	abandon_stream (s);
+	Streams[s].stride = key - Streams[s].last;
+	Streams[s].last = key;
+	Streams[s].next = -1;
+	Streams[s].confirm = 0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : abandon_stream
+// Description  : the stream went elsewhere, anything it prefetched ahead
+//                and has not read counts as wasted
+//
+// Inputs       : s - the stream
+// Outputs      : void function
+
+void abandon_stream (int s){
+
+	int32_t key, ahead, i;
+	uint32_t wasted = 0;
+
+	// The blocks between the last read and the prefetch frontier
+	ahead = 0;
+	if (Streams[s].stride != 0 && Streams[s].next != -1){
+		ahead = (Streams[s].next - Streams[s].last)/Streams[s].stride - 1;
+	}
+	for (i=1; i<=ahead; i++){
+		key = Streams[s].last + i*Streams[s].stride;
+		if (key >= 0 && key < SMSA_CACHE_MAX_KEYS && ReadaheadPending[key] == s+1){
+			ReadaheadPending[key] = 0;
+			wasted++;
+		}
+	}
+	if (wasted > 0){
+		ReadaheadStats.wasted += wasted;
+		backoff_window (s);
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : grow_window
+// Description  : a prefetch paid off, double the window once the stream
+//                has used a whole window's worth
+//
+// Inputs       : s - the stream
+// Outputs      : void function
+
+void grow_window (int s){
+
+	if (Streams[s].window == 0){
+		return;
+	}
+	Streams[s].consumed++;
+	if (Streams[s].consumed >= Streams[s].window && Streams[s].window < ReadaheadWindow){
+		Streams[s].window *= 2;
+		if (Streams[s].window > ReadaheadWindow){
+			Streams[s].window = ReadaheadWindow;
+		}
+		Streams[s].consumed = 0;
+		ReadaheadStats.grown++;
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backoff_window
+// Description  : a prefetch went unread, halve the window.  A stream that
+//                is already down to one block stops prefetching until it
+//                has gone SMSA_READAHEAD_PROBATION more blocks.
+//
+// Inputs       : s - the stream
+// Outputs      : void function
+
+void backoff_window (int s){
+
+	Streams[s].window /= 2;
+	Streams[s].consumed = 0;
+	ReadaheadStats.backoffs++;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_stream
+// Description  : keep the stream's window of blocks ahead of key in the
+//                cache.  The window is only topped up once half of it has
+//                been read, so the prefetches go out in runs the head can
+//                stream through, a stride of one as one read of the run.
+//
+// Inputs       : s - the stream
+//                key - the block the stream just read
+// Outputs      : 0 if successful, -1 if a prefetch failed
+
+int prefetch_stream (int s, int32_t key){
+
+	SMSA_READAHEAD_STREAM *st = &Streams[s];
+	int32_t start = -1; // First key of the run not yet sent
+	uint32_t cnt = 0;   // Blocks in it
+
+	if (st->confirm == 0){
+		return(0);
+	}
+
+	// Start just past the read if it has caught up with the prefetching
+	if (st->next == -1 || (st->next - key)/st->stride <= 0){
+		st->next = key + st->stride;
+	}
+	if ((uint32_t)((st->next - key)/st->stride) > st->window/2 + 1){
+		return(0);
+	}
+
+	while ((uint32_t)((st->next - key)/st->stride) <= st->window &&
+			st->next >= 0 && st->next < SMSA_CACHE_MAX_KEYS){
+
+		// Cached blocks (possibly dirty) and ones on their way are left
+		// alone, and end the run
+		if (!smsa_probe_cache_line (st->next / SMSA_MAX_BLOCK_ID, st->next % SMSA_MAX_BLOCK_ID) &&
+				!ReadaheadFlying[st->next]){
+			if (cnt > 0 && (st->stride != 1 || st->next != start + (int32_t)cnt || cnt == SMSA_MAX_EXTENT)){
+				if (send_prefetch (start, cnt) == -1){
+					return(-1);
+				}
+				cnt = 0;
+			}
+			if (cnt++ == 0){
+				start = st->next;
+			}
+			if (ReadaheadPending[st->next]){
+				// Some stream prefetched it before and it fell out unread
+				ReadaheadStats.wasted++;
+			}
+			ReadaheadPending[st->next] = s+1;
+			ReadaheadStats.issued++;
+		}
+		st->next += st->stride;
+	}
+	if (cnt > 0){
+		return(send_prefetch (start, cnt));
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : send_prefetch
+// Description  : send the read of a run of blocks, not waiting for it.
+//                Once there is no room left for another, the ones out
+//                land first.
+//
+// Inputs       : key - the first block of the run
+//                cnt - the number of blocks
+// Outputs      : 0 if successful, -1 if a prefetch failed
+
+int send_prefetch (int32_t key, uint32_t cnt){
+
+	SMSA_READAHEAD_FLIGHT *f;
+	uint32_t i;
+
+	if ((ReadaheadFlights == SMSA_READAHEAD_FLIGHTS || ReadaheadBufUsed + cnt > SMSA_READAHEAD_BUF_BLOCKS) &&
+			smsa_land_readahead() == -1){
+		return(-1);
+	}
+
+	f = &ReadaheadFlight[ReadaheadFlights];
+	if (ReadaheadFetch (key / SMSA_MAX_BLOCK_ID, key % SMSA_MAX_BLOCK_ID, cnt,
+			&ReadaheadBuf[ReadaheadBufUsed*SMSA_BLOCK_SIZE], &f->id) == -1){
+		logMessage (LOG_ERROR_LEVEL, "Prefetch failed [%d/%d].\n", key / SMSA_MAX_BLOCK_ID, key % SMSA_MAX_BLOCK_ID);
+		return(-1);
+	}
+	f->key = key;
+	f->cnt = cnt;
+	f->at = ReadaheadBufUsed;
+	ReadaheadBufUsed += cnt;
+	ReadaheadFlights++;
+	for (i=0; i<cnt; i++){
+		ReadaheadFlying[key+i] = 1;
+	}
+	return(0);
+}
@@ -0,0 +1,90 @@
+#ifndef SMSA_READAHEAD_INCLUDED
+#define SMSA_READAHEAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_readahead.h
+//  Description    : This is the readahead engine for the SMSA driver.  It
+//                   watches the blocks smsa_vread touches, picks out
+//                   sequential and constant stride streams and prefetches
+//                   the blocks they are about to ask for into the cache.
+//
+//   Author        : Mohanish Sheth
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+
+// Defines
+#define SMSA_READAHEAD_STREAMS 8      // Streams tracked at once
+#define SMSA_READAHEAD_MAX_STRIDE 16  // Largest gap (in blocks) taken as a stride
+#define SMSA_READAHEAD_MIN_WINDOW 2   // Window a newly confirmed stream starts with
+#define SMSA_READAHEAD_PROBATION 8    // Blocks a stream backed off to nothing waits
+#define SMSA_READAHEAD_FLIGHTS 16     // Prefetches sent before they have to land
+#define SMSA_READAHEAD_BUF_BLOCKS (2*SMSA_MAX_BLOCK_ID) // Blocks they land in
+
+//
+// Type Definitions
+
+// Sends a read of cnt blocks from the array into buf without waiting for
+// it, putting the request to wait for in id.  0 if successful, -1 if failure
+typedef int (*SMSA_READAHEAD_FETCH)( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t cnt, unsigned char *buf, uint32_t *id );
+
+// Waits for a request a fetch sent, 0 if it worked, -1 if failure
+typedef int (*SMSA_READAHEAD_WAIT)( uint32_t id );
+
+// A prefetch sent and not yet in the cache
+typedef struct {
+    uint32_t         id;       // The request to wait for
+    int32_t          key;      // First key it reads
+    uint32_t         cnt;      // Blocks it reads, in a row
+    uint32_t         at;       // Block of the landing buffer they go to
+} SMSA_READAHEAD_FLIGHT;
+
+// One access stream, keys are drum*SMSA_MAX_BLOCK_ID+block
+typedef struct {
+    int32_t          last;     // Key of the last block the stream read (-1 if free)
+    int32_t          stride;   // Distance between its reads (0 until known)
+    int32_t          next;     // Next key to prefetch
+    uint32_t         window;   // Blocks to keep prefetched ahead of the stream (0 if backed off)
+    uint32_t         confirm;  // Reads in a row that matched the stride
+    uint32_t         consumed; // Prefetched blocks used since the window last changed
+    uint64_t         used;     // Logical clock value at the last read
+} SMSA_READAHEAD_STREAM;
+
+// What the readahead did since smsa_init_readahead()
+typedef struct {
+    uint64_t         issued;   // Blocks prefetched
+    uint64_t         useful;   // Prefetched blocks read before leaving the cache
+    uint64_t         wasted;   // Prefetched blocks evicted or abandoned unread
+    uint64_t         grown;    // Times a stream window doubled
+    uint64_t         backoffs; // Times a stream window was cut
+} SMSA_READAHEAD_STATS;
+
+//
+// Funtional Prototypes
+
+// Setup the readahead, a window of 0 turns it off
+int smsa_init_readahead( uint32_t window, SMSA_READAHEAD_FETCH fetch, SMSA_READAHEAD_WAIT wait );
+
+// Tell the readahead a block was read (hit if it came from the cache,
+// last if no more of the request follow)
+int smsa_readahead( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, int hit, int last );
+
+// Is a prefetch of the block on its way (not yet in the cache)
+int smsa_readahead_flying( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
+
+// Wait for the prefetches on their way and put them in the cache
+int smsa_land_readahead( void );
+
+// Get the readahead counters
+int smsa_get_readahead_stats( SMSA_READAHEAD_STATS *stats );
+
+// Log the readahead counters
+void smsa_log_readahead_stats( void );
+
+#endif
@@ -11,39 +11,229 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 // Project Include Files
 #include <smsa.h>
 #include <smsa_network.h>
+#include <smsa_shm.h>
 #include <cmpsc311_log.h>
 
+// Defines
+#define SMSA_SERVER_MAX_EVENTS 64       // Events taken from epoll per wait
+#define SMSA_SERVER_OUT_LIMIT  65536    // Queued reply bytes before a client stops being read
+#define SMSA_SERVER_MAX_WORKERS 64      // Most worker threads the server runs
+#define SMSA_SERVER_IN_SIZE    (16*SMSA_NET_MAX_PACKET) // Pipelined request bytes taken per read (grows for extents)
+#define SMSA_SERVER_URING_ENTRIES  256  // Submission queue entries of the io_uring loop
+#define SMSA_SERVER_URING_BUFS     64   // Receive buffers the kernel picks from (a power of two)
+#define SMSA_SERVER_URING_BUF_SIZE (16*1024) // Bytes in each receive buffer
+#define SMSA_SERVER_URING_ACCEPT   0    // What a completion is for, in the low bits of its
+#define SMSA_SERVER_URING_RECV     1    //   user data (the rest is the connection)
+#define SMSA_SERVER_URING_SEND     2
+#define SMSA_SERVER_URING_CANCEL   3    //   (a cancel has no connection)
+#define SMSA_SERVER_URING_IN_LIMIT (SMSA_NET_MAX_EXTENT_PACKET+SMSA_SERVER_URING_BUFS*SMSA_SERVER_URING_BUF_SIZE) // Most unrun bytes a paused client holds
+#define SMSA_SERVER_ZC_MIN     (32*SMSA_BLOCK_SIZE) // Smallest read sent zero-copy, pinning costs more below it
+#define SMSA_SERVER_ZC_MAX     64       // Zero-copy sends in flight per client before reads are copied again
+
+//
+// Type Definitions
+
+// A zero-copy send the kernel may still be reading the array for, its
+// pins are given back when the kernel says it is done
+typedef struct {
+    uint32_t        seq;                          // The send's number on the socket
+    int             pinned;                       // Number of pins
+    SMSA_PIN        pins[SMSA_MAX_PINS];          // The array memory it sends
+} SMSA_SERVER_ZC;
+
+// One client connection.  Requests are read into in as they arrive and
+// only run once whole, replies are queued on out and written as the
+// socket takes them, so no client ever blocks the loop.  With workers the
+// socket is watched one shot at a time, so only the worker it was handed
+// to touches the connection until it is watched again.  A client that
+// attached shared memory sends and gets packets through its rings, its
+// socket then only rings the doorbell.  With zero-copy on, a big read with
+// no replies queued before it goes to the socket straight from the array.
+typedef struct smsa_server_conn {
+    int             sock;                         // The client socket
+    char            name[32];                     // Client address, for the log
+    uint32_t        events;                       // What epoll is watching for
+    uint32_t        ready;                        // What epoll last said was ready
+    struct smsa_server_conn *next;                // Next connection waiting for a worker
+    SMSA_SESSION    session;                      // The client's heads and cycles on the array
+    SMSA_SHM_SEGMENT *shm;                        // The client's rings (NULL if on the socket)
+    SMSA_SHM_SEGMENT *shm_next;                   // Rings to move to once the attach reply is sent
+    unsigned char  *in;                           // Received bytes not yet run
+    size_t          in_len;                       // Number of bytes in in
+    size_t          in_cap;                       // Size of in
+    unsigned char  *out;                          // Replies not yet sent
+    size_t          out_off;                      // First unsent byte of out
+    size_t          out_len;                      // End of the queued bytes in out
+    size_t          out_cap;                      // Size of out
+    unsigned char  *sending;                      // Replies io_uring is sending (out is swapped in)
+    size_t          send_off;                     // First byte of sending not yet sent
+    size_t          send_len;                     // End of the bytes in sending
+    size_t          send_cap;                     // Size of sending
+    int             recv_armed;                   // io_uring is receiving for the connection
+    int             recv_held;                    // The receive is cancelled until the replies drain
+    int             send_armed;                   // io_uring is sending for the connection
+    int             closing;                      // Free once io_uring is done with it
+    int             zc;                           // Big reads are sent zero-copy
+    int             zc_copying;                   // The kernel copies them anyway, so they no longer are
+    uint32_t        zc_seq;                       // Number of the next zero-copy send on the socket
+    SMSA_SERVER_ZC  zc_flight[SMSA_SERVER_ZC_MAX]; // Zero-copy sends the kernel still has
+    int             zc_count;                     // Number of them
+    uint32_t        zc_sends;                     // Zero-copy sends made, for the log
+    uint32_t        zc_copied;                    // The ones the kernel copied after all
+} SMSA_SERVER_CONN;
+
+// The io_uring loop's rings, mapped from the kernel, and the receive
+// buffers the kernel fills (it picks one per completion)
+typedef struct {
+    int             fd;                           // The io_uring instance
+    unsigned       *sq_head;                      // Submission queue, the kernel takes from head
+    unsigned       *sq_tail;
+    unsigned       *sq_mask;
+    unsigned       *sq_entries;
+    unsigned       *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned       *cq_head;                      // Completion queue, the kernel adds at tail
+    unsigned       *cq_tail;
+    unsigned       *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned        pending;                      // Entries queued since the last submit
+    void           *rings;                        // The mapping of both queues
+    size_t          rings_len;
+    size_t          sqes_len;
+    struct io_uring_buf_ring *buf_ring;           // Receive buffers handed to the kernel
+    unsigned char  *bufs;
+} SMSA_SERVER_URING;
+
 // Global variables
 int smsa_server_shutdown    = 0;
-int client_socket	    = -1;
-unsigned char *client_ip    = NULL;
-unsigned short client_port  = 0;
+int smsa_server_workers     = 0;  // Worker threads running operations (0 runs them in the loop)
+int smsa_server_use_uring   = 0;  // Run the io_uring loop instead of epoll
+int smsa_server_zerocopy    = 0;  // Send big reads straight from the array
+
+// The connections waiting for a worker
+static SMSA_SERVER_CONN *smsa_server_runq_head = NULL;
+static SMSA_SERVER_CONN *smsa_server_runq_tail = NULL;
+static int smsa_server_runq_stop = 0;
+static pthread_mutex_t smsa_server_runq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t smsa_server_runq_cond = PTHREAD_COND_INITIALIZER;
 
 // Functional Prototypes
-int smsa_server_handle_connection( int sock );
-int smsa_recieve_packet( int sock, uint32_t *op, int16_t *ret, int *blkbytes, unsigned char *block ); 
-int smsa_send_packet( int sock, uint32_t op, int16_t ret, unsigned char *block );
-int smsa_read_bytes( int sock, int len, unsigned char *block );
-int smsa_send_bytes( int sock, int len, unsigned char *block );
-int smsa_wait_read( int sock );
+int smsa_server_accept( int epfd, int server );
+SMSA_SERVER_CONN *smsa_server_new_conn( int client, struct sockaddr_in *caddr );
+void smsa_server_handle( int epfd, SMSA_SERVER_CONN *conn );
+int smsa_server_handle_input( SMSA_SERVER_CONN *conn );
+int smsa_server_handle_output( SMSA_SERVER_CONN *conn );
+int smsa_server_drain( SMSA_SERVER_CONN *conn );
+int smsa_server_process( SMSA_SERVER_CONN *conn );
+int smsa_server_framed( uint32_t op, uint16_t len );
+int smsa_server_attach( SMSA_SERVER_CONN *conn, unsigned char *name, size_t rest );
+ssize_t smsa_server_recv( SMSA_SERVER_CONN *conn, unsigned char *buf, size_t len );
+ssize_t smsa_server_send( SMSA_SERVER_CONN *conn, unsigned char *buf, size_t len );
+int smsa_server_batch( SMSA_SERVER_CONN *conn, uint32_t op, uint32_t id, unsigned char *data, size_t size );
+int smsa_server_zerocopy_read( SMSA_SERVER_CONN *conn, uint32_t op, uint32_t id );
+int smsa_server_zerocopy_reap( SMSA_SERVER_CONN *conn );
+void smsa_server_zerocopy_release( SMSA_SERVER_ZC *zc );
+int smsa_server_run( SMSA_SERVER_CONN *conn, uint32_t op, unsigned char *block );
+int smsa_server_queue( SMSA_SERVER_CONN *conn, uint32_t op, int16_t ret, uint32_t id, size_t len );
+unsigned char *smsa_server_reserve( SMSA_SERVER_CONN *conn, size_t need );
+uint32_t smsa_server_header( unsigned char *out, uint16_t len, uint32_t op, int16_t ret, uint32_t id );
+uint32_t smsa_server_payload( uint32_t op, int reply );
+int smsa_server_watch( int epfd, SMSA_SERVER_CONN *conn );
+void smsa_server_close( int epfd, SMSA_SERVER_CONN *conn );
+void *smsa_server_worker( void *arg );
+int smsa_server_uring( int server );
+int smsa_server_uring_setup( SMSA_SERVER_URING *ring );
+void smsa_server_uring_teardown( SMSA_SERVER_URING *ring );
+struct io_uring_sqe *smsa_server_uring_sqe( SMSA_SERVER_URING *ring );
+int smsa_server_uring_enter( SMSA_SERVER_URING *ring, int wait );
+void smsa_server_uring_give( SMSA_SERVER_URING *ring, uint16_t bid );
+int smsa_server_uring_accept( SMSA_SERVER_URING *ring, int server );
+int smsa_server_uring_recv( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn );
+int smsa_server_uring_send( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn );
+int smsa_server_uring_run( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn );
+void smsa_server_uring_complete( SMSA_SERVER_URING *ring, struct io_uring_cqe *cqe, int server );
+void smsa_server_uring_drop( SMSA_SERVER_CONN *conn );
 void smsa_signal_handler( int no );
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_workers
+// Description  : Set how many worker threads run client operations, 0
+//                runs them in the epoll loop itself
+//
+// Inputs       : workers - the number of worker threads
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_workers( int workers ) {
+
+    // Check for a sane pool
+    if ( (workers < 0) || (workers > SMSA_SERVER_MAX_WORKERS) ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA bad worker count [%d], must be 0-%d", workers, SMSA_SERVER_MAX_WORKERS );
+	return( -1 );
+    }
+    smsa_server_workers = workers;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_uring
+// Description  : Run the io_uring loop instead of the epoll one
+//
+// Inputs       : on - 1 for io_uring, 0 for epoll
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_uring( int on ) {
+    smsa_server_use_uring = on;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_zerocopy
+// Description  : Send big extent reads to socket clients straight from
+//                the array (MSG_ZEROCOPY), not through the reply queue.
+//                Not used by the io_uring loop or on shared memory.
+//
+// Inputs       : on - 1 for zero-copy sends, 0 to copy
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_zerocopy( int on ) {
+    smsa_server_zerocopy = on;
+    return( 0 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_server
-// Description  : The main function SMSA server processing loop.
+// Description  : The main function SMSA server processing loop.  One epoll
+//                loop serves every client: the listening socket and all the
+//                (non-blocking) client sockets are waited on together.  With
+//                workers the loop hands each ready client to the pool, so
+//                clients on different drums run at the same time.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
@@ -52,17 +242,24 @@ int smsa_server( void ) {
 
     // Local variables
     struct sigaction new_action;
-    struct sockaddr_in saddr, caddr;
-    int server, client, optval;
-    unsigned int inet_len;
+    struct sockaddr_in saddr;
+    struct epoll_event ev, events[SMSA_SERVER_MAX_EVENTS];
+    pthread_t workers[SMSA_SERVER_MAX_WORKERS];
+    sigset_t sigs, oldsigs;
+    SMSA_SERVER_CONN *conn;
+    int server, epfd, optval, nev, i, nworkers = 0;
 
     // Set the signal handler
     new_action.sa_handler = smsa_signal_handler;
     new_action.sa_flags = SA_NODEFER | SA_ONSTACK;
+    sigemptyset( &new_action.sa_mask );
     sigaction( SIGINT, &new_action, NULL );
 
+    // A client that goes away leaves an error on the socket, not a signal
+    signal( SIGPIPE, SIG_IGN );
+
     // Create the socket
-    if ( (server=socket(AF_INET, SOCK_STREAM, 0)) == -1 ) {
+    if ( (server=socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, 0)) == -1 ) {
 	// Error out
 	logMessage( LOG_ERROR_LEVEL, "SMSA socket() create failed : [%s]", strerror(errno) );
 	smsa_error_number = SMSA_NET_ERROR;
@@ -79,7 +276,7 @@ int smsa_server( void ) {
 	return( -1 );
     }
 
-    // Setup address and bind the server to a particular port 
+    // Setup address and bind the server to a particular port
     saddr.sin_family = AF_INET;
     saddr.sin_port = htons(SMSA_DEFAULT_PORT);
     saddr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -104,42 +301,112 @@ int smsa_server( void ) {
 	return( -1 );
     }
 
+    // The io_uring loop serves everyone itself
+    if ( smsa_server_use_uring ) {
+	i = smsa_server_uring( server );
+	logMessage( LOG_INFO_LEVEL, "Shutting down SMSA server ..." );
+	close( server );
+	return( i );
+    }
+
+    // Setup the event loop, the listening socket has no connection
+    if ( (epfd = epoll_create1(0)) == -1 ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA epoll_create1() failed : [%s]", strerror(errno) );
+	smsa_error_number = SMSA_NET_ERROR;
+	close( server );
+	return( -1 );
+    }
+    memset( &ev, 0x0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if ( epoll_ctl(epfd, EPOLL_CTL_ADD, server, &ev) == -1 ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA epoll_ctl() failed : [%s]", strerror(errno) );
+	smsa_error_number = SMSA_NET_ERROR;
+	close( epfd );
+	close( server );
+	return( -1 );
+    }
+
+    // Start the workers, they wait for the loop to hand them clients and
+    // leave signals to the loop so a shutdown wakes it
+    smsa_server_runq_stop = 0;
+    sigemptyset( &sigs );
+    sigaddset( &sigs, SIGINT );
+    pthread_sigmask( SIG_BLOCK, &sigs, &oldsigs );
+    for ( nworkers=0; nworkers<smsa_server_workers; nworkers++ ) {
+	if ( pthread_create(&workers[nworkers], NULL, smsa_server_worker, (void *)(intptr_t)epfd) ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA unable to start worker %d, aborting.", nworkers );
+	    smsa_server_shutdown = 1;
+	    break;
+	}
+    }
+    pthread_sigmask( SIG_SETMASK, &oldsigs, NULL );
+    if ( nworkers ) {
+	logMessage( LOG_INFO_LEVEL, "Server running operations on [%d] workers", nworkers );
+    }
+
     // Wait until server is complete
-    smsa_server_shutdown = 0;
     while ( ! smsa_server_shutdown ) {
 
-	// Select waiting for data
-	if ( smsa_wait_read( server ) == -1 ) {
-	    // error out
+	// Wait for any socket to be ready
+	if ( (nev = epoll_wait(epfd, events, SMSA_SERVER_MAX_EVENTS, -1)) == -1 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
 	    logMessage( LOG_ERROR_LEVEL, "SMSA server wait failued, aborting." );
 	    smsa_error_number = SMSA_NET_ERROR;
-	    close( server );
-	    server = -1;
-	    return( -1 );
+	    break;
 	}
 
-	// Accept the connection
-	inet_len = sizeof(caddr);
-	if ( (client = accept( server, (struct sockaddr *)&caddr, &inet_len )) == -1 ) {
-	    // error out
-	    logMessage( LOG_ERROR_LEVEL, "SMSA server accept failued, aborting." );
-	    smsa_error_number = SMSA_NET_ERROR;
-	    close( server );
-	    server = -1;
-	    return( -1 );
+	for ( i=0; i<nev; i++ ) {
+
+	    // New connections on the listening socket
+	    if ( (conn = events[i].data.ptr) == NULL ) {
+		if ( smsa_server_accept(epfd, server) == -1 ) {
+		    logMessage( LOG_ERROR_LEVEL, "SMSA server accept failued, aborting." );
+		    smsa_error_number = SMSA_NET_ERROR;
+		    nev = -1;
+		    break;
+		}
+		continue;
+	    }
+	    conn->ready = events[i].events;
+
+	    // Serve the client here, or queue it for the next free worker
+	    if ( ! nworkers ) {
+		smsa_server_handle( epfd, conn );
+		continue;
+	    }
+	    pthread_mutex_lock( &smsa_server_runq_lock );
+	    conn->next = NULL;
+	    if ( smsa_server_runq_tail ) {
+		smsa_server_runq_tail->next = conn;
+	    } else {
+		smsa_server_runq_head = conn;
+	    }
+	    smsa_server_runq_tail = conn;
+	    pthread_cond_signal( &smsa_server_runq_cond );
+	    pthread_mutex_unlock( &smsa_server_runq_lock );
 	}
+	if ( nev == -1 ) {
+	    break;
+	}
+    }
 
-	// Log the creation of the new connection, process the input data
-	logMessage( LOG_INFO_LEVEL, "Server new client connection [%s/%d]", inet_ntoa(caddr.sin_addr), caddr.sin_port );
-	smsa_server_handle_connection( client );
-	logMessage( LOG_INFO_LEVEL, "Closing client connection [%s/%d]", inet_ntoa(caddr.sin_addr), caddr.sin_port );
-	close( client );
+    // Stop the workers, they finish the client they have first
+    pthread_mutex_lock( &smsa_server_runq_lock );
+    smsa_server_runq_stop = 1;
+    pthread_cond_broadcast( &smsa_server_runq_cond );
+    pthread_mutex_unlock( &smsa_server_runq_lock );
+    for ( i=0; i<nworkers; i++ ) {
+	pthread_join( workers[i], NULL );
     }
 
     // Log and shutdowmn, return
     logMessage( LOG_INFO_LEVEL, "Shutting down SMSA server ..." );
+    close( epfd );
     close( server );
-    return( 0 );
+    return( (nev == -1) ? -1 : 0 );
 }
 
 //
@@ -147,272 +414,1613 @@ int smsa_server( void ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : smsa_server_handle_connection
-// Description  : Handle a connection from a client process.
+// Function     : smsa_server_accept
+// Description  : Accept every waiting connection and add it to the loop
 //
-// Inputs       : sock - the socket filehandle of the clinet connection
+// Inputs       : epfd - the epoll instance
+//                server - the listening socket
 // Outputs      : 0 if successful, -1 if failure
 
-int smsa_server_handle_connection( int sock ) {
+int smsa_server_accept( int epfd, int server ) {
 
     // Local variables
-    int receiving = 1, blkbytes;
-    unsigned char block[SMSA_BLOCK_SIZE];
-    uint32_t op;
-    int16_t ret;
+    struct sockaddr_in caddr;
+    SMSA_SERVER_CONN *conn;
+    unsigned int inet_len;
+    int client;
 
-    // Keep receiving requests until done
-    while ( (receiving) && (! smsa_server_shutdown) ) {
+    while ( 1 ) {
 
-	// Keep receiving until we have enough data
-	blkbytes = SMSA_BLOCK_SIZE;
-	if ( smsa_recieve_packet( sock, &op, &ret, &blkbytes, block ) == -1 ) {
-	    logMessage( LOG_ERROR_LEVEL, "SMSA receive failed : [%s]", strerror(errno) );
-	    smsa_error_number = SMSA_NET_ERROR;
+	// Accept the connection, stop when there are no more
+	inet_len = sizeof(caddr);
+	if ( (client = accept( server, (struct sockaddr *)&caddr, &inet_len )) == -1 ) {
+	    if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) {
+		return( 0 );
+	    }
+
+	    // Running out of descriptors is the client's problem, not the server's
+	    if ( (errno == EMFILE) || (errno == ENFILE) || (errno == ECONNABORTED) ) {
+		logMessage( LOG_ERROR_LEVEL, "SMSA accept failed : [%s]", strerror(errno) );
+		return( 0 );
+	    }
 	    return( -1 );
 	}
-	assert( (blkbytes == 0) || (blkbytes == SMSA_BLOCK_SIZE) );
 
-	// Now process the received  data, send the response
-	ret = smsa_operation( op, block );
-	if ( smsa_send_packet(sock, op, ret, (SMSA_OPCODE(op) == SMSA_DISK_READ) ? block : NULL) == -1 ) {
-	    logMessage( LOG_ERROR_LEVEL, "SMSA send failed : [%s]", strerror(errno) );
-	    smsa_error_number = SMSA_NET_ERROR;
-	    return( -1 );
+	// The loop never waits on one client
+	if ( fcntl(client, F_SETFL, fcntl(client, F_GETFL)|O_NONBLOCK) == -1 ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA unable to make client non-blocking : [%s]", strerror(errno) );
+	    close( client );
+	    continue;
 	}
+
+	// Setup the connection state
+	if ( (conn = smsa_server_new_conn(client, &caddr)) == NULL ) {
+	    close( client );
+	    continue;
+	}
+	if ( smsa_server_watch(epfd, conn) == -1 ) {
+	    close( client );
+	    free( conn->in );
+	    free( conn );
+	    continue;
+	}
+
+	// Log the creation of the new connection
+	logMessage( LOG_INFO_LEVEL, "Server new client connection [%s]", conn->name );
     }
+}
 
-    // Close the socket and return sucessfully
-    close( sock );
-    return( 0 );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_new_conn
+// Description  : Setup the state of a new client connection
+//
+// Inputs       : client - the client socket
+//                caddr - the client address
+// Outputs      : the connection, NULL if failure
+
+SMSA_SERVER_CONN *smsa_server_new_conn( int client, struct sockaddr_in *caddr ) {
+
+    // Local variables
+    SMSA_SERVER_CONN *conn;
+    int optval = 1;
+
+    // Small replies go out right away
+    setsockopt( client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval) );
+
+    if ( (conn = calloc(1, sizeof(SMSA_SERVER_CONN))) == NULL ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to allocate connection, dropping client." );
+	return( NULL );
+    }
+    if ( (conn->in = malloc(SMSA_SERVER_IN_SIZE)) == NULL ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to allocate connection, dropping client." );
+	free( conn );
+	return( NULL );
+    }
+    conn->in_cap = SMSA_SERVER_IN_SIZE;
+    conn->sock = client;
+    smsa_init_session( &conn->session );
+    snprintf( conn->name, sizeof(conn->name), "%s/%d", inet_ntoa(caddr->sin_addr), ntohs(caddr->sin_port) );
+    conn->events = 0;
+
+    // Big reads go out of the array itself if the kernel lets them
+    if ( smsa_server_zerocopy && ! smsa_server_use_uring ) {
+	if ( setsockopt(client, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) == 0 ) {
+	    conn->zc = 1;
+	} else {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA no zero-copy sends for [%s] : [%s]", conn->name, strerror(errno) );
+	}
+    }
+    return( conn );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : smsa_recieve_packet
-// Description  : Recevie a packet from the other side
+// Function     : smsa_server_handle
+// Description  : Serve a client epoll said was ready, then watch it for
+//                whatever it needs next (the last thing done with it)
 //
-// Inputs       : sock - the socket filehandle of the clinet connection
-//                op - the opcode that was read
-//                ret - the return value from the operation (as needed)
-//                blkbytes - the number of bytes read into the block (0 if none)
-//                block - the read block
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : epfd - the epoll instance
+//                conn - the client connection
+// Outputs      : none
+
+void smsa_server_handle( int epfd, SMSA_SERVER_CONN *conn ) {
+
+    // The kernel says on the error queue when it is done with zero-copy sends
+    if ( (conn->ready & EPOLLERR) && conn->zc && (smsa_server_zerocopy_reap(conn) == -1) ) {
+	smsa_server_close( epfd, conn );
+	return;
+    }
+
+    // Data from or room for a client, a failure only drops that client
+    if ( (conn->ready & (EPOLLIN|EPOLLERR|EPOLLHUP)) && (conn->events & EPOLLIN) &&
+	    (smsa_server_handle_input(conn) == -1) ) {
+	smsa_server_close( epfd, conn );
+	return;
+    }
+    if ( (conn->ready & EPOLLOUT) && (smsa_server_handle_output(conn) == -1) ) {
+	smsa_server_close( epfd, conn );
+	return;
+    }
+    if ( smsa_server_watch(epfd, conn) == -1 ) {
+	smsa_server_close( epfd, conn );
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_handle_input
+// Description  : Read whatever the client has sent, run every complete
+//                request and send the replies
+//
+// Inputs       : conn - the client connection
+// Outputs      : 0 if successful, -1 if the connection is done
 
-int smsa_recieve_packet( int sock, uint32_t *op, int16_t *ret, int *blkbytes, unsigned char *block ) {
+int smsa_server_handle_input( SMSA_SERVER_CONN *conn ) {
 
     // Local variables
-    uint16_t  len, idx;
-    unsigned char hdr[SMSA_NET_HEADER_SIZE];
-
-    // SMSA Packet definition
-    //
-    //	Bytes 0-1   : length - how many total bytes in packet
-    //	Bytes 2-6   : opcode - the opcode for the command
-    //  Bytes 7-8   : return - return code of comamnd 
-    //	Bytes 6-261 : block - as needed, SMSA_BLOCK
-    //
-
-    // Read the header
-    if ( smsa_read_bytes( sock, SMSA_NET_HEADER_SIZE, hdr ) == -1 ) {
-	logMessage( LOG_ERROR_LEVEL, "SMSA receive packet failed : [%s]", strerror(errno) );
-	smsa_error_number = SMSA_NET_ERROR;
-	return( -1 );
+    unsigned char bell[64];
+    ssize_t rb;
+
+    // On shared memory the socket only says to look at the rings, or
+    // that the client went away
+    if ( conn->shm ) {
+	while ( (rb = read(conn->sock, bell, sizeof(bell))) > 0 );
+	if ( rb == 0 ) {
+	    logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->name );
+	    return( -1 );
+	}
+	if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA read bytes failed : [%s]", strerror(errno) );
+	    return( -1 );
+	}
     }
 
-    // Now get the header and other data, convert to host byte order
-    idx = 0;
-    memcpy( &len, hdr, sizeof(uint16_t) );
-    idx += sizeof(uint16_t);
-    len = ntohs( len );
-    memcpy( op, &hdr[idx], sizeof(uint32_t) );
-    idx += sizeof(uint32_t);
-    *op = ntohl( *op );
-    memcpy( ret, &hdr[idx], sizeof(int16_t) );
-    idx += sizeof(int16_t);
-    *ret = ntohs( *ret );
-
-    // Now see if there is more data to read
-    if ( len > SMSA_NET_HEADER_SIZE ) {
-	// Now read the remainig data for the packet
-	if ( smsa_read_bytes( sock, len-SMSA_NET_HEADER_SIZE, block ) == -1 ) {
-	    logMessage( LOG_ERROR_LEVEL, "SMSA receive packet failed : [%s]", strerror(errno) );
-	    smsa_error_number = SMSA_NET_ERROR;
+    // Keep reading until the socket is empty or the client has to wait
+    // for its replies to drain
+    while ( (conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT) && (conn->in_len < conn->in_cap) ) {
+
+	rb = smsa_server_recv( conn, &conn->in[conn->in_len], conn->in_cap-conn->in_len );
+	if ( rb < 0 ) {
+	    if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+		break;
+	    }
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    logMessage( LOG_ERROR_LEVEL, "SMSA read bytes failed : [%s]", strerror(errno) );
+	    return( -1 );
+	}
+
+	// Check for closed file
+	if ( rb == 0 ) {
+	    logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->name );
+	    return( -1 );
+	}
+	conn->in_len += rb;
+
+	// Run what came in
+	if ( smsa_server_process(conn) == -1 ) {
 	    return( -1 );
 	}
-	*blkbytes = len-SMSA_NET_HEADER_SIZE;
-    } else {
-	// Set the block bytes to none
-	*blkbytes = 0;
     }
 
-    // Return successfully
-    logMessage( LOG_INFO_LEVEL, "Received %d bytes on handle %d", len, sock );
-    return( 0 );
+    // Send the replies
+    return( smsa_server_handle_output(conn) );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Function     : smsa_send_packet
-// Description  : Send a packet to the other side
 //
-// Inputs       : sock - the socket filehandle of the clinet connection
-//                op - the opcode that was readi
-//                ret - return value to return
-//                block - the read block (NULL if not sent)
-// Outputs      : 0 if successful, -1 if failure
-
-int smsa_send_packet( int sock, uint32_t op, int16_t ret, unsigned char *block ) {
+// Function     : smsa_server_handle_output
+// Description  : Write as much of the queued replies as the socket takes
+//
+// Inputs       : conn - the client connection
+// Outputs      : 0 if successful, -1 if the connection is done
 
-    // Local varibles
-    uint16_t len, idx;
-    unsigned char sndbuf[SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE];
+int smsa_server_handle_output( SMSA_SERVER_CONN *conn ) {
 
-    // Read is the only time we send back a block
-    len = SMSA_NET_HEADER_SIZE;
-    if ( block != NULL ) {
-	len += SMSA_BLOCK_SIZE;
+    if ( smsa_server_drain(conn) == -1 ) {
+	return( -1 );
     }
-    len = htons(len);
-    op = htonl(op);
-    ret = htons(ret);
 
-    // Assemble the packet
-    idx = 0;
-    memcpy( &sndbuf[idx], &len, sizeof(len) ); // Length
-    idx += sizeof(uint16_t);
-    memcpy( &sndbuf[idx], &op, sizeof(op) ); // Opcode
-    idx += sizeof(uint32_t);
-    memcpy( &sndbuf[idx], &ret, sizeof(ret) ); // Result
-    idx += sizeof(uint16_t);
+    // Everything went, start the queue over (on the rings if the attach
+    // reply was the last thing for the socket)
+    if ( conn->out_off == conn->out_len ) {
+	conn->out_off = conn->out_len = 0;
+	if ( conn->shm_next ) {
+	    conn->shm = conn->shm_next;
+	    conn->shm_next = NULL;
+	}
+    }
 
-    // If reading, add block to packet
-    if ( block != NULL ) {
-	memcpy( &sndbuf[idx], block, SMSA_BLOCK_SIZE ); // Result
-	idx += SMSA_BLOCK_SIZE;
+    // Reading may have stopped for the queue to drain, pick it up again
+    if ( (conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT) && (conn->in_len > 0) &&
+	    (smsa_server_process(conn) == -1) ) {
+	return( -1 );
     }
-    
-    // Send the packetx, return the return value
-    logMessage( LOG_INFO_LEVEL, "Sending %d bytes on handle %d", idx, sock );
-    return( smsa_send_bytes(sock, idx, sndbuf) );
+    return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : smsa_send_bytes
-// Description  : Send a specific length of bytes to socket
+// Function     : smsa_server_drain
+// Description  : Write queued replies until they are all gone or the
+//                socket is full
 //
-// Inputs       : sock - the socket filehandle of the clinet connection
-//                len - the number of bytes to send
-//                buf - the buffer to send 
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : conn - the client connection
+// Outputs      : 0 if successful, -1 if the connection is done
 
-int smsa_send_bytes( int sock, int len, unsigned char *buf ) {
+int smsa_server_drain( SMSA_SERVER_CONN *conn ) {
 
     // Local variables
-    int sentBytes = 0, sb;
+    ssize_t sb;
+
+    while ( conn->out_off < conn->out_len ) {
+	sb = smsa_server_send( conn, &conn->out[conn->out_off], conn->out_len-conn->out_off );
+	if ( sb < 0 ) {
+	    if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+		break;
+	    }
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    logMessage( LOG_ERROR_LEVEL, "SMSA send bytes failed : [%s]", strerror(errno) );
+	    return( -1 );
+	}
+	conn->out_off += sb;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_process
+// Description  : Run every complete request in the input buffer, queueing
+//                the replies
+//
+// Inputs       : conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
 
-    // Loop until you have read all the bytes
-    while ( sentBytes < len ) {
+int smsa_server_process( SMSA_SERVER_CONN *conn ) {
 
-	// Read the bytes and check for error
-	if ( (sb = write(sock, &buf[sentBytes], len-sentBytes)) < 0 ) {
-	    logMessage( LOG_ERROR_LEVEL, "SMSA send bytes failed : [%s]", strerror(errno) );
+    // Local variables
+    unsigned char *data, *in, *out;
+    uint16_t len;
+    uint32_t op, id;
+    int16_t ret;
+    size_t idx = 0, need;
+    int sent;
+
+    // SMSA Packet definition in smsa_network.h, the request id is only
+    // echoed back so the client can match the reply
+    while ( (conn->in_len-idx >= SMSA_NET_HEADER_SIZE) &&
+	    (conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT) ) {
+
+	// Get the header, convert to host byte order
+	memcpy( &len, &conn->in[idx], sizeof(uint16_t) );
+	len = ntohs( len );
+	memcpy( &op, &conn->in[idx+sizeof(uint16_t)], sizeof(uint32_t) );
+	op = ntohl( op );
+	memcpy( &ret, &conn->in[idx+sizeof(uint16_t)+sizeof(uint32_t)], sizeof(int16_t) );
+	ret = ntohs( ret );
+	memcpy( &id, &conn->in[idx+sizeof(uint16_t)+sizeof(uint32_t)+sizeof(uint16_t)], sizeof(uint32_t) );
+	id = ntohl( id );
+
+	// Check the length before waiting for that many bytes
+	if ( ! smsa_server_framed(op, len) ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA bad packet length [%u] from [%s]", len, conn->name );
 	    smsa_error_number = SMSA_NET_ERROR;
 	    return( -1 );
 	}
 
-	// Check for closed file
-	else if ( sb == 0 ) {
-	    // Close file, not an error
-	    logMessage( LOG_ERROR_LEVEL, "SMSA client socket closed on snd : [%s]", strerror(errno) );
+	// Wait for the rest of the packet, making room for a big extent
+	if ( conn->in_len-idx < len ) {
+	    if ( len > conn->in_cap ) {
+		memmove( conn->in, &conn->in[idx], conn->in_len-idx );
+		conn->in_len -= idx;
+		idx = 0;
+		if ( (in = realloc(conn->in, len)) == NULL ) {
+		    logMessage( LOG_ERROR_LEVEL, "SMSA unable to grow request buffer for [%s]", conn->name );
+		    return( -1 );
+		}
+		conn->in = in;
+		conn->in_cap = len;
+	    }
+	    break;
+	}
+	logMessage( LOG_INFO_LEVEL, "Received %d bytes on handle %d", len, conn->sock );
+
+	// Writes take their blocks straight from the packet
+	data = (len > SMSA_NET_HEADER_SIZE) ? &conn->in[idx+SMSA_NET_HEADER_SIZE] : NULL;
+	idx += len;
+
+	// Move the client to its shared memory after the reply
+	if ( SMSA_OPCODE(op) == SMSA_NET_ATTACH ) {
+	    ret = smsa_server_attach( conn, data, conn->in_len-idx );
+	    if ( (smsa_server_reserve(conn, SMSA_NET_HEADER_SIZE) == NULL) ||
+		    (smsa_server_queue(conn, op, ret, id, SMSA_NET_HEADER_SIZE) == -1) ) {
+		return( -1 );
+	    }
+	    continue;
+	}
+
+	// A batch runs all its operations and sends back one reply
+	if ( SMSA_OPCODE(op) == SMSA_NET_BATCH ) {
+	    if ( smsa_server_batch(conn, op, id, data, len-SMSA_NET_HEADER_SIZE) == -1 ) {
+		return( -1 );
+	    }
+	    continue;
+	}
+
+	// Big reads may go to the socket straight from the array
+	if ( conn->zc && ! conn->zc_copying && (SMSA_OPCODE(op) == SMSA_DISK_READ_EXTENT) &&
+		(smsa_server_payload(op, 1) >= SMSA_SERVER_ZC_MIN) ) {
+	    if ( (sent = smsa_server_zerocopy_read(conn, op, id)) == -1 ) {
+		return( -1 );
+	    }
+	    if ( sent ) {
+		continue;
+	    }
+	}
+
+	// Reads go straight into the reply queue after the room for the
+	// header, so a block is only copied out of the array once
+	need = SMSA_NET_HEADER_SIZE+smsa_server_payload(op, 1);
+	if ( (out = smsa_server_reserve(conn, need)) == NULL ) {
 	    return( -1 );
 	}
+	if ( need > SMSA_NET_HEADER_SIZE ) {
+	    data = &out[SMSA_NET_HEADER_SIZE];
+	}
 
-	// Now process what we read
-	sentBytes += sb;
+	// Now process the received  data, queue the response
+	ret = smsa_server_run( conn, op, data );
+	if ( smsa_server_queue(conn, op, ret, id, need) == -1 ) {
+	    return( -1 );
+	}
     }
 
-    // Return successsfully
+    // Keep any partial packet at the front of the buffer
+    if ( idx > 0 ) {
+	memmove( conn->in, &conn->in[idx], conn->in_len-idx );
+	conn->in_len -= idx;
+    }
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : smsa_read_bytes
-// Description  : Recevie a specific length of bytes form socket
+// Function     : smsa_server_framed
+// Description  : Check a request is as long as its opcode makes it: only
+//                the bytes being written follow the header, a batch holds
+//                at least the opcodes of its operations and an attach the
+//                segment name
+//
+// Inputs       : op - the opcode
+//                len - the length of the packet
+// Outputs      : 1 if the length is right, 0 if not
+
+int smsa_server_framed( uint32_t op, uint16_t len ) {
+
+    switch ( SMSA_OPCODE(op) ) {
+
+	case SMSA_NET_BATCH: // The operations, at least four bytes each
+	    return( (SMSA_EXTENTLEN(op) > 0) &&
+		    (len >= SMSA_NET_HEADER_SIZE+SMSA_EXTENTLEN(op)*sizeof(uint32_t)) );
+
+	case SMSA_NET_ATTACH: // The segment name
+	    return( len == SMSA_NET_HEADER_SIZE+SMSA_SHM_NAME_SIZE );
+    }
+    return( len == SMSA_NET_HEADER_SIZE+smsa_server_payload(op, 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_attach
+// Description  : Map the shared memory a client made, the connection moves
+//                to it once the reply has gone on the socket
 //
-// Inputs       : sock - the socket filehandle of the clinet connection
-//                len - the number of bytes to be read
-//                buf - the buffer to read into 
+// Inputs       : conn - the client connection
+//                name - the segment name
+//                rest - bytes the client sent on the socket after it
 // Outputs      : 0 if successful, -1 if failure
 
-int smsa_read_bytes( int sock, int len, unsigned char *buf ) {
+int smsa_server_attach( SMSA_SERVER_CONN *conn, unsigned char *name, size_t rest ) {
 
-    // Local variables
-    int readBytes = 0, rb;
+    // Only once, with nothing left to go either way on the socket (the
+    // io_uring loop only serves sockets)
+    if ( (conn->shm != NULL) || (conn->shm_next != NULL) || (rest > 0) || (conn->out_off < conn->out_len) ||
+	    smsa_server_use_uring ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA attach out of order from [%s]", conn->name );
+	return( -1 );
+    }
+    if ( (conn->shm_next = smsa_shm_attach((char *)name)) == NULL ) {
+	return( -1 );
+    }
+    logMessage( LOG_INFO_LEVEL, "Server client [%s] attached shared memory", conn->name );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_recv
+// Description  : Read what the client sent, like read(2) on its socket.
+//                An empty request ring is marked so before giving up, so
+//                the next request rings the doorbell.
+//
+// Inputs       : conn - the client connection
+//                buf - where the bytes go
+//                len - the most to take
+// Outputs      : the number of bytes, -1 with errno set if none
 
-    // Loop until you have read all the bytes
-    while ( readBytes < len ) {
+ssize_t smsa_server_recv( SMSA_SERVER_CONN *conn, unsigned char *buf, size_t len ) {
 
-	// Read the bytes and check for error
-	if ( (rb = read(sock, &buf[readBytes], len-readBytes)) < 0 ) {
-	    // Check for client error on read
-	    logMessage( LOG_ERROR_LEVEL, "SMSA read bytes failed : [%s]", strerror(errno) );
-	    smsa_error_number = SMSA_NET_ERROR;
+    // Local variables
+    uint32_t rb;
+
+    if ( conn->shm == NULL ) {
+	return( read(conn->sock, buf, len) );
+    }
+    while ( (rb = smsa_shm_get(&conn->shm->req, buf, len)) == 0 ) {
+	if ( smsa_shm_idle(&conn->shm->req, 0) ) {
+	    errno = EAGAIN;
 	    return( -1 );
 	}
+    }
 
-	// Check for closed file
-	else if ( rb == 0 ) {
-	    // Close file, not an error
-	    logMessage( LOG_ERROR_LEVEL, "SMSA client socket closed on rd : [%s]", strerror(errno) );
+    // The client may be waiting for room to send more
+    if ( smsa_shm_notify(&conn->shm->req, 0) ) {
+	smsa_shm_wake( &conn->shm->req.head );
+    }
+    return( rb );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_send
+// Description  : Send replies to the client, like write(2) on its socket.
+//                A full reply ring is marked so before giving up, so the
+//                client rings the doorbell when it makes room.
+//
+// Inputs       : conn - the client connection
+//                buf - the bytes
+//                len - the number of them
+// Outputs      : the number of bytes sent, -1 with errno set if none
+
+ssize_t smsa_server_send( SMSA_SERVER_CONN *conn, unsigned char *buf, size_t len ) {
+
+    // Local variables
+    uint32_t sb;
+
+    if ( conn->shm == NULL ) {
+	return( write(conn->sock, buf, len) );
+    }
+    while ( (sb = smsa_shm_put(&conn->shm->rep, buf, len)) == 0 ) {
+	if ( smsa_shm_idle(&conn->shm->rep, 1) ) {
+	    errno = EAGAIN;
 	    return( -1 );
 	}
-
-	// Now process what we read
-	readBytes += rb;
     }
 
-    // Return successsfully
-    return( 0 );
+    // The client may be asleep waiting for these
+    if ( smsa_shm_notify(&conn->shm->rep, 1) ) {
+	smsa_shm_wake( &conn->shm->rep.tail );
+    }
+    return( sb );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : smsa_wait_read
-// Description  : Wait for user input on the socket
+// Function     : smsa_server_batch
+// Description  : Run the operations of a batch frame in order and queue
+//                one reply for all of them.  The frame holds each opcode
+//                followed by the blocks it writes, the reply holds every
+//                return code and then the blocks each operation read.
 //
-// Inputs       : sock - the socket to write on
+// Inputs       : conn - the client connection
+//                op - the opcode of the frame (how many operations)
+//                id - the client's request id
+//                data - the operations, after the header
+//                size - the number of bytes of them
 // Outputs      : 0 if successful, -1 if failure
-
-int smsa_wait_read( int sock ) {
+int smsa_server_batch( SMSA_SERVER_CONN *conn, uint32_t op, uint32_t id, unsigned char *data, size_t size ) {
 
     // Local variables
-    fd_set rfds;
-    int nfds, ret;
+    unsigned char *out, *rets, *blk, *sub_data;
+    uint32_t count = SMSA_EXTENTLEN(op), sub, i, bytes = 0;
+    size_t pos = 0, need;
+    int16_t ret, failed = 0;
+
+    // Check the frame holds exactly its operations, and no batches
+    for ( i=0; i<count; i++ ) {
+	if ( size-pos < sizeof(uint32_t) ) {
+	    break;
+	}
+	memcpy( &sub, &data[pos], sizeof(uint32_t) );
+	sub = ntohl( sub );
+	if ( SMSA_OPCODE(sub) == SMSA_NET_BATCH ) {
+	    break;
+	}
+	pos += sizeof(uint32_t)+smsa_server_payload(sub, 0);
+	if ( pos > size ) {
+	    break;
+	}
+	bytes += smsa_server_payload( sub, 1 );
+    }
+    need = SMSA_NET_HEADER_SIZE+count*sizeof(int16_t)+bytes;
+    if ( (i < count) || (pos != size) || (need > SMSA_NET_MAX_FRAME) ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA bad batch of [%u] operations from [%s]", count, conn->name );
+	smsa_error_number = SMSA_NET_ERROR;
+	return( -1 );
+    }
 
-    // Setup and perform the select
-    nfds = sock + 1;
-    FD_ZERO( &rfds );
-    FD_SET( sock, &rfds );
-    ret = select( nfds, &rfds, NULL, NULL, NULL );
+    // The blocks read go straight into the reply
+    if ( (out = smsa_server_reserve(conn, need)) == NULL ) {
+	return( -1 );
+    }
+    rets = &out[SMSA_NET_HEADER_SIZE];
+    blk = &rets[count*sizeof(int16_t)];
+
+    // Run the operations in order, the last failure is the frame's
+    for ( i=0, pos=0; i<count; i++ ) {
+	memcpy( &sub, &data[pos], sizeof(uint32_t) );
+	sub = ntohl( sub );
+	pos += sizeof(uint32_t);
+	if ( smsa_server_payload(sub, 0) > 0 ) {
+	    sub_data = &data[pos];
+	    pos += smsa_server_payload(sub, 0);
+	} else if ( smsa_server_payload(sub, 1) > 0 ) {
+	    sub_data = blk;
+	    blk += smsa_server_payload(sub, 1);
+	} else {
+	    sub_data = NULL;
+	}
+	if ( (ret = smsa_server_run(conn, sub, sub_data)) != 0 ) {
+	    failed = ret;
+	}
+	ret = htons( ret );
+	memcpy( &rets[i*sizeof(int16_t)], &ret, sizeof(int16_t) );
+    }
 
-    // Check the return value
-    if ( ret == -1 ) {
-	logMessage( LOG_ERROR_LEVEL, "SMSA select() failed : [%s]", strerror(errno) );
-	smsa_error_number = SMSA_NET_ERROR;
+    // Now the header, the reply is already in place
+    return( smsa_server_queue(conn, op, failed, id, need) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_zerocopy_read
+// Description  : Run an extent read by pinning its blocks on the array and
+//                sending them from there with MSG_ZEROCOPY.  That only
+//                keeps the replies in order with none queued before it,
+//                so the queue is written out first; if it does not all go
+//                the read is left to the usual path.  Whatever part of the
+//                reply the socket does not take now is copied to the queue.
+//
+// Inputs       : conn - the client connection
+//                op - the extent read
+//                id - the client's request id
+// Outputs      : 1 if the read was run, 0 if it was not, -1 if failure
+
+int smsa_server_zerocopy_read( SMSA_SERVER_CONN *conn, uint32_t op, uint32_t id ) {
+
+    // Local variables
+    unsigned char header[SMSA_NET_HEADER_SIZE], *out;
+    struct iovec iov[1+SMSA_MAX_PINS];
+    struct msghdr msg;
+    SMSA_SERVER_ZC *zc;
+    size_t need = SMSA_NET_HEADER_SIZE+smsa_server_payload(op, 1), off, skip;
+    ssize_t sb;
+    int i;
+
+    // Only on the socket, with room to track the send (sends the kernel
+    // finished may not have been reaped yet)
+    if ( conn->shm || conn->shm_next ) {
+	return( 0 );
+    }
+    if ( (conn->zc_count == SMSA_SERVER_ZC_MAX) && (smsa_server_zerocopy_reap(conn) == -1) ) {
 	return( -1 );
     }
+    if ( conn->zc_count == SMSA_SERVER_ZC_MAX ) {
+	return( 0 );
+    }
 
-    // check to make sure we are selected on the read
-    if ( FD_ISSET( sock, &rfds ) == 0 ) {
-	logMessage( LOG_ERROR_LEVEL, "SMSA select() returned without selecting FD : [%d]", sock );
-	smsa_error_number = SMSA_NET_ERROR;
+    // The replies before this one go first
+    if ( smsa_server_drain(conn) == -1 ) {
 	return( -1 );
     }
+    if ( conn->out_off < conn->out_len ) {
+	return( 0 );
+    }
+    conn->out_off = conn->out_len = 0;
 
-    // Return successsfully
-    return( 0 );
+    // Pin the blocks instead of reading them, a failed read still gets a
+    // reply of the full length
+    zc = &conn->zc_flight[conn->zc_count];
+    if ( (zc->pinned = smsa_operation_pin(&conn->session, op, zc->pins)) == -1 ) {
+	if ( smsa_server_reserve(conn, need) == NULL ) {
+	    return( -1 );
+	}
+	return( (smsa_server_queue(conn, op, -1, id, need) == -1) ? -1 : 1 );
+    }
+
+    // The header and the pinned blocks in one send
+    smsa_server_header( header, need, op, 0, id );
+    iov[0].iov_base = header;
+    iov[0].iov_len = SMSA_NET_HEADER_SIZE;
+    for ( i=0; i<zc->pinned; i++ ) {
+	iov[i+1].iov_base = zc->pins[i].data;
+	iov[i+1].iov_len = zc->pins[i].len;
+    }
+    memset( &msg, 0x0, sizeof(msg) );
+    msg.msg_iov = iov;
+    msg.msg_iovlen = zc->pinned+1;
+    do {
+	sb = sendmsg( conn->sock, &msg, MSG_ZEROCOPY );
+    } while ( (sb == -1) && (errno == EINTR) );
+    if ( (sb == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS) ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA send bytes failed : [%s]", strerror(errno) );
+	smsa_server_zerocopy_release( zc );
+	return( -1 );
+    }
+    logMessage( LOG_INFO_LEVEL, "Sending %lu bytes on handle %d", need, conn->sock );
+    sb = (sb == -1) ? 0 : sb;
+
+    // The rest waits in the queue like any other reply
+    if ( (size_t)sb < need ) {
+	if ( (out = smsa_server_reserve(conn, need-sb)) == NULL ) {
+	    smsa_server_zerocopy_release( zc );
+	    return( -1 );
+	}
+	for ( i=0, off=0; i<=zc->pinned; off+=iov[i].iov_len, i++ ) {
+	    if ( off+iov[i].iov_len > (size_t)sb ) {
+		skip = ((size_t)sb > off) ? sb-off : 0;
+		memcpy( out, (unsigned char *)iov[i].iov_base+skip, iov[i].iov_len-skip );
+		out += iov[i].iov_len-skip;
+	    }
+	}
+	conn->out_len += need-sb;
+    }
+
+    // The kernel has the blocks until it says otherwise, unless it took none
+    if ( sb == 0 ) {
+	smsa_server_zerocopy_release( zc );
+	return( 1 );
+    }
+    zc->seq = conn->zc_seq++;
+    conn->zc_count ++;
+    conn->zc_sends ++;
+    return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_zerocopy_reap
+// Description  : Take the kernel's notices of finished zero-copy sends off
+//                the socket's error queue and give back their pins.  Each
+//                notice covers a range of send numbers.  If the kernel had
+//                to copy them after all (loopback does, as do devices that
+//                cannot gather) pinning only costs, so the client's reads
+//                go back to the queue.
+//
+// Inputs       : conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_zerocopy_reap( SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)+sizeof(struct sockaddr_in6))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    uint32_t lo, hi;
+    int i, kept;
+
+    while ( 1 ) {
+	memset( &msg, 0x0, sizeof(msg) );
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if ( recvmsg(conn->sock, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) == -1 ) {
+	    if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+		return( 0 );
+	    }
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    logMessage( LOG_ERROR_LEVEL, "SMSA error queue read failed : [%s]", strerror(errno) );
+	    return( -1 );
+	}
+
+	for ( cm=CMSG_FIRSTHDR(&msg); cm!=NULL; cm=CMSG_NXTHDR(&msg, cm) ) {
+	    if ( ! (((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) ||
+		    ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))) ) {
+		continue;
+	    }
+	    serr = (struct sock_extended_err *)CMSG_DATA( cm );
+	    if ( (serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) ) {
+		continue;
+	    }
+	    lo = serr->ee_info;
+	    hi = serr->ee_data;
+	    if ( serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) {
+		conn->zc_copied += hi-lo+1;
+		conn->zc_copying = 1;
+	    }
+
+	    // Give back the pins of the sends in the range, keep the rest
+	    for ( i=0, kept=0; i<conn->zc_count; i++ ) {
+		if ( conn->zc_flight[i].seq-lo <= hi-lo ) {
+		    smsa_server_zerocopy_release( &conn->zc_flight[i] );
+		} else {
+		    conn->zc_flight[kept++] = conn->zc_flight[i];
+		}
+	    }
+	    conn->zc_count = kept;
+	}
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_zerocopy_release
+// Description  : Give back the pins of a zero-copy send
+//
+// Inputs       : zc - the send
+// Outputs      : none
+
+void smsa_server_zerocopy_release( SMSA_SERVER_ZC *zc ) {
+
+    // Local variables
+    int i;
+
+    for ( i=0; i<zc->pinned; i++ ) {
+	smsa_unpin( &zc->pins[i] );
+    }
+    zc->pinned = 0;
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_run
+// Description  : Run one client operation against the array
+//
+// Inputs       : conn - the client connection
+//                op - the opcode to run
+//                block - the blocks written or the place to read into
+// Outputs      : the return code of the operation
+
+int smsa_server_run( SMSA_SERVER_CONN *conn, uint32_t op, unsigned char *block ) {
+
+    // Local variables
+    int16_t ret;
+
+    ret = smsa_operation( &conn->session, op, block );
+    if ( SMSA_OPCODE(op) == SMSA_UNMOUNT ) {
+	logMessage( LOG_INFO_LEVEL, "Cycle count at unmount [%lu]", smsa_get_cycle_count() );
+	logMessage( LOG_INFO_LEVEL, "Session cycle count at unmount [%lu] for [%s]",
+		conn->session.cycle_count, conn->name );
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_queue
+// Description  : Add a reply packet to the end of the output queue.  The
+//                caller reserved its room and put any blocks read after
+//                the header, only the header is left to write.
+//
+// Inputs       : conn - the client connection
+//                op - the opcode that was run
+//                ret - return value to return
+//                id - the client's request id
+//                len - the length of the whole packet
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_queue( SMSA_SERVER_CONN *conn, uint32_t op, int16_t ret, uint32_t id, size_t len ) {
+
+    // The room has to be there already
+    if ( conn->out_cap-conn->out_len < len ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA reply queued without room for [%s]", conn->name );
+	return( -1 );
+    }
+    smsa_server_header( &conn->out[conn->out_len], len, op, ret, id );
+    conn->out_len += len;
+    logMessage( LOG_INFO_LEVEL, "Sending %lu bytes on handle %d", len, conn->sock );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_reserve
+// Description  : Make room for need more bytes at the end of the output
+//                queue, the caller fills them and adds them to out_len
+//
+// Inputs       : conn - the client connection
+//                need - the number of bytes
+// Outputs      : where the bytes go, NULL if failure
+
+unsigned char *smsa_server_reserve( SMSA_SERVER_CONN *conn, size_t need ) {
+
+    // Local varibles
+    unsigned char *out;
+    size_t cap;
+
+    // Make room, sliding the unsent bytes down before growing
+    if ( conn->out_cap-conn->out_len < need ) {
+	if ( conn->out_off > 0 ) {
+	    memmove( conn->out, &conn->out[conn->out_off], conn->out_len-conn->out_off );
+	    conn->out_len -= conn->out_off;
+	    conn->out_off = 0;
+	}
+	if ( conn->out_cap-conn->out_len < need ) {
+	    cap = (conn->out_cap) ? conn->out_cap*2 : 4*SMSA_NET_MAX_PACKET;
+	    while ( cap-conn->out_len < need ) {
+		cap *= 2;
+	    }
+	    if ( (out = realloc(conn->out, cap)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "SMSA unable to grow reply queue for [%s]", conn->name );
+		return( NULL );
+	    }
+	    conn->out = out;
+	    conn->out_cap = cap;
+	}
+    }
+    return( &conn->out[conn->out_len] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_header
+// Description  : Write a reply header in network byte order
+//
+// Inputs       : out - where the header goes
+//                len - the length of the whole packet
+//                op - the opcode that was run
+//                ret - return value to return
+//                id - the client's request id
+// Outputs      : the number of bytes written
+
+uint32_t smsa_server_header( unsigned char *out, uint16_t len, uint32_t op, int16_t ret, uint32_t id ) {
+
+    // Local varibles
+    uint32_t idx = 0;
+
+    len = htons(len);
+    op = htonl(op);
+    ret = htons(ret);
+    id = htonl(id);
+
+    // Assemble the header
+    memcpy( &out[idx], &len, sizeof(len) ); // Length
+    idx += sizeof(uint16_t);
+    memcpy( &out[idx], &op, sizeof(op) ); // Opcode
+    idx += sizeof(uint32_t);
+    memcpy( &out[idx], &ret, sizeof(ret) ); // Result
+    idx += sizeof(uint16_t);
+    memcpy( &out[idx], &id, sizeof(id) ); // Request
+    idx += sizeof(uint32_t);
+    return( idx );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_payload
+// Description  : Work out how many bytes follow the header of a request
+//                or of its reply
+//
+// Inputs       : op - the opcode
+//                reply - 1 for the reply, 0 for the request
+// Outputs      : the number of bytes
+
+uint32_t smsa_server_payload( uint32_t op, int reply ) {
+
+    switch ( SMSA_OPCODE(op) ) {
+
+	case SMSA_DISK_WRITE: // The block written
+	case SMSA_DISK_WRITE_AT:
+	    return( reply ? 0 : SMSA_BLOCK_SIZE );
+
+	case SMSA_DISK_READ: // The block read, or the drum hashes
+	case SMSA_DISK_READ_AT:
+	case SMSA_GET_STATE:
+	    return( reply ? SMSA_BLOCK_SIZE : 0 );
+
+	case SMSA_DISK_WRITE_EXTENT: // The run of blocks written
+	    return( reply ? 0 : SMSA_EXTENTLEN(op)*SMSA_BLOCK_SIZE );
+
+	case SMSA_DISK_READ_EXTENT: // The run of blocks read
+	    return( reply ? SMSA_EXTENTLEN(op)*SMSA_BLOCK_SIZE : 0 );
+
+	case SMSA_DISK_WRITE_PART: // The bytes written
+	    return( reply ? 0 : SMSA_EXTENTLEN(op) );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_watch
+// Description  : Tell epoll what the connection is waiting for: input
+//                unless too many replies are queued, output while any are.
+//                On shared memory only the doorbell is watched, it rings
+//                for room in the reply ring too.  With workers the watch
+//                is one shot and is always renewed.
+//
+// Inputs       : epfd - the epoll instance
+//                conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_watch( int epfd, SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    struct epoll_event ev;
+    uint32_t events = 0;
+
+    if ( (conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT) || conn->shm ) {
+	events |= EPOLLIN;
+    }
+    if ( (conn->out_off < conn->out_len) && ! conn->shm ) {
+	events |= EPOLLOUT;
+    }
+    if ( smsa_server_workers ) {
+	events |= EPOLLONESHOT;
+    } else if ( events == conn->events ) {
+	return( 0 );
+    }
+
+    memset( &ev, 0x0, sizeof(ev) );
+    ev.events = events;
+    ev.data.ptr = conn;
+    if ( epoll_ctl(epfd, (conn->events) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->sock, &ev) == -1 ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA epoll_ctl() failed for [%s] : [%s]", conn->name, strerror(errno) );
+	return( -1 );
+    }
+    conn->events = events;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_close
+// Description  : Drop a client connection and free its state
+//
+// Inputs       : epfd - the epoll instance
+//                conn - the client connection
+// Outputs      : none
+
+void smsa_server_close( int epfd, SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    int i;
+
+    // A client that leaves without unmounting gives up its hold on the array
+    smsa_close_session( &conn->session );
+
+    // Nobody reads the zero-copy sends the kernel may still have, the
+    // array is free to change under them
+    for ( i=0; i<conn->zc_count; i++ ) {
+	smsa_server_zerocopy_release( &conn->zc_flight[i] );
+    }
+    if ( conn->zc_sends > 0 ) {
+	logMessage( LOG_INFO_LEVEL, "Server client [%s] had [%u] zero-copy sends, [%u] copied by the kernel",
+		conn->name, conn->zc_sends, conn->zc_copied );
+    }
+
+    // Closing the socket takes it out of the epoll set
+    logMessage( LOG_INFO_LEVEL, "Closed client connection [%s]", conn->name );
+    if ( epfd != -1 ) {
+	epoll_ctl( epfd, EPOLL_CTL_DEL, conn->sock, NULL );
+    }
+    close( conn->sock );
+    if ( conn->shm ) {
+	smsa_shm_detach( conn->shm );
+    }
+    if ( conn->shm_next ) {
+	smsa_shm_detach( conn->shm_next );
+    }
+    free( conn->in );
+    free( conn->out );
+    free( conn->sending );
+    free( conn );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_worker
+// Description  : One worker thread, serves the clients the loop hands it
+//                until the server shuts down
+//
+// Inputs       : arg - the epoll instance
+// Outputs      : NULL
+
+void *smsa_server_worker( void *arg ) {
+
+    // Local variables
+    int epfd = (int)(intptr_t)arg;
+    SMSA_SERVER_CONN *conn;
+
+    while ( 1 ) {
+
+	// Wait for a ready client
+	pthread_mutex_lock( &smsa_server_runq_lock );
+	while ( (smsa_server_runq_head == NULL) && (! smsa_server_runq_stop) ) {
+	    pthread_cond_wait( &smsa_server_runq_cond, &smsa_server_runq_lock );
+	}
+	if ( smsa_server_runq_head == NULL ) {
+	    pthread_mutex_unlock( &smsa_server_runq_lock );
+	    return( NULL );
+	}
+	conn = smsa_server_runq_head;
+	if ( (smsa_server_runq_head = conn->next) == NULL ) {
+	    smsa_server_runq_tail = NULL;
+	}
+	pthread_mutex_unlock( &smsa_server_runq_lock );
+
+	// The client's operations run here, in order
+	smsa_server_handle( epfd, conn );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring
+// Description  : The io_uring server loop.  One multishot accept takes
+//                every new client and one multishot receive per client
+//                fills buffers the kernel picks from a ring we share with
+//                it, so nothing is re-armed per packet.  The operations in
+//                what arrives run as soon as its completion is seen (they
+//                never block) and their replies become a send queued right
+//                behind them, which the next wait hands to the kernel: one
+//                system call sends every reply and waits for more requests.
+//
+// Inputs       : server - the listening socket
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring( int server ) {
+
+    // Local variables
+    SMSA_SERVER_URING ring;
+    unsigned head;
+    int ret = 0;
+
+    if ( smsa_server_workers ) {
+	logMessage( LOG_WARNING_LEVEL, "SMSA io_uring loop runs the operations itself, ignoring workers" );
+    }
+    if ( smsa_server_uring_setup(&ring) == -1 ) {
+	smsa_error_number = SMSA_NET_ERROR;
+	return( -1 );
+    }
+    if ( smsa_server_uring_accept(&ring, server) == -1 ) {
+	smsa_error_number = SMSA_NET_ERROR;
+	smsa_server_uring_teardown( &ring );
+	return( -1 );
+    }
+    logMessage( LOG_INFO_LEVEL, "Server running on io_uring" );
+
+    // Wait until server is complete
+    while ( ! smsa_server_shutdown ) {
+
+	// Submit what is queued and wait for something to finish
+	if ( smsa_server_uring_enter(&ring, 1) == -1 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    logMessage( LOG_ERROR_LEVEL, "SMSA server wait failued, aborting." );
+	    smsa_error_number = SMSA_NET_ERROR;
+	    ret = -1;
+	    break;
+	}
+
+	// Handle every completion, giving each slot back as we go
+	head = *ring.cq_head;
+	while ( head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) ) {
+	    smsa_server_uring_complete( &ring, &ring.cqes[head & *ring.cq_mask], server );
+	    __atomic_store_n( ring.cq_head, ++head, __ATOMIC_RELEASE );
+	}
+    }
+
+    // Closing the ring cancels what the kernel still has
+    smsa_server_uring_teardown( &ring );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_setup
+// Description  : Create the io_uring, map its queues and give it the
+//                receive buffers
+//
+// Inputs       : ring - the ring state to fill in
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring_setup( SMSA_SERVER_URING *ring ) {
+
+    // Local variables
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    unsigned char *rings;
+    void *mem;
+    size_t sq_len, cq_len;
+    uint16_t i;
+
+    // Only this thread submits, and completions are only needed when it
+    // waits for them (older kernels get a plain ring)
+    memset( ring, 0x0, sizeof(SMSA_SERVER_URING) );
+    memset( &params, 0x0, sizeof(params) );
+    params.flags = IORING_SETUP_SUBMIT_ALL|IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN;
+    if ( (ring->fd = syscall(__NR_io_uring_setup, SMSA_SERVER_URING_ENTRIES, &params)) == -1 ) {
+	memset( &params, 0x0, sizeof(params) );
+	if ( (ring->fd = syscall(__NR_io_uring_setup, SMSA_SERVER_URING_ENTRIES, &params)) == -1 ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA io_uring_setup() failed : [%s]", strerror(errno) );
+	    return( -1 );
+	}
+    }
+    if ( ! (params.features & IORING_FEAT_SINGLE_MMAP) ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA io_uring is too old to use" );
+	close( ring->fd );
+	return( -1 );
+    }
+
+    // Both queues are in one mapping, the entries in another
+    sq_len = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+    cq_len = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+    ring->rings_len = (sq_len > cq_len) ? sq_len : cq_len;
+    mem = mmap( NULL, ring->rings_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+    if ( mem == MAP_FAILED ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to map io_uring : [%s]", strerror(errno) );
+	smsa_server_uring_teardown( ring );
+	return( -1 );
+    }
+    ring->rings = rings = mem;
+    ring->sqes_len = params.sq_entries*sizeof(struct io_uring_sqe);
+    mem = mmap( NULL, ring->sqes_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+    if ( mem == MAP_FAILED ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to map io_uring : [%s]", strerror(errno) );
+	smsa_server_uring_teardown( ring );
+	return( -1 );
+    }
+    ring->sqes = mem;
+    ring->sq_head = (unsigned *)&rings[params.sq_off.head];
+    ring->sq_tail = (unsigned *)&rings[params.sq_off.tail];
+    ring->sq_mask = (unsigned *)&rings[params.sq_off.ring_mask];
+    ring->sq_entries = (unsigned *)&rings[params.sq_off.ring_entries];
+    ring->sq_array = (unsigned *)&rings[params.sq_off.array];
+    ring->cq_head = (unsigned *)&rings[params.cq_off.head];
+    ring->cq_tail = (unsigned *)&rings[params.cq_off.tail];
+    ring->cq_mask = (unsigned *)&rings[params.cq_off.ring_mask];
+    ring->cqes = (struct io_uring_cqe *)&rings[params.cq_off.cqes];
+
+    // The receive buffers, registered as buffer group 0
+    mem = mmap( NULL, SMSA_SERVER_URING_BUFS*sizeof(struct io_uring_buf), PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+    if ( (mem == MAP_FAILED) || ((ring->bufs = malloc(SMSA_SERVER_URING_BUFS*SMSA_SERVER_URING_BUF_SIZE)) == NULL) ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to allocate io_uring buffers" );
+	if ( mem != MAP_FAILED ) {
+	    munmap( mem, SMSA_SERVER_URING_BUFS*sizeof(struct io_uring_buf) );
+	}
+	smsa_server_uring_teardown( ring );
+	return( -1 );
+    }
+    ring->buf_ring = mem;
+    memset( &reg, 0x0, sizeof(reg) );
+    reg.ring_addr = (uintptr_t)ring->buf_ring;
+    reg.ring_entries = SMSA_SERVER_URING_BUFS;
+    reg.bgid = 0;
+    if ( syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1 ) {
+	logMessage( LOG_ERROR_LEVEL, "SMSA unable to register io_uring buffers : [%s]", strerror(errno) );
+	smsa_server_uring_teardown( ring );
+	return( -1 );
+    }
+    for ( i=0; i<SMSA_SERVER_URING_BUFS; i++ ) {
+	smsa_server_uring_give( ring, i );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_teardown
+// Description  : Close the io_uring and free what it used
+//
+// Inputs       : ring - the ring state
+// Outputs      : none
+
+void smsa_server_uring_teardown( SMSA_SERVER_URING *ring ) {
+
+    close( ring->fd );
+    if ( ring->sqes ) {
+	munmap( ring->sqes, ring->sqes_len );
+    }
+    if ( ring->rings ) {
+	munmap( ring->rings, ring->rings_len );
+    }
+    if ( ring->buf_ring ) {
+	munmap( ring->buf_ring, SMSA_SERVER_URING_BUFS*sizeof(struct io_uring_buf) );
+    }
+    free( ring->bufs );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_sqe
+// Description  : Take the next submission queue entry, submitting what is
+//                queued first if it is full.  The kernel only reads an
+//                entry when it is submitted, so the caller fills it in
+//                before anything else touches the ring.
+//
+// Inputs       : ring - the ring state
+// Outputs      : the cleared entry, NULL if failure
+
+struct io_uring_sqe *smsa_server_uring_sqe( SMSA_SERVER_URING *ring ) {
+
+    // Local variables
+    struct io_uring_sqe *sqe;
+    unsigned tail = *ring->sq_tail, idx;
+
+    if ( tail-__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries ) {
+	if ( (smsa_server_uring_enter(ring, 0) == -1) ||
+		(tail-__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries) ) {
+	    logMessage( LOG_ERROR_LEVEL, "SMSA io_uring submission queue full" );
+	    return( NULL );
+	}
+    }
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset( sqe, 0x0, sizeof(struct io_uring_sqe) );
+    ring->sq_array[idx] = idx;
+    __atomic_store_n( ring->sq_tail, tail+1, __ATOMIC_RELEASE );
+    ring->pending++;
+    return( sqe );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_enter
+// Description  : Submit the queued entries, and wait for a completion
+//
+// Inputs       : ring - the ring state
+//                wait - 1 to wait for a completion, 0 to only submit
+// Outputs      : 0 if successful, -1 if failure (errno set)
+
+int smsa_server_uring_enter( SMSA_SERVER_URING *ring, int wait ) {
+
+    // Local variables
+    int ret;
+
+    ret = syscall( __NR_io_uring_enter, ring->fd, ring->pending, (wait) ? 1 : 0,
+	    (wait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+    if ( ret == -1 ) {
+	return( -1 );
+    }
+    ring->pending -= ret;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_give
+// Description  : Give a receive buffer (back) to the kernel
+//
+// Inputs       : ring - the ring state
+//                bid - the buffer id
+// Outputs      : none
+
+void smsa_server_uring_give( SMSA_SERVER_URING *ring, uint16_t bid ) {
+
+    // Local variables
+    struct io_uring_buf *buf;
+
+    // The tail shares the first slot, so only fill the buffer fields
+    buf = &ring->buf_ring->bufs[ring->buf_ring->tail & (SMSA_SERVER_URING_BUFS-1)];
+    buf->addr = (uintptr_t)&ring->bufs[bid*SMSA_SERVER_URING_BUF_SIZE];
+    buf->len = SMSA_SERVER_URING_BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n( &ring->buf_ring->tail, ring->buf_ring->tail+1, __ATOMIC_RELEASE );
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_accept
+// Description  : Start accepting clients, until the kernel says it stopped
+//
+// Inputs       : ring - the ring state
+//                server - the listening socket
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring_accept( SMSA_SERVER_URING *ring, int server ) {
+
+    // Local variables
+    struct io_uring_sqe *sqe;
+
+    if ( (sqe = smsa_server_uring_sqe(ring)) == NULL ) {
+	return( -1 );
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = SMSA_SERVER_URING_ACCEPT;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_recv
+// Description  : Start receiving from a client into the shared buffers,
+//                until the kernel says it stopped
+//
+// Inputs       : ring - the ring state
+//                conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring_recv( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    struct io_uring_sqe *sqe;
+
+    if ( (sqe = smsa_server_uring_sqe(ring)) == NULL ) {
+	return( -1 );
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sock;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (uintptr_t)conn|SMSA_SERVER_URING_RECV;
+    conn->recv_armed = 1;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_send
+// Description  : Send the queued replies unless a send is already out.
+//                The kernel gets the whole queue and new replies start a
+//                fresh one, so it never moves under the kernel.
+//
+// Inputs       : ring - the ring state
+//                conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring_send( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    struct io_uring_sqe *sqe;
+    unsigned char *buf;
+    size_t cap;
+
+    if ( conn->send_armed || conn->closing ) {
+	return( 0 );
+    }
+
+    // The last send is done, swap the queue in
+    if ( conn->send_off == conn->send_len ) {
+	if ( conn->out_off == conn->out_len ) {
+	    return( 0 );
+	}
+	buf = conn->sending;
+	cap = conn->send_cap;
+	conn->sending = conn->out;
+	conn->send_cap = conn->out_cap;
+	conn->send_off = conn->out_off;
+	conn->send_len = conn->out_len;
+	conn->out = buf;
+	conn->out_cap = cap;
+	conn->out_off = conn->out_len = 0;
+    }
+
+    if ( (sqe = smsa_server_uring_sqe(ring)) == NULL ) {
+	return( -1 );
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->sock;
+    sqe->addr = (uintptr_t)&conn->sending[conn->send_off];
+    sqe->len = conn->send_len-conn->send_off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)conn|SMSA_SERVER_URING_SEND;
+    conn->send_armed = 1;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_run
+// Description  : Run a client's requests and send the replies, keeping its
+//                receive going only while they drain.  Past
+//                SMSA_SERVER_OUT_LIMIT the multishot receive is cancelled
+//                (as epoll drops EPOLLIN), it is started again once a
+//                send takes the queue down and the requests held back
+//                have run.
+//
+// Inputs       : ring - the ring state
+//                conn - the client connection
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_uring_run( SMSA_SERVER_URING *ring, SMSA_SERVER_CONN *conn ) {
+
+    // Local variables
+    struct io_uring_sqe *sqe;
+
+    if ( ((conn->in_len > 0) && (smsa_server_process(conn) == -1)) ||
+	    (smsa_server_uring_send(ring, conn) == -1) ) {
+	return( -1 );
+    }
+
+    // A send that took the queue leaves room for what was held back,
+    // only with that run is what is left of in a part of a packet
+    if ( (conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT) && (conn->in_len > 0) &&
+	    ((smsa_server_process(conn) == -1) || (smsa_server_uring_send(ring, conn) == -1)) ) {
+	return( -1 );
+    }
+    if ( conn->out_len-conn->out_off < SMSA_SERVER_OUT_LIMIT ) {
+	if ( ! conn->recv_armed ) {
+	    return( smsa_server_uring_recv(ring, conn) );
+	}
+	return( 0 );
+    }
+
+    // Full, stop the receive (its last completion says when it has)
+    if ( conn->recv_armed && ! conn->recv_held ) {
+	if ( (sqe = smsa_server_uring_sqe(ring)) == NULL ) {
+	    return( -1 );
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uintptr_t)conn|SMSA_SERVER_URING_RECV;
+	sqe->user_data = SMSA_SERVER_URING_CANCEL;
+	conn->recv_held = 1;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_complete
+// Description  : Handle one completion: a new client, requests to run or
+//                replies sent
+//
+// Inputs       : ring - the ring state
+//                cqe - the completion
+//                server - the listening socket
+// Outputs      : none
+
+void smsa_server_uring_complete( SMSA_SERVER_URING *ring, struct io_uring_cqe *cqe, int server ) {
+
+    // Local variables
+    SMSA_SERVER_CONN *conn = (SMSA_SERVER_CONN *)(uintptr_t)(cqe->user_data & ~(uint64_t)3);
+    int what = cqe->user_data & 3, res = cqe->res;
+    uint32_t flags = cqe->flags;
+    struct sockaddr_in caddr;
+    socklen_t inet_len = sizeof(caddr);
+    unsigned char *in;
+    size_t cap;
+    uint16_t bid;
+
+    switch ( what ) {
+
+	case SMSA_SERVER_URING_ACCEPT: // A new client
+	    if ( res >= 0 ) {
+		if ( (getpeername(res, (struct sockaddr *)&caddr, &inet_len) == -1) ||
+			((conn = smsa_server_new_conn(res, &caddr)) == NULL) ) {
+		    close( res );
+		} else if ( smsa_server_uring_recv(ring, conn) == -1 ) {
+		    smsa_server_close( -1, conn );
+		} else {
+		    logMessage( LOG_INFO_LEVEL, "Server new client connection [%s]", conn->name );
+		}
+	    } else if ( (res != -EMFILE) && (res != -ENFILE) && (res != -ECONNABORTED) && (res != -EINTR) ) {
+		logMessage( LOG_ERROR_LEVEL, "SMSA server accept failued, aborting." );
+		smsa_error_number = SMSA_NET_ERROR;
+		smsa_server_shutdown = 1;
+		return;
+	    } else {
+		logMessage( LOG_ERROR_LEVEL, "SMSA accept failed : [%s]", strerror(-res) );
+	    }
+	    if ( ! (flags & IORING_CQE_F_MORE) ) {
+		smsa_server_uring_accept( ring, server );
+	    }
+	    return;
+
+	case SMSA_SERVER_URING_CANCEL: // The receive is stopped, its own completion follows
+	    return;
+
+	case SMSA_SERVER_URING_RECV: // Requests from a client
+	    if ( ! (flags & IORING_CQE_F_MORE) ) {
+		conn->recv_armed = 0;
+		conn->recv_held = 0;
+	    }
+
+	    // Take the bytes out of the kernel's buffer and give it back
+	    if ( flags & IORING_CQE_F_BUFFER ) {
+		bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if ( (res > 0) && ! conn->closing ) {
+		    if ( conn->in_len+res > SMSA_SERVER_URING_IN_LIMIT ) {
+			logMessage( LOG_ERROR_LEVEL, "SMSA too many unrun request bytes from [%s]", conn->name );
+			smsa_server_uring_drop( conn );
+		    } else if ( conn->in_cap-conn->in_len < (size_t)res ) {
+			cap = conn->in_cap*2;
+			while ( cap-conn->in_len < (size_t)res ) {
+			    cap *= 2;
+			}
+			if ( (in = realloc(conn->in, cap)) == NULL ) {
+			    logMessage( LOG_ERROR_LEVEL, "SMSA unable to grow request buffer for [%s]", conn->name );
+			    smsa_server_uring_drop( conn );
+			} else {
+			    conn->in = in;
+			    conn->in_cap = cap;
+			}
+		    }
+		    if ( ! conn->closing ) {
+			memcpy( &conn->in[conn->in_len], &ring->bufs[bid*SMSA_SERVER_URING_BUF_SIZE], res );
+			conn->in_len += res;
+		    }
+		}
+		smsa_server_uring_give( ring, bid );
+	    }
+	    if ( conn->closing ) {
+		break;
+	    }
+	    if ( res == 0 ) {
+		logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->name );
+		smsa_server_uring_drop( conn );
+		break;
+	    }
+	    if ( (res < 0) && (res != -ENOBUFS) && (res != -ECANCELED) ) {
+		logMessage( LOG_ERROR_LEVEL, "SMSA read bytes failed : [%s]", strerror(-res) );
+		smsa_server_uring_drop( conn );
+		break;
+	    }
+
+	    // Run what came in, the replies go out with the next wait
+	    if ( smsa_server_uring_run(ring, conn) == -1 ) {
+		smsa_server_uring_drop( conn );
+	    }
+	    break;
+
+	case SMSA_SERVER_URING_SEND: // Replies the kernel took
+	    conn->send_armed = 0;
+	    if ( conn->closing ) {
+		break;
+	    }
+	    if ( res < 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "SMSA send bytes failed : [%s]", strerror(-res) );
+		smsa_server_uring_drop( conn );
+		break;
+	    }
+	    conn->send_off += res;
+
+	    // A full queue may have held requests back, run them now
+	    if ( smsa_server_uring_run(ring, conn) == -1 ) {
+		smsa_server_uring_drop( conn );
+	    }
+	    break;
+    }
+
+    // A dropped client goes once the kernel has nothing of it left
+    if ( conn->closing && ! conn->recv_armed && ! conn->send_armed ) {
+	smsa_server_close( -1, conn );
+    }
+    return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_uring_drop
+// Description  : Drop a client on the io_uring loop.  Shutting the socket
+//                ends what the kernel is doing with it, the connection is
+//                freed when those completions are in.
+//
+// Inputs       : conn - the client connection
+// Outputs      : none
+
+void smsa_server_uring_drop( SMSA_SERVER_CONN *conn ) {
+
+    conn->closing = 1;
+    shutdown( conn->sock, SHUT_RDWR );
+    return;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
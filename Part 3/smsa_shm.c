@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_shm.c
+//  Description    : This is the shared memory transport for SMSA clients on
+//                   the same host as the server.
+//
+//   Author        : Mohanish Sheth
+//
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <cmpsc311_log.h>
+
+// Project Include Files
+#include <smsa_shm.h>
+
+// GlobalVariable
+uint32_t ShmSegments = 0;  // Segments created by this process, for their names
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_create
+// Description  : Create a new segment with empty rings
+//
+// Inputs       : name - where to put the segment name (SMSA_SHM_NAME_SIZE)
+// Outputs      : the mapped segment, NULL if failure
+
+SMSA_SHM_SEGMENT *smsa_shm_create( char *name ) {
+
+	// Local variables
+	SMSA_SHM_SEGMENT *seg;
+	int fd;
+
+	// A name nobody else is using, the new segment is all zeros
+	snprintf( name, SMSA_SHM_NAME_SIZE, "%s%d-%u", SMSA_SHM_PREFIX, getpid(),
+		__atomic_fetch_add(&ShmSegments, 1, __ATOMIC_RELAXED) );
+	if ( (fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to create shared memory [%s] : [%s]", name, strerror(errno) );
+		return( NULL );
+	}
+	if ( ftruncate(fd, sizeof(SMSA_SHM_SEGMENT)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to size shared memory [%s] : [%s]", name, strerror(errno) );
+		close( fd );
+		shm_unlink( name );
+		return( NULL );
+	}
+	seg = mmap( NULL, sizeof(SMSA_SHM_SEGMENT), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( seg == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to map shared memory [%s] : [%s]", name, strerror(errno) );
+		shm_unlink( name );
+		return( NULL );
+	}
+
+	// The server starts out asleep, the first request rings the doorbell
+	seg->req.consumer_waiting = 1;
+	seg->magic = SMSA_SHM_MAGIC;
+	return( seg );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_attach
+// Description  : Map the segment a client created, checking it is one
+//
+// Inputs       : name - the segment name (SMSA_SHM_NAME_SIZE bytes)
+// Outputs      : the mapped segment, NULL if failure
+
+SMSA_SHM_SEGMENT *smsa_shm_attach( const char *name ) {
+
+	// Local variables
+	SMSA_SHM_SEGMENT *seg;
+	struct stat st;
+	int fd;
+
+	// Only names a client would have made
+	if ( (memchr(name, '\0', SMSA_SHM_NAME_SIZE) == NULL) ||
+			(strncmp(name, SMSA_SHM_PREFIX, strlen(SMSA_SHM_PREFIX)) != 0) ||
+			(strchr(&name[1], '/') != NULL) ) {
+		logMessage( LOG_ERROR_LEVEL, "Bad shared memory name" );
+		return( NULL );
+	}
+	if ( (fd = shm_open(name, O_RDWR, 0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to open shared memory [%s] : [%s]", name, strerror(errno) );
+		return( NULL );
+	}
+	if ( (fstat(fd, &st) == -1) || (st.st_size != sizeof(SMSA_SHM_SEGMENT)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Shared memory [%s] is the wrong size", name );
+		close( fd );
+		return( NULL );
+	}
+	seg = mmap( NULL, sizeof(SMSA_SHM_SEGMENT), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( seg == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to map shared memory [%s] : [%s]", name, strerror(errno) );
+		return( NULL );
+	}
+	if ( seg->magic != SMSA_SHM_MAGIC ) {
+		logMessage( LOG_ERROR_LEVEL, "Shared memory [%s] was not set up", name );
+		munmap( seg, sizeof(SMSA_SHM_SEGMENT) );
+		return( NULL );
+	}
+	return( seg );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_detach
+// Description  : Unmap a segment
+//
+// Inputs       : seg - the segment
+// Outputs      : none
+
+void smsa_shm_detach( SMSA_SHM_SEGMENT *seg ) {
+	munmap( seg, sizeof(SMSA_SHM_SEGMENT) );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_unlink
+// Description  : Remove the name of a segment once both sides have it
+//                mapped, so nothing is left behind when they go
+//
+// Inputs       : name - the segment name
+// Outputs      : none
+
+void smsa_shm_unlink( const char *name ) {
+	shm_unlink( name );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_put
+// Description  : Copy as much of the data into the ring as fits
+//
+// Inputs       : ring - the ring (this side produces)
+//                data - the bytes
+//                len - the number of them
+// Outputs      : the number of bytes copied
+
+uint32_t smsa_shm_put( SMSA_SHM_RING *ring, const unsigned char *data, uint32_t len ) {
+
+	// Local variables
+	uint32_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+	uint32_t tail = ring->tail, off, first;
+
+	// Copy what fits, wrapping at the end
+	if ( len > SMSA_SHM_RING_SIZE-(tail-head) ) {
+		len = SMSA_SHM_RING_SIZE-(tail-head);
+	}
+	off = tail&(SMSA_SHM_RING_SIZE-1);
+	first = (len < SMSA_SHM_RING_SIZE-off) ? len : SMSA_SHM_RING_SIZE-off;
+	memcpy( &ring->data[off], data, first );
+	memcpy( ring->data, &data[first], len-first );
+
+	// The bytes are there before the consumer sees the new tail
+	__atomic_store_n( &ring->tail, tail+len, __ATOMIC_RELEASE );
+	return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_get
+// Description  : Copy as much of the data out of the ring as there is
+//
+// Inputs       : ring - the ring (this side consumes)
+//                data - where the bytes go
+//                len - the most to take
+// Outputs      : the number of bytes copied
+
+uint32_t smsa_shm_get( SMSA_SHM_RING *ring, unsigned char *data, uint32_t len ) {
+
+	// Local variables
+	uint32_t tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+	uint32_t head = ring->head, off, first;
+
+	// Copy what is there, wrapping at the end
+	if ( len > tail-head ) {
+		len = tail-head;
+	}
+	off = head&(SMSA_SHM_RING_SIZE-1);
+	first = (len < SMSA_SHM_RING_SIZE-off) ? len : SMSA_SHM_RING_SIZE-off;
+	memcpy( data, &ring->data[off], first );
+	memcpy( &data[first], ring->data, len-first );
+
+	// The bytes are out before the producer may reuse them
+	__atomic_store_n( &ring->head, head+len, __ATOMIC_RELEASE );
+	return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_idle
+// Description  : Say this side is about to sleep on the ring, then look at
+//                it again in case the other side moved before seeing that.
+//                The other side clears the flag when it wakes this one.
+//
+// Inputs       : ring - the ring
+//                producer - 1 if this side waits for room, 0 for bytes
+// Outputs      : 1 if this side may sleep, 0 if the ring moved
+
+int smsa_shm_idle( SMSA_SHM_RING *ring, int producer ) {
+
+	// Local variables
+	uint32_t *flag = (producer) ? &ring->producer_waiting : &ring->consumer_waiting;
+	uint32_t head, tail;
+
+	__atomic_store_n( flag, 1, __ATOMIC_SEQ_CST );
+	head = __atomic_load_n( &ring->head, __ATOMIC_SEQ_CST );
+	tail = __atomic_load_n( &ring->tail, __ATOMIC_SEQ_CST );
+	if ( (producer) ? (tail-head < SMSA_SHM_RING_SIZE) : (tail != head) ) {
+		__atomic_store_n( flag, 0, __ATOMIC_RELAXED );
+		return( 0 );
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_notify
+// Description  : After putting or getting bytes, see whether the other side
+//                went to sleep waiting for that
+//
+// Inputs       : ring - the ring
+//                producer - 1 if this side put bytes, 0 if it got them
+// Outputs      : 1 if the other side has to be woken, 0 if not
+
+int smsa_shm_notify( SMSA_SHM_RING *ring, int producer ) {
+
+	// Local variables
+	uint32_t *flag = (producer) ? &ring->consumer_waiting : &ring->producer_waiting;
+
+	// Order the head/tail store before the look at the flag (see idle)
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	if ( ! __atomic_load_n(flag, __ATOMIC_RELAXED) ) {
+		return( 0 );
+	}
+	return( __atomic_exchange_n(flag, 0, __ATOMIC_SEQ_CST) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_wait
+// Description  : Sleep on a ring word until it changes or is woken, the
+//                futex is shared between processes
+//
+// Inputs       : word - the head or tail to wait on
+//                seen - the value it had when this side went idle
+//                ms - the most milliseconds to sleep
+// Outputs      : 0 if woken or changed, -1 on timeout
+
+int smsa_shm_wait( uint32_t *word, uint32_t seen, int ms ) {
+
+	// Local variables
+	struct timespec ts;
+
+	ts.tv_sec = ms/1000;
+	ts.tv_nsec = (ms%1000)*1000000L;
+	if ( (syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0) == -1) && (errno == ETIMEDOUT) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_shm_wake
+// Description  : Wake the side sleeping on a ring word
+//
+// Inputs       : word - the head or tail it waits on
+// Outputs      : none
+
+void smsa_shm_wake( uint32_t *word ) {
+	syscall( SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0 );
+	return;
+}
@@ -0,0 +1,82 @@
+#ifndef SMSA_SHM_INCLUDED
+#define SMSA_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_shm.h
+//  Description    : This is the shared memory transport for SMSA clients on
+//                   the same host as the server.  Each client gets a pair
+//                   of single producer, single consumer byte rings (requests
+//                   and replies) carrying the same packets as the socket.
+//                   A side only sleeps after saying so in the ring, so the
+//                   other side only makes a system call to wake it then.
+//
+//   Author        : Mohanish Sheth
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define SMSA_SHM_RING_SIZE (1<<18)     // Bytes in each ring (a power of two)
+#define SMSA_SHM_NAME_SIZE 32          // Bytes of the segment name sent to the server
+#define SMSA_SHM_PREFIX "/smsa-"       // Every segment name starts with this
+#define SMSA_SHM_MAGIC 0x534d5341      // Marks a set up segment
+
+//
+// Type Definitions
+
+// One ring.  The consumer only writes head and consumer_waiting, the
+// producer only writes tail and producer_waiting, each pair on its own
+// cache line (a side clears the other's waiting flag to wake it).  head
+// and tail run free, the bytes in the ring are tail-head.
+typedef struct {
+    uint32_t         head __attribute__((aligned(64)));  // Next byte to take
+    uint32_t         consumer_waiting;                   // Consumer is asleep until tail moves
+    uint32_t         tail __attribute__((aligned(64)));  // Next byte to fill
+    uint32_t         producer_waiting;                   // Producer is asleep until head moves
+    unsigned char    data[SMSA_SHM_RING_SIZE] __attribute__((aligned(64)));
+} SMSA_SHM_RING;
+
+// The segment a client shares with the server
+typedef struct {
+    uint32_t         magic;    // SMSA_SHM_MAGIC once set up
+    SMSA_SHM_RING    req;      // Client to server
+    SMSA_SHM_RING    rep;      // Server to client
+} SMSA_SHM_SEGMENT;
+
+//
+// Funtional Prototypes
+
+// Create a new segment, its name goes in name (SMSA_SHM_NAME_SIZE bytes)
+SMSA_SHM_SEGMENT *smsa_shm_create( char *name );
+
+// Map the segment a client created
+SMSA_SHM_SEGMENT *smsa_shm_attach( const char *name );
+
+// Unmap a segment
+void smsa_shm_detach( SMSA_SHM_SEGMENT *seg );
+
+// Remove the name of a segment, it lives on while mapped
+void smsa_shm_unlink( const char *name );
+
+// Copy up to len bytes into the ring, returns the number copied
+uint32_t smsa_shm_put( SMSA_SHM_RING *ring, const unsigned char *data, uint32_t len );
+
+// Copy up to len bytes out of the ring, returns the number copied
+uint32_t smsa_shm_get( SMSA_SHM_RING *ring, unsigned char *data, uint32_t len );
+
+// Say this side is going to sleep, 1 if it may, 0 if the ring moved first
+int smsa_shm_idle( SMSA_SHM_RING *ring, int producer );
+
+// After moving the ring, 1 if the other side was asleep and has to be woken
+int smsa_shm_notify( SMSA_SHM_RING *ring, int producer );
+
+// Sleep while *word is still seen (up to ms milliseconds), -1 on timeout
+int smsa_shm_wait( uint32_t *word, uint32_t seen, int ms );
+
+// Wake whoever sleeps on word
+void smsa_shm_wake( uint32_t *word );
+
+#endif
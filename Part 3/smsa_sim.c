@@ -27,15 +27,20 @@
 #include <cmpsc311_util.h>
 
 // Defines
-#define SMSA_ARGUMENTS "huvl:c:"
+#define SMSA_ARGUMENTS "huvwl:c:p:a:f:n:"
 #define USAGE \
-	"USAGE: smsa [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: smsa [-h] [-v] [-w] [-l <logfile>] [-c <sz>] [-p <policy>] [-a <blocks>] [-f <file>] [-n <transport>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
+	"    -w - write-back caching (writes reach the array on eviction/sync/unmount)\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set cache size to <sz> lines\n" \
+	"    -p - set cache replacement policy (lru, clock, 2q, arc, lfu)\n" \
+	"    -a - prefetch up to <blocks> ahead of sequential/strided reads\n" \
+	"    -f - save the cache to <file> at unmount, warm it from there at mount\n" \
+	"    -n - reach the server by <transport> (tcp, shm, shm-poll)\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -64,8 +69,9 @@ int simulate_SMSA( char *wload, int cache_size );
 int main( int argc, char *argv[] )
 {
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, policy;
 	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
+	uint32_t window;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
@@ -79,6 +85,10 @@ int main( int argc, char *argv[] )
 			verbose = 1;
 			break;
 
+		case 'w': // Write-back caching
+			smsa_vset_write_back( 1 );
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -90,6 +100,39 @@ int main( int argc, char *argv[] )
 			}
 			break;
 
+		case 'p': // Set cache replacement policy
+			if ( (policy = smsa_cache_policy_lookup(optarg)) == -1 ) {
+			    fprintf( stderr, "Unknown cache policy (%s), aborting.\n", optarg );
+			    return( -1 );
+			}
+			smsa_set_cache_policy( policy );
+			break;
+
+		case 'a': // Set the readahead window
+			if ( sscanf( optarg, "%u", &window ) != 1 ) {
+			    fprintf( stderr, "Bad readahead window (%s), aborting.\n", optarg );
+			    return( -1 );
+			}
+			smsa_vset_readahead( window );
+			break;
+
+		case 'f': // Keep the cache in a snapshot file across mounts
+			smsa_vset_cache_file( optarg );
+			break;
+
+		case 'n': // Set the transport to the server
+			if ( strcmp(optarg, "tcp") == 0 ) {
+			    smsa_client_set_transport( SMSA_NET_TCP );
+			} else if ( strcmp(optarg, "shm") == 0 ) {
+			    smsa_client_set_transport( SMSA_NET_SHM );
+			} else if ( strcmp(optarg, "shm-poll") == 0 ) {
+			    smsa_client_set_transport( SMSA_NET_SHM_POLL );
+			} else {
+			    fprintf( stderr, "Unknown transport (%s), aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -144,7 +187,9 @@ int simulate_SMSA( char *wload, int cache_size ) {
 	char line[256], cmd[32];
 	unsigned char buf[SMSA_MAXIMUM_RDWR_SIZE], sig[CMPSC311_HASH_LENGTH], sigstr[CMPSC311_HASH_LENGTH*4];
 	FILE *fhandle = NULL;
-	uint32_t addr, len, ch, slen, op;
+	uint32_t addr, len, ch, slen;
+	uint32_t sign_ops[SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID];
+	int16_t sign_rets[SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID];
 	int i, j, err;
 
 	// Open the workload file
@@ -176,20 +221,31 @@ int simulate_SMSA( char *wload, int cache_size ) {
 			else if ( strncmp(SMSA_WORKLOAD_SIGNALL,line,strlen(SMSA_WORKLOAD_SIGNALL)) == 0 ) {
 				logMessage( LOG_INFO_LEVEL, "Computing signatures on the array.");
 
-				// Now just test the disk block signature generation
+				// The array has to see any writes still held in the cache
+				if ( smsa_vsync() ) {
+				    logMessage( LOG_ERROR_LEVEL, "Error syncing the cache before signing" );
+				    fclose( fhandle );
+				    return( -1 );
+				}
+
+				// Now just test the disk block signature generation, every
+				// block in one batch rather than a round trip each
 				for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
 					for ( j=0; j<SMSA_MAX_BLOCK_ID; j++ ) {
-
-					// Send the sign operation
-					op = encode_SMSA_operation( SMSA_BLOCK_SIGN, i, j );
-					if ( smsa_client_operation( op, NULL ) == -1 ) { 
-					    // Error out 
-					    logMessage( LOG_ERROR_LEVEL, "Error signing block [%d,%d]", i, j );
-					    fclose( fhandle );
-					    return( -1 );
+						sign_ops[i*SMSA_MAX_BLOCK_ID+j] = encode_SMSA_operation( SMSA_BLOCK_SIGN, i, j );
 					}
-
-				    }
+				}
+				memset( sign_rets, 0x0, sizeof(sign_rets) );
+				if ( smsa_client_operation_batch( sign_ops, NULL, sign_rets, SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID ) == -1 ) {
+					// Error out, naming the first block that failed
+					for ( i=0; (i<SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID) && (sign_rets[i] == 0); i++ );
+					if ( i < SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID ) {
+					    logMessage( LOG_ERROR_LEVEL, "Error signing block [%d,%d]", i/SMSA_MAX_BLOCK_ID, i%SMSA_MAX_BLOCK_ID );
+					} else {
+					    logMessage( LOG_ERROR_LEVEL, "Error signing the array" );
+					}
+					fclose( fhandle );
+					return( -1 );
 				}
 
 				// Now print out the performance of the system
@@ -17,14 +17,18 @@
 #include <cmpsc311_log.h>
 
 // Defines
-#define SMSA_ARGUMENTS "vhl:"
+#define SMSA_ARGUMENTS "vhsuzl:t:"
 #define USAGE \
-	"USAGE: smsasrvr [-h] [-v] [-l <logfile>]\n" \
+	"USAGE: smsasrvr [-h] [-v] [-s] [-u] [-z] [-l <logfile>] [-t <threads>]\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
+	"    -s - keep the array contents in smsa_data.dat between mounts\n" \
+	"    -u - serve clients from an io_uring loop instead of epoll\n" \
+	"    -z - send big extent reads straight from the array (MSG_ZEROCOPY)\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -t - run client operations on <threads> worker threads\n" \
 	"\n" \
 
 //
@@ -48,7 +52,7 @@
 int main( int argc, char *argv[] )
 {
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, threads;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
@@ -62,11 +66,30 @@ int main( int argc, char *argv[] )
 			verbose = 1;
 			break;
 
+		case 's': // Keep the array between mounts
+			smsa_set_storage( 1 );
+			break;
+
+		case 'u': // Use the io_uring loop
+			smsa_server_set_uring( 1 );
+			break;
+
+		case 'z': // Send big reads without copying them
+			smsa_server_set_zerocopy( 1 );
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
 			break;
 
+		case 't': // Run the operations on a worker pool
+			if ( (sscanf(optarg, "%d", &threads) != 1) || smsa_server_set_workers(threads) ) {
+				fprintf( stderr, "Bad worker thread count (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
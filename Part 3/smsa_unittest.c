@@ -53,36 +53,36 @@ int smsa_unit_test( void ) {
 	// PHASE 1 - FORMAT AND WRITE CONTENTS
 
 	// Start by mounting the drive and formatting each of the disks
-	smsa_operation( encode_SMSA_operation(SMSA_MOUNT, 0, 0), NULL );
+	smsa_operation( NULL, encode_SMSA_operation(SMSA_MOUNT, 0, 0), NULL );
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		smsa_operation( encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL );
+		smsa_operation( NULL, encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL );
 	}
 
 	// Now write blocks to each of the disks
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		smsa_operation( encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL ); // reset read head
+		smsa_operation( NULL, encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL ); // reset read head
 		for ( j=0; j<SMSA_MAX_BLOCK_ID; j++ ) {
-			smsa_operation( encode_SMSA_operation(SMSA_DISK_WRITE, 0, 0), test_disk_block(i,j,blk) );
+			smsa_operation( NULL, encode_SMSA_operation(SMSA_DISK_WRITE, 0, 0), test_disk_block(i,j,blk) );
 		}
 	}
 
 	// Unmount (and save to disk)
-	smsa_operation( encode_SMSA_operation(SMSA_UNMOUNT, 0, 0), NULL );
+	smsa_operation( NULL, encode_SMSA_operation(SMSA_UNMOUNT, 0, 0), NULL );
 
 	//
 	// PHASE 2 - READ CONTENTS
 
 	// Remount the array
-	smsa_operation( encode_SMSA_operation(SMSA_MOUNT, 0, 0), NULL );
+	smsa_operation( NULL, encode_SMSA_operation(SMSA_MOUNT, 0, 0), NULL );
 
 	// Now write blocks to each of the disks
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		smsa_operation( encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL ); // reset read head
+		smsa_operation( NULL, encode_SMSA_operation(SMSA_SEEK_DRUM, i, 0), NULL ); // reset read head
 		for ( j=SMSA_MAX_BLOCK_ID-1; j>=0; j-- ) {
 
 			// Seek to specific disk location and execute
-			smsa_operation( encode_SMSA_operation(SMSA_SEEK_BLOCK, 0, j), NULL ); // reset read head
-			smsa_operation( encode_SMSA_operation(SMSA_DISK_READ, 0, 0), blk2 );
+			smsa_operation( NULL, encode_SMSA_operation(SMSA_SEEK_BLOCK, 0, j), NULL ); // reset read head
+			smsa_operation( NULL, encode_SMSA_operation(SMSA_DISK_READ, 0, 0), blk2 );
 
 			// Now generate the disk block expected and compare
 			test_disk_block( i, j, blk );
@@ -100,7 +100,7 @@ int smsa_unit_test( void ) {
 	// Now just test the disk block signature generation
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
 		for ( j=0; j<SMSA_MAX_BLOCK_ID; j++ ) {
-			smsa_operation( encode_SMSA_operation(SMSA_BLOCK_SIGN, 0, j), NULL );
+			smsa_operation( NULL, encode_SMSA_operation(SMSA_BLOCK_SIGN, 0, j), NULL );
 		}
 	}
 